@@ -0,0 +1,121 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#include "allocguard.h"
+#include <stddef.h>
+#include <stdint.h>
+
+static __thread int watched = 0;
+static volatile unsigned long heapCalls = 0;
+
+static void note_call()
+{
+  if (watched) __sync_fetch_and_add(&heapCalls, 1);
+}
+
+#if defined(__GLIBC__)
+
+/* glibc exports its allocator under these names too, so ours can sit in
+   front of it without dlsym, which itself allocates */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+void *malloc(size_t size)
+{
+  note_call();
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+  note_call();
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  note_call();
+  return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+  if (ptr != NULL) note_call();
+  __libc_free(ptr);
+}
+
+int allocguard_supported(void)
+{
+  return 1;
+}
+
+#elif defined(__APPLE__)
+
+/* The hook malloc stack logging uses: libmalloc calls it for every
+   allocation and free in every zone. */
+typedef void (malloc_logger_t)(uint32_t type, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t result, uint32_t skipFrames);
+extern malloc_logger_t *malloc_logger;
+
+static void log_call(uint32_t type, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t result, uint32_t skipFrames)
+{
+  note_call();
+}
+
+static void install_logger(void) __attribute__((constructor));
+static void install_logger(void)
+{
+  malloc_logger = log_call;
+}
+
+int allocguard_supported(void)
+{
+  return 1;
+}
+
+#else
+
+int allocguard_supported(void)
+{
+  return 0;
+}
+
+#endif
+
+void allocguard_watch_thread(void)
+{
+  watched = 1;
+}
+
+void allocguard_unwatch_thread(void)
+{
+  watched = 0;
+}
+
+unsigned long allocguard_count(void)
+{
+  return heapCalls;
+}
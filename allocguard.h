@@ -0,0 +1,44 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#ifndef __allocguard_h__
+#define __allocguard_h__
+
+/* allocguard counts heap calls (malloc, calloc, realloc and free) made
+   by threads that ask to be watched, to check that streaming never
+   allocates. Linking it in interposes the allocator for the whole
+   program, so it belongs in test tools only. */
+
+/* Returns 0 where the allocator can't be watched. */
+int allocguard_supported(void);
+
+/* Start or stop counting the calling thread's heap calls. */
+void allocguard_watch_thread(void);
+void allocguard_unwatch_thread(void);
+
+/* Heap calls by watched threads so far. */
+unsigned long allocguard_count(void);
+
+#endif /* __allocguard_h__ */
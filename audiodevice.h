@@ -0,0 +1,57 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#ifndef __audiodevice_h__
+#define __audiodevice_h__
+
+/* The audio pipes reach the hardware only through this interface.
+   coreaudiodevice.c implements it on the default Mac OS X devices; a
+   stand-in can be linked in its place to drive the pipes without
+   hardware. Devices exchange interleaved stereo float samples. */
+
+enum { AUDIODEVICE_INPUT, AUDIODEVICE_OUTPUT };
+
+/* Called on the device's thread with samples to consume (input) or a
+   buffer to fill (output). hostTime is when the first sample was
+   captured or will be played, in seconds on the audiodevice_host_time
+   clock, or 0 if the device doesn't say. */
+typedef void (*audiodeviceProc)(void *context, float *samples, unsigned sampleCount, double hostTime);
+
+typedef struct audiodevice audiodevice;
+
+audiodevice *audiodevice_new(int direction, audiodeviceProc proc, void *context);
+void audiodevice_start(audiodevice *device);
+void audiodevice_stop(audiodevice *device);
+void audiodevice_free(audiodevice *device);
+
+/* The device's nominal sample rate, in frames per second. It is read
+   when the device is opened and kept current afterwards, so callers can
+   compare it against the rate they set up for to spot a change. */
+double audiodevice_get_rate(audiodevice *device);
+
+/* Seconds on the clock callbacks are timestamped with. */
+double audiodevice_host_time(void);
+
+#endif /* __audiodevice_h__ */
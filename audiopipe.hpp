@@ -0,0 +1,156 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#ifndef __audiopipe_hpp__
+#define __audiopipe_hpp__
+
+/* A header-only C++ layer over audiopipeout and audiopipein. The sample
+   type, byte order and channel count are template parameters, so the
+   conversion loop in write() and read() is chosen at compile time and
+   inlined, with byte swapping folded in, rather than reached through a
+   function pointer and a separate swap pass. The pipe is created in the
+   constructor and freed in the destructor. */
+
+extern "C" {
+#include "audiopipeout.h"
+#include "audiopipein.h"
+}
+
+namespace audiopipe {
+
+enum Endian { NativeEndian, SwappedEndian };
+
+template <typename Sample> struct Format;
+
+#define AUDIOPIPE_FORMAT(TYPE, NAME, S16) \
+template <> struct Format<TYPE> { \
+  enum { isS16 = S16 }; \
+  static float toFloat(TYPE v) { return NAME##_to_float(v); } \
+  static TYPE fromFloat(float f) { return float_to_##NAME(f); } \
+};
+
+AUDIOPIPE_FORMAT(char, s8, 0)
+AUDIOPIPE_FORMAT(unsigned char, u8, 0)
+AUDIOPIPE_FORMAT(short, s16, 1)
+AUDIOPIPE_FORMAT(unsigned short, u16, 0)
+AUDIOPIPE_FORMAT(long, s32, 0)
+AUDIOPIPE_FORMAT(unsigned long, u32, 0)
+
+#undef AUDIOPIPE_FORMAT
+
+template <> struct Format<float> {
+  enum { isS16 = 0 };
+  static float toFloat(float v) { return v; }
+  static float fromFloat(float f) { return f; }
+};
+
+template <typename Sample, Endian E> struct ByteOrder {
+  static Sample apply(Sample v) { return v; }
+};
+
+template <typename Sample> struct ByteOrder<Sample, SwappedEndian> {
+  static Sample apply(Sample v) {
+    union { Sample s; unsigned char c[sizeof(Sample)]; } in, out;
+    unsigned i;
+    in.s = v;
+    for (i = 0; i < sizeof(Sample); i++) out.c[i] = in.c[sizeof(Sample) - 1 - i];
+    return out.s;
+  }
+};
+
+enum { kChunkSamples = 1024 };
+
+template <typename Sample, int Channels = 2, Endian E = NativeEndian>
+class AudioPipeOut {
+  typedef char channels_must_be_1_or_2[(Channels == 1 || Channels == 2) ? 1 : -1];
+public:
+  explicit AudioPipeOut(float rate, int frameBufferSize = 131072, int storeFormat = STORE_FLOAT)
+    : ap_(apo_new_with_storage(rate, Channels == 1, frameBufferSize, storeFormat)) {}
+  ~AudioPipeOut() { apo_free(ap_); }
+
+  void write(const Sample *samples, unsigned sampleCount) {
+    /* native s16 can go straight into a compact queue */
+    if (Format<Sample>::isS16 && E == NativeEndian) {
+      apo_write_s16_samples(ap_, (short*)samples, sampleCount);
+      return;
+    }
+    while (sampleCount > 0) {
+      float buf[kChunkSamples];
+      unsigned n = (sampleCount < kChunkSamples) ? sampleCount : kChunkSamples;
+      for (unsigned i = 0; i < n; i++) {
+        buf[i] = Format<Sample>::toFloat(ByteOrder<Sample, E>::apply(samples[i]));
+      }
+      apo_write_float_samples(ap_, buf, n);
+      samples += n;
+      sampleCount -= n;
+    }
+  }
+
+  audiopipeout *get() { return ap_; }
+
+private:
+  AudioPipeOut(const AudioPipeOut &);
+  AudioPipeOut &operator=(const AudioPipeOut &);
+  audiopipeout *ap_;
+};
+
+template <typename Sample, int Channels = 2, Endian E = NativeEndian>
+class AudioPipeIn {
+  typedef char channels_must_be_1_or_2[(Channels == 1 || Channels == 2) ? 1 : -1];
+public:
+  explicit AudioPipeIn(float rate, int frameBufferSize = 4096, int storeFormat = STORE_FLOAT)
+    : ap_(api_new_with_storage(rate, Channels == 1, frameBufferSize, storeFormat)) {}
+  ~AudioPipeIn() { api_free(ap_); }
+
+  /* Blocks until something is captured; returns the samples read. */
+  unsigned read(Sample *samples, unsigned maxSampleCount) {
+    float buf[kChunkSamples];
+    unsigned n;
+    if (Format<Sample>::isS16) {
+      n = api_read_s16_samples(ap_, (short*)samples, maxSampleCount);
+      if (E == SwappedEndian) {
+        for (unsigned i = 0; i < n; i++) samples[i] = ByteOrder<Sample, E>::apply(samples[i]);
+      }
+      return n;
+    }
+    if (maxSampleCount > kChunkSamples) maxSampleCount = kChunkSamples;
+    n = api_read_float_samples(ap_, buf, maxSampleCount);
+    for (unsigned i = 0; i < n; i++) {
+      samples[i] = ByteOrder<Sample, E>::apply(Format<Sample>::fromFloat(buf[i]));
+    }
+    return n;
+  }
+
+  audiopipein *get() { return ap_; }
+
+private:
+  AudioPipeIn(const AudioPipeIn &);
+  AudioPipeIn &operator=(const AudioPipeIn &);
+  audiopipein *ap_;
+};
+
+} /* namespace audiopipe */
+
+#endif /* __audiopipe_hpp__ */
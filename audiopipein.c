@@ -24,94 +24,716 @@
 */
 
 #include "audiopipein.h"
-#include <CoreAudio/CoreAudio.h>
+#include "trace.h"
+#include <string.h>
+#include <strings.h>
 
-static void resamplerCallback(void *context, const float *resampledData, unsigned resampledDataCount)
+#define SKIP_LOG_SIZE 256
+#define OVERRUN_LOG_SIZE 256
+/* the spill buffer holds this many queues' worth */
+#define SPILL_QUEUES 8
+
+/* The spill buffer is a FIFO behind the queue that only the callback
+   touches. It is allocated when the policy is chosen, so the callback
+   never allocates; when it too is full the rest is an overrun. */
+static int spill_append(audiopipein *ap, const char *bytes, unsigned length)
+{
+  if (ap->spillUsed + length > ap->spillSize) return -1;
+  if (ap->spillStart + ap->spillUsed + length > ap->spillSize) {
+    memmove(ap->spill, ap->spill + ap->spillStart, ap->spillUsed);
+    ap->spillStart = 0;
+  }
+  memcpy(ap->spill + ap->spillStart + ap->spillUsed, bytes, length);
+  ap->spillUsed += length;
+  return 0;
+}
+
+static void spill_drain(audiopipein *ap)
+{
+  unsigned added;
+  if (ap->spillUsed == 0) return;
+  added = addBytesNoWait(&ap->tq, ap->spill + ap->spillStart, ap->spillUsed);
+  ap->spillStart += added;
+  ap->spillUsed -= added;
+  if (ap->spillUsed == 0) ap->spillStart = 0;
+}
+
+/* Queue samples without ever waiting for the reader; what happens when
+   it has fallen behind is up to the overrun policy. Losses are logged
+   at the read position where the gap will appear. */
+static void store_bytes(audiopipein *ap, const void *bytes, unsigned length)
 {
-  threadedqueue *tq = (threadedqueue *)context;
-  addBytes(tq, resampledData, resampledDataCount * sizeof(float));
+  unsigned sampleSize = ap->sampleSize;
+  unsigned stored, lost, queuedBefore;
+
+  switch (ap->overrunPolicy) {
+  case OVERRUN_OVERWRITE_OLDEST:
+    lost = addBytesOverwriting(&ap->tq, bytes, length, &queuedBefore);
+    if (lost > 0) rangelog_add_nowait(&ap->overruns, ap->samplesQueued - queuedBefore / sampleSize, lost / sampleSize);
+    ap->samplesQueued += (length - lost) / sampleSize;
+    break;
+  case OVERRUN_SPILL:
+    /* once anything has spilled, the rest follows it to keep order */
+    stored = (ap->spillUsed == 0) ? addBytesNoWait(&ap->tq, bytes, length) : 0;
+    ap->samplesQueued += stored / sampleSize;
+    if (stored < length) {
+      if (spill_append(ap, (const char*)bytes + stored, length - stored) == 0) {
+        ap->samplesQueued += (length - stored) / sampleSize;
+      } else {
+        rangelog_add_nowait(&ap->overruns, ap->samplesQueued, (length - stored) / sampleSize);
+      }
+    }
+    break;
+  default:
+    stored = addBytesNoWait(&ap->tq, bytes, length);
+    ap->samplesQueued += stored / sampleSize;
+    if (stored < length) rangelog_add_nowait(&ap->overruns, ap->samplesQueued, (length - stored) / sampleSize);
+  }
 }
 
-static OSStatus audioProc(AudioDeviceID 	inDevice,
-                const AudioTimeStamp*	inNow,
-		const AudioBufferList*	inInputData,
-		const AudioTimeStamp*	inInputTime,
-		AudioBufferList* 	outOutputData, 
-		const AudioTimeStamp*	inOutputTime,
-		void*			inClientData)
+static void enqueue_float(audiopipein *ap, const float *samples, unsigned count)
 {
-  audiopipein *ap = (audiopipein *)inClientData;
-  unsigned byteCount = inInputData->mBuffers[0].mDataByteSize;
-  float *samples = (float*)inInputData->mBuffers[0].mData;
+  short sBuf[1024];
 
+  if (ap->storeFormat == STORE_FLOAT) {
+    store_bytes(ap, samples, count * sizeof(float));
+    return;
+  }
+  while (count > 0) {
+    unsigned toConvert = count;
+    if (toConvert > 1024) toConvert = 1024;
+    convert_float_to_s16(sBuf, samples, toConvert);
+    store_bytes(ap, sBuf, toConvert * sizeof(short));
+    samples += toConvert;
+    count -= toConvert;
+  }
+}
+
+static void resamplerCallback(void *context, const float *resampledData, unsigned resampledDataCount)
+{
+  enqueue_float((audiopipein *)context, resampledData, resampledDataCount);
+}
+
+static void deliver(audiopipein *ap, float *samples, unsigned sampleCount)
+{
   if (ap->resampler != NULL) {
-    resampler_scale_data(ap->resampler, samples, byteCount / sizeof(float));
+    resampler_scale_data(ap->resampler, samples, sampleCount);
     resampler_flush(ap->resampler);
   } else {
-    addBytes(&ap->tq, samples, byteCount);
+    enqueue_float(ap, samples, sampleCount);
+  }
+}
+
+static resampler *new_resampler(audiopipein *ap, double deviceRate)
+{
+  resampler *rs = resampler_new_with_quality(deviceRate, ap->rate, resamplerCallback, ap->isMono ? 1 : 2, ap->quality);
+  resampler_set_buffer_size(rs, 1024);
+  resampler_set_context(rs, ap);
+  resampler_set_quality(rs, governor_quality(&ap->governor));
+  return rs;
+}
+
+/* Set up for the device's current rate: no resampler at all when it
+   matches the stream. Runs on the device's thread after a change. */
+static void configure_rate(audiopipein *ap)
+{
+  double deviceRate = audiodevice_get_rate(ap->device);
+
+  if (ap->deviceRate != 0.0) {
+    ap->gateHoldSamples = ap->gateHoldSamples * (deviceRate / ap->deviceRate);
+  }
+  ap->deviceRate = deviceRate;
+  ap->outputPerDeviceSample = ap->rate / deviceRate;
+  dsp_set_rate(&ap->dsp, deviceRate);
+  if (ap->resampler != NULL) {
+    resampler_drain(ap->resampler);
+    resampler_free(ap->resampler);
+    ap->resampler = NULL;
+  }
+  if (ap->rate != deviceRate) ap->resampler = new_resampler(ap, deviceRate);
+}
+
+/* Leave a resampler for api_set_resampler_quality or api_free to free;
+   returns 0 if both places are taken. */
+static int retire_resampler(audiopipein *ap, resampler *rs)
+{
+  unsigned i;
+  for (i = 0; i < 2; i++) {
+    if (__sync_bool_compare_and_swap(&ap->retiredResamplers[i], NULL, rs)) return 0;
+  }
+  return -1;
+}
+
+/* Swap in a resampler api_set_resampler_quality built, unless the
+   device's rate has moved on since. */
+static void take_next_resampler(audiopipein *ap)
+{
+  resampler *next = __sync_lock_test_and_set(&ap->nextResampler, NULL);
+  resampler *old = ap->resampler;
+
+  if (next == NULL) return;
+  if (next->inputRate != (float)ap->deviceRate) old = next;
+  if (old != NULL && retire_resampler(ap, old) != 0) {
+    /* nowhere to put it yet: try again next block */
+    __sync_bool_compare_and_swap(&ap->nextResampler, NULL, next);
+    return;
+  }
+  if (old == next) return;
+  if (old != NULL) resampler_drain(old);
+  ap->resampler = next;
+}
+
+static void free_retired_resamplers(audiopipein *ap)
+{
+  unsigned i;
+  for (i = 0; i < 2; i++) {
+    resampler *rs = __sync_lock_test_and_set(&ap->retiredResamplers[i], NULL);
+    if (rs != NULL) resampler_free(rs);
+  }
+}
+
+/* Taps drop what doesn't fit; losses are logged like the pipe's own. */
+static void tap_store(audiopipetap *tap, const void *bytes, unsigned length)
+{
+  unsigned stored = addBytesNoWait(&tap->tq, bytes, length);
+  tap->samplesQueued += stored / tap->sampleSize;
+  if (stored < length) rangelog_add_nowait(&tap->overruns, tap->samplesQueued, (length - stored) / tap->sampleSize);
+}
+
+static void deliver_to_taps(tapconverter *tc, const float *samples, unsigned count)
+{
+  short sBuf[API_TAP_CHUNK];
+  int haveShorts = 0;
+  unsigned i;
+
+  for (i = 0; i < tc->tapCount; i++) {
+    audiopipetap *tap = tc->taps[i];
+    if (tap->storeFormat == STORE_FLOAT) {
+      tap_store(tap, samples, count * sizeof(float));
+      continue;
+    }
+    /* converted once for all the 16 bit taps at this rate */
+    if (!haveShorts) convert_float_to_s16(sBuf, samples, count);
+    haveShorts = 1;
+    tap_store(tap, sBuf, count * sizeof(short));
+  }
+}
+
+static void converterCallback(void *context, const float *resampledData, unsigned resampledDataCount)
+{
+  tapconverter *tc = (tapconverter *)context;
+  while (resampledDataCount > 0) {
+    unsigned count = resampledDataCount;
+    if (count > API_TAP_CHUNK) count = API_TAP_CHUNK;
+    deliver_to_taps(tc, resampledData, count);
+    resampledData += count;
+    resampledDataCount -= count;
+  }
+}
+
+/* Give a tap the converter for its rate from deviceRate, adding one and
+   any halvings it needs. Called with tapLock held. */
+static void assign_tap(audiopipein *ap, audiopipetap *tap, double deviceRate)
+{
+  unsigned halvings = 0;
+  tapconverter *tc = NULL;
+  unsigned i;
+
+  /* halve while the level below still carries the tap's band */
+  while (halvings < API_MAX_HALVINGS && deviceRate / (2 << halvings) >= tap->frameRate) halvings++;
+  for (i = 0; i < ap->converterCount; i++) {
+    if (ap->converters[i].halvings == halvings && ap->converters[i].rate == tap->rate) tc = &ap->converters[i];
+  }
+  if (tc == NULL) {
+    double levelRate = deviceRate / (1 << halvings);
+    tc = &ap->converters[ap->converterCount++];
+    tc->halvings = halvings;
+    tc->rate = tap->rate;
+    tc->resampler = NULL;
+    tc->tapCount = 0;
+    if (levelRate != tap->rate) {
+      tc->resampler = resampler_new_with_quality(levelRate, tap->rate, converterCallback, tap->channelCount, ap->quality);
+      resampler_set_buffer_size(tc->resampler, API_TAP_CHUNK);
+      resampler_set_context(tc->resampler, tc);
+      resampler_set_quality(tc->resampler, governor_quality(&ap->governor));
+    }
+  }
+  tc->taps[tc->tapCount++] = tap;
+  while (ap->halvingCount < halvings) init_halfband(&ap->halvings[ap->halvingCount++]);
+}
+
+/* Rebuild every tap's stages for deviceRate. Called with tapLock held,
+   from api_add_tap and api_set_resampler_quality, and on the device's
+   thread only after a change of rate. */
+static void configure_taps(audiopipein *ap, double deviceRate)
+{
+  unsigned i;
+  for (i = 0; i < ap->converterCount; i++) {
+    if (ap->converters[i].resampler == NULL) continue;
+    resampler_drain(ap->converters[i].resampler);
+    resampler_free(ap->converters[i].resampler);
+  }
+  ap->converterCount = 0;
+  ap->halvingCount = 0;
+  for (i = 0; i < ap->tapCount; i++) assign_tap(ap, ap->taps[i], deviceRate);
+  ap->tapDeviceRate = deviceRate;
+}
+
+static void convert_for_taps(tapconverter *tc, const float *samples, unsigned sampleCount)
+{
+  if (tc->resampler != NULL) {
+    resampler_scale_data(tc->resampler, (float *)samples, sampleCount);
+    resampler_flush(tc->resampler);
+  } else {
+    deliver_to_taps(tc, samples, sampleCount);
+  }
+}
+
+/* Run one piece down the cascade, handing each level to the converters
+   that start from it. */
+static void cascade(audiopipein *ap, const float *samples, unsigned sampleCount)
+{
+  unsigned level, i;
+  for (level = 0; ; level++) {
+    for (i = 0; i < ap->converterCount; i++) {
+      if (ap->converters[i].halvings == level) convert_for_taps(&ap->converters[i], samples, sampleCount);
+    }
+    if (level == ap->halvingCount) break;
+    sampleCount = halfband_process(&ap->halvings[level], samples, sampleCount, ap->halvingBuffers[level]);
+    samples = ap->halvingBuffers[level];
+  }
+}
+
+static void feed_taps(audiopipein *ap, const float *samples, unsigned sampleCount)
+{
+  unsigned i;
+
+  if (ap->tapCount == 0) return;
+  if (pthread_mutex_trylock(&ap->tapLock) != 0) {
+    /* a tap is being added; the rest miss this block, logged once the
+       taps are ours again */
+    ap->tapMissedSamples += sampleCount;
+    return;
+  }
+  for (i = 0; i < ap->tapCount; i++) {
+    audiopipetap *tap = ap->taps[i];
+    if (ap->tapMissedSamples > 0) {
+      rangelog_add_nowait(&tap->overruns, tap->samplesQueued, (unsigned long long)(ap->tapMissedSamples * tap->rate / ap->deviceRate));
+    }
+    rangelog_publish(&tap->overruns);
+  }
+  ap->tapMissedSamples = 0;
+  if (ap->tapDeviceRate != ap->deviceRate) configure_taps(ap, ap->deviceRate);
+  while (sampleCount > 0) {
+    unsigned count = sampleCount;
+    if (count > API_TAP_CHUNK) count = API_TAP_CHUNK;
+    cascade(ap, samples, count);
+    samples += count;
+    sampleCount -= count;
+  }
+  pthread_mutex_unlock(&ap->tapLock);
+}
+
+static void capture(audiopipein *ap, float *samples, unsigned sampleCount, double hostTime)
+{
+  audiolevels levels;
+  int gated = 0;
+
+  if (audiodevice_get_rate(ap->device) != ap->deviceRate) configure_rate(ap);
+  if (ap->nextResampler != NULL) take_next_resampler(ap);
+  /* whatever spilled goes back in ahead of this block */
+  spill_drain(ap);
+  rangelog_publish(&ap->overruns);
+  rangelog_publish(&ap->skips);
+
+  levels_measure(&levels, samples, sampleCount / 2);
+  ap->levelsSequence++;
+  __sync_synchronize();
+  ap->levels = levels;
+  ap->blockCount++;
+  __sync_synchronize();
+  ap->levelsSequence++;
+
+  if (ap->gateThreshold > 0.0) {
+    if (levels_loudest_rms(&levels) >= ap->gateThreshold) {
+      ap->gateHoldRemaining = ap->gateHoldSamples;
+    } else if (ap->gateHoldRemaining >= sampleCount) {
+      ap->gateHoldRemaining -= sampleCount;
+    } else {
+      /* gate closed: drop the block and note where the gap is */
+      unsigned long long skipped;
+      ap->gateHoldRemaining = 0;
+      ap->gateSkipRemainder += sampleCount * ap->outputPerDeviceSample;
+      skipped = (unsigned long long)ap->gateSkipRemainder;
+      ap->gateSkipRemainder -= skipped;
+      if (skipped > 0) rangelog_add_nowait(&ap->skips, ap->samplesQueued, skipped);
+      gated = 1;
+    }
+  }
+  /* the gate is the pipe's own; taps still want the block */
+  if (gated && ap->tapCount == 0) return;
+
+  if (hostTime != 0.0 && !gated) {
+    /* the next sample queued is centred this far into the block */
+    float offset = (ap->resampler != NULL) ? resampler_next_output_offset(ap->resampler) : 0.0;
+    timeline_mark(&ap->captureTimes, ap->samplesQueued, hostTime + offset / (ap->deviceRate * 2));
+  }
+
+  if (ap->dsp.stageCount == 0) {
+    if (!gated) deliver(ap, samples, sampleCount);
+    feed_taps(ap, samples, sampleCount);
+    return;
+  }
+  /* process a copy; the device's buffer is only ours to read */
+  while (sampleCount > 0) {
+    float fBuf[1024];
+    unsigned toCopy = sampleCount;
+    if (toCopy > 1024) toCopy = 1024;
+    memcpy(fBuf, samples, toCopy * sizeof(float));
+    dsp_process(&ap->dsp, fBuf, toCopy);
+    if (!gated) deliver(ap, fBuf, toCopy);
+    feed_taps(ap, fBuf, toCopy);
+    samples += toCopy;
+    sampleCount -= toCopy;
+  }
+}
+
+/* Every converter follows the governor. Called with tapLock held. */
+static void set_tap_quality(audiopipein *ap, int quality)
+{
+  unsigned i;
+  for (i = 0; i < ap->converterCount; i++) {
+    if (ap->converters[i].resampler != NULL) resampler_set_quality(ap->converters[i].resampler, quality);
   }
-  return 0;
+}
+
+static void audioProc(void *context, float *samples, unsigned sampleCount, double hostTime)
+{
+  audiopipein *ap = (audiopipein *)context;
+  int governed = (ap->governor.budget > 0.0);
+  double started = 0.0;
+
+  TRACE_BEGIN(input_callback);
+  TRACE_COUNTER(input_queue_bytes, ap->tq.bytesInQueue);
+  if (governed) started = audiodevice_host_time();
+  capture(ap, samples, sampleCount, hostTime);
+  if (governed) {
+    double spent = audiodevice_host_time() - started;
+    int before = governor_quality(&ap->governor);
+    int quality = governor_block(&ap->governor, spent, sampleCount / (ap->deviceRate * 2), ap->samplesQueued);
+    if (quality != before) {
+      if (ap->resampler != NULL) resampler_set_quality(ap->resampler, quality);
+      if (pthread_mutex_trylock(&ap->tapLock) == 0) {
+        set_tap_quality(ap, quality);
+        pthread_mutex_unlock(&ap->tapLock);
+      }
+    }
+  }
+  TRACE_END(input_callback);
 }
 
 audiopipein *api_new(float rate, int isMono, int frameBufferSize)
 {
-  OSStatus s;
-  AudioDeviceID inputDevice;
-  Boolean writeable;
-  UInt32 ioPropertyDataSize;
+  return api_new_with_storage(rate, isMono, frameBufferSize, STORE_FLOAT);
+}
+
+audiopipein *api_new_with_storage(float rate, int isMono, int frameBufferSize, int storeFormat)
+{
   audiopipein *ap = (audiopipein*)malloc(sizeof(audiopipein));
   
-  init_threadedqueue(&ap->tq, frameBufferSize * sizeof(float));
+  ap->storeFormat = storeFormat;
+  ap->sampleSize = (storeFormat == STORE_S16) ? sizeof(short) : sizeof(float);
+  init_threadedqueue(&ap->tq, frameBufferSize * ap->sampleSize);
+  ap->levelsSequence = 0;
+  bzero(&ap->levels, sizeof(ap->levels));
+  ap->blockCount = 0;
+  ap->samplesQueued = 0;
+  ap->gateThreshold = 0.0;
+  ap->gateHoldSamples = 0;
+  ap->gateHoldRemaining = 0;
+  ap->gateSkipRemainder = 0.0;
+  init_rangelog(&ap->skips, SKIP_LOG_SIZE);
+  ap->overrunPolicy = OVERRUN_DROP_NEWEST;
+  init_rangelog(&ap->overruns, OVERRUN_LOG_SIZE);
+  ap->spill = NULL;
+  ap->spillStart = 0;
+  ap->spillUsed = 0;
+  ap->spillSize = 0;
   if (isMono) rate = rate / 2.0;
+  ap->rate = rate;
+  ap->isMono = isMono;
+  ap->quality = RESAMPLER_BOX;
+  init_governor(&ap->governor, RESAMPLER_BOX, 0.0);
+  ap->nextResampler = NULL;
+  ap->retiredResamplers[0] = NULL;
+  ap->retiredResamplers[1] = NULL;
+  init_timeline(&ap->captureTimes, 1.0 / (rate * 2));
+  ap->samplesRead = 0;
   ap->resampler = NULL;
-  if (rate != 44100.0) {
-    ap->resampler = resampler_new(44100.0, rate, resamplerCallback);
-    resampler_set_buffer_size(ap->resampler, 1024);
-    resampler_set_context(ap->resampler, ap);
-  }
-  s = AudioHardwareGetPropertyInfo(kAudioHardwarePropertyDefaultInputDevice, &ioPropertyDataSize, &writeable);
-
-  s = AudioHardwareGetProperty(kAudioHardwarePropertyDefaultInputDevice, &ioPropertyDataSize, &inputDevice);
-
-  s = AudioDeviceAddIOProc(inputDevice, audioProc, ap);
-  s = AudioDeviceStart(inputDevice, audioProc);
+  pthread_mutex_init(&ap->tapLock, NULL);
+  ap->tapCount = 0;
+  ap->tapDeviceRate = 0.0;
+  ap->tapMissedSamples = 0;
+  ap->converterCount = 0;
+  ap->halvingCount = 0;
+  ap->device = audiodevice_new(AUDIODEVICE_INPUT, audioProc, ap);
+  ap->deviceRate = 0.0;
+  dsp_init(&ap->dsp, audiodevice_get_rate(ap->device), 2);
+  configure_rate(ap);
+  audiodevice_start(ap->device);
   return ap;
 }
 
-#define DECLARE(NAME, TYPE, ADDITOR, MULTIPLIER) \
-unsigned NAME(audiopipein *ap, TYPE samples[], unsigned maxFrameCount) { \
-  unsigned samplesRead, loop; \
-  float *fsamples = (float*)alloca(2048 * sizeof(float)); \
+#define DECLARE(NAME, PIPE, READ_FLOAT, TYPE, FORMAT) \
+unsigned NAME(PIPE *ap, TYPE samples[], unsigned maxFrameCount) { \
+  unsigned samplesRead, i; \
+  float fsamples[2048]; \
   if (maxFrameCount > 2048) maxFrameCount = 2048; \
-  samplesRead = api_read_float_samples(ap, fsamples, maxFrameCount); \
-  loop = samplesRead; \
-  while (loop-- > 0) { \
-    *samples++ = *fsamples++ * MULTIPLIER + ADDITOR; \
+  samplesRead = READ_FLOAT(ap, fsamples, maxFrameCount); \
+  for (i = 0; i < samplesRead; i++) { \
+    samples[i] = float_to_##FORMAT(fsamples[i]); \
   } \
   return samplesRead; \
 }
 
-DECLARE(api_read_s8_samples, char, 0, 0x7f)
-DECLARE(api_read_s16_samples, short, 0, 0x7fff)
-DECLARE(api_read_s32_samples, long, 0, 0x7fffffff)
-DECLARE(api_read_u8_samples, unsigned char, 0x80, 0x7f)
-DECLARE(api_read_u16_samples, unsigned short, 0x8000, 0x7fff)
-DECLARE(api_read_u32_samples, unsigned long, ((unsigned)0x80000000), 0x7fffffff)
+DECLARE(api_read_s8_samples, audiopipein, api_read_float_samples, char, s8)
+DECLARE(api_read_s32_samples, audiopipein, api_read_float_samples, long, s32)
+DECLARE(api_read_u8_samples, audiopipein, api_read_float_samples, unsigned char, u8)
+DECLARE(api_read_u16_samples, audiopipein, api_read_float_samples, unsigned short, u16)
+DECLARE(api_read_u32_samples, audiopipein, api_read_float_samples, unsigned long, u32)
+DECLARE(api_tap_read_s8_samples, audiopipetap, api_tap_read_float_samples, char, s8)
+DECLARE(api_tap_read_s32_samples, audiopipetap, api_tap_read_float_samples, long, s32)
+DECLARE(api_tap_read_u8_samples, audiopipetap, api_tap_read_float_samples, unsigned char, u8)
+DECLARE(api_tap_read_u16_samples, audiopipetap, api_tap_read_float_samples, unsigned short, u16)
+DECLARE(api_tap_read_u32_samples, audiopipetap, api_tap_read_float_samples, unsigned long, u32)
+
+static unsigned read_queue(threadedqueue *tq, unsigned sampleSize, void *samples, unsigned maxFrameCount)
+{
+  /* read 'em from queue, in whatever format they are stored */
+  unsigned bytesToMove = waitForMinimumBytes(tq, sampleSize);
+  bytesToMove = bytesToMove & (~(sampleSize-1));
+  if (bytesToMove > maxFrameCount * sampleSize) bytesToMove = maxFrameCount * sampleSize;
+  bytesToMove = removeBytesTo(tq, samples, bytesToMove, bytesToMove);
+  return bytesToMove / sampleSize;
+}
+
+static unsigned read_stored_samples(audiopipein *ap, void *samples, unsigned maxFrameCount)
+{
+  unsigned samplesRead = read_queue(&ap->tq, ap->sampleSize, samples, maxFrameCount);
+  ap->samplesRead += samplesRead;
+  return samplesRead;
+}
+
+static unsigned read_tap_samples(audiopipetap *tap, void *samples, unsigned maxFrameCount)
+{
+  unsigned samplesRead = read_queue(&tap->tq, tap->sampleSize, samples, maxFrameCount);
+  tap->samplesRead += samplesRead;
+  return samplesRead;
+}
+
+unsigned api_read_s16_samples(audiopipein *ap, short *samples, unsigned maxFrameCount)
+{
+  unsigned samplesRead;
+  float fsamples[2048];
+
+  if (ap->storeFormat == STORE_S16) return read_stored_samples(ap, samples, maxFrameCount);
+  if (maxFrameCount > 2048) maxFrameCount = 2048;
+  samplesRead = read_stored_samples(ap, fsamples, maxFrameCount);
+  convert_float_to_s16(samples, fsamples, samplesRead);
+  return samplesRead;
+}
 
 unsigned api_read_float_samples(audiopipein *ap, float *samples, unsigned maxFrameCount)
 {
-  /* read 'em from queue */
-  unsigned bytesToMove = waitForMinimumBytes(&ap->tq, sizeof(float));
-  bytesToMove = bytesToMove & (~(sizeof(float)-1));
-  if (bytesToMove > maxFrameCount * sizeof(float)) bytesToMove = maxFrameCount * sizeof(float);
-  bytesToMove = removeBytesTo(&ap->tq, samples, bytesToMove, bytesToMove);
-  return bytesToMove / sizeof(float);
+  unsigned samplesRead;
+  short ssamples[2048];
+
+  if (ap->storeFormat == STORE_FLOAT) return read_stored_samples(ap, samples, maxFrameCount);
+  if (maxFrameCount > 2048) maxFrameCount = 2048;
+  samplesRead = read_stored_samples(ap, ssamples, maxFrameCount);
+  convert_s16_to_float(samples, ssamples, samplesRead);
+  return samplesRead;
+}
+
+unsigned api_tap_read_s16_samples(audiopipetap *tap, short *samples, unsigned maxFrameCount)
+{
+  unsigned samplesRead;
+  float fsamples[2048];
+
+  if (tap->storeFormat == STORE_S16) return read_tap_samples(tap, samples, maxFrameCount);
+  if (maxFrameCount > 2048) maxFrameCount = 2048;
+  samplesRead = read_tap_samples(tap, fsamples, maxFrameCount);
+  convert_float_to_s16(samples, fsamples, samplesRead);
+  return samplesRead;
+}
+
+unsigned api_tap_read_float_samples(audiopipetap *tap, float *samples, unsigned maxFrameCount)
+{
+  unsigned samplesRead;
+  short ssamples[2048];
+
+  if (tap->storeFormat == STORE_FLOAT) return read_tap_samples(tap, samples, maxFrameCount);
+  if (maxFrameCount > 2048) maxFrameCount = 2048;
+  samplesRead = read_tap_samples(tap, ssamples, maxFrameCount);
+  convert_s16_to_float(samples, ssamples, samplesRead);
+  return samplesRead;
+}
+
+audiopipetap *api_add_tap(audiopipein *ap, float rate, int isMono, int frameBufferSize, int storeFormat)
+{
+  double deviceRate = audiodevice_get_rate(ap->device);
+  audiopipetap *tap;
+
+  if (ap->tapCount == API_MAX_TAPS) return NULL;
+  tap = (audiopipetap*)malloc(sizeof(audiopipetap));
+  tap->storeFormat = storeFormat;
+  tap->sampleSize = (storeFormat == STORE_S16) ? sizeof(short) : sizeof(float);
+  init_threadedqueue(&tap->tq, frameBufferSize * tap->sampleSize);
+  tap->frameRate = rate;
+  tap->rate = isMono ? rate / 2.0 : rate;
+  tap->channelCount = isMono ? 1 : 2;
+  tap->samplesQueued = 0;
+  tap->samplesRead = 0;
+  init_rangelog(&tap->overruns, OVERRUN_LOG_SIZE);
+
+  /* converters are built here rather than on the device's thread */
+  pthread_mutex_lock(&ap->tapLock);
+  ap->taps[ap->tapCount] = tap;
+  /* the callback may look at the count without the lock */
+  __sync_synchronize();
+  ap->tapCount++;
+  if (ap->tapDeviceRate == deviceRate) assign_tap(ap, tap, deviceRate);
+  else configure_taps(ap, deviceRate);
+  pthread_mutex_unlock(&ap->tapLock);
+  return tap;
+}
+
+unsigned api_tap_take_overrun_ranges(audiopipetap *tap, samplerange ranges[], unsigned maxCount)
+{
+  return rangelog_take(&tap->overruns, ranges, maxCount);
+}
+
+unsigned long api_tap_overrun_count(audiopipetap *tap)
+{
+  return rangelog_event_count(&tap->overruns);
+}
+
+unsigned long api_get_levels(audiopipein *ap, audiolevels *levels)
+{
+  unsigned long blockCount;
+  unsigned long sequence;
+  do {
+    sequence = ap->levelsSequence;
+    __sync_synchronize();
+    *levels = ap->levels;
+    blockCount = ap->blockCount;
+    __sync_synchronize();
+  } while ((sequence & 1) || ap->levelsSequence != sequence);
+  return blockCount;
+}
+
+void api_set_silence_gate(audiopipein *ap, float thresholdDb, float holdSeconds)
+{
+  ap->gateThreshold = (thresholdDb < 0.0) ? levels_db_to_linear(thresholdDb) : 0.0;
+  /* hold is counted in device samples: two per stereo frame */
+  ap->gateHoldSamples = holdSeconds * ap->deviceRate * 2;
+}
+
+unsigned api_take_skipped_ranges(audiopipein *ap, samplerange ranges[], unsigned maxCount)
+{
+  return rangelog_take(&ap->skips, ranges, maxCount);
+}
+
+void api_set_overrun_policy(audiopipein *ap, int policy)
+{
+  if (policy == OVERRUN_SPILL && ap->spill == NULL) {
+    ap->spillSize = ap->tq.maxDataSize * SPILL_QUEUES;
+    ap->spill = (char*)malloc(ap->spillSize);
+    if (ap->spill == NULL) ap->spillSize = 0;
+    /* the callback may be running: publish the buffer before the policy */
+    __sync_synchronize();
+  }
+  ap->overrunPolicy = policy;
+}
+
+unsigned api_take_overrun_ranges(audiopipein *ap, samplerange ranges[], unsigned maxCount)
+{
+  return rangelog_take(&ap->overruns, ranges, maxCount);
+}
+
+unsigned long api_overrun_count(audiopipein *ap)
+{
+  return rangelog_event_count(&ap->overruns);
+}
+
+void api_set_resampler_quality(audiopipein *ap, int quality, float budget)
+{
+  double deviceRate = audiodevice_get_rate(ap->device);
+  resampler *superseded;
+
+  if (quality < RESAMPLER_BOX) quality = RESAMPLER_BOX;
+  if (quality >= RESAMPLER_QUALITY_COUNT) quality = RESAMPLER_QUALITY_COUNT - 1;
+  ap->quality = quality;
+  governor_set(&ap->governor, quality, budget);
+  /* everything is built here, off the capture thread: the taps'
+     converters under tapLock, and the pipe's own resampler for the
+     callback to swap in */
+  pthread_mutex_lock(&ap->tapLock);
+  if (ap->tapCount > 0) configure_taps(ap, deviceRate);
+  pthread_mutex_unlock(&ap->tapLock);
+  free_retired_resamplers(ap);
+  superseded = __sync_lock_test_and_set(&ap->nextResampler, NULL);
+  if (superseded != NULL) resampler_free(superseded);
+  if (ap->rate != deviceRate) {
+    resampler *rs = new_resampler(ap, deviceRate);
+    __sync_synchronize();
+    ap->nextResampler = rs;
+  }
+}
+
+unsigned api_take_quality_switches(audiopipein *ap, qualityswitch switches[], unsigned maxCount)
+{
+  return governor_take_switches(&ap->governor, switches, maxCount);
+}
+
+unsigned long long api_read_position(audiopipein *ap)
+{
+  return ap->samplesRead;
+}
+
+int api_capture_time(audiopipein *ap, unsigned long long readPosition, double *hostTime)
+{
+  return timeline_lookup(&ap->captureTimes, readPosition, hostTime);
+}
+
+dspchain *api_dsp(audiopipein *ap)
+{
+  return &ap->dsp;
 }
 
 void api_free(audiopipein *ap)
 {
+  unsigned i;
+
+  audiodevice_stop(ap->device);
+  audiodevice_free(ap->device);
+  for (i = 0; i < ap->tapCount; i++) {
+    destroy_threadedqueue(&ap->taps[i]->tq);
+    destroy_rangelog(&ap->taps[i]->overruns);
+    free(ap->taps[i]);
+  }
+  for (i = 0; i < ap->converterCount; i++) {
+    if (ap->converters[i].resampler != NULL) resampler_free(ap->converters[i].resampler);
+  }
+  pthread_mutex_destroy(&ap->tapLock);
+  destroy_rangelog(&ap->skips);
+  destroy_rangelog(&ap->overruns);
+  destroy_governor(&ap->governor);
+  free(ap->spill);
   destroy_threadedqueue(&ap->tq);
   if (ap->resampler) resampler_free(ap->resampler);
+  if (ap->nextResampler) resampler_free(ap->nextResampler);
+  free_retired_resamplers(ap);
   free(ap);
 }
 
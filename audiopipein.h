@@ -35,16 +35,110 @@
 
 #include "threadedqueue.h"
 #include "resampler.h"
+#include "governor.h"
+#include "convert.h"
+#include "levels.h"
+#include "rangelog.h"
+#include "audiodevice.h"
+#include "dsp.h"
+#include "timeline.h"
+#include "halfband.h"
 
+#define API_MAX_TAPS 8
+/* enough to take 192 kHz down to 12 kHz before the last resampler */
+#define API_MAX_HALVINGS 4
+/* taps are fed in pieces this many samples long */
+#define API_TAP_CHUNK 1024
+
+/* An extra output at its own rate and storage format, with its own
+   queue. */
 typedef struct {
   threadedqueue tq;
+  float frameRate;
+  float rate;
+  unsigned channelCount;
+  int storeFormat;
+  unsigned sampleSize;
+  unsigned long long samplesQueued;
+  unsigned long long samplesRead;
+  rangelog overruns;
+} audiopipetap;
+
+/* The last step to one tap rate from one level of the halving cascade,
+   shared by every tap that wants that rate. */
+typedef struct {
+  unsigned halvings;
+  float rate;
   resampler *resampler;
+  unsigned tapCount;
+  audiopipetap *taps[API_MAX_TAPS];
+} tapconverter;
+
+typedef struct {
+  threadedqueue tq;
+  audiodevice *device;
+  /* api_set_resampler_quality builds the next resampler and the capture
+     callback swaps it in, leaving the old one here to be freed */
+  resampler *volatile nextResampler;
+  resampler *volatile retiredResamplers[2];
+  resampler *resampler;
+  int quality;
+  governor governor;
+  float rate;
+  int isMono;
+  double deviceRate;
+  int storeFormat;
+  unsigned sampleSize;
+  /* odd while the callback writes levels and blockCount; readers retry */
+  volatile unsigned long levelsSequence;
+  audiolevels levels;
+  unsigned long blockCount;
+  float outputPerDeviceSample;
+  unsigned long long samplesQueued;
+  float gateThreshold;
+  unsigned gateHoldSamples;
+  unsigned gateHoldRemaining;
+  double gateSkipRemainder;
+  rangelog skips;
+  int overrunPolicy;
+  rangelog overruns;
+  char *spill;
+  unsigned spillStart;
+  unsigned spillUsed;
+  unsigned spillSize;
+  dspchain dsp;
+  timeline captureTimes;
+  unsigned long long samplesRead;
+  /* taps, and the stages feeding them; the callback only tries the lock */
+  pthread_mutex_t tapLock;
+  volatile unsigned tapCount;
+  audiopipetap *taps[API_MAX_TAPS];
+  double tapDeviceRate;
+  unsigned long tapMissedSamples;
+  unsigned converterCount;
+  tapconverter converters[API_MAX_TAPS];
+  unsigned halvingCount;
+  halfband halvings[API_MAX_HALVINGS];
+  float halvingBuffers[API_MAX_HALVINGS][API_TAP_CHUNK / 2];
 } audiopipein;
 
 
-/* Larger buffers reduces dropout probability. */
+/* What the capture callback does with samples the queue has no room
+   for. It never waits for the reader. */
+enum { OVERRUN_DROP_NEWEST, OVERRUN_OVERWRITE_OLDEST, OVERRUN_SPILL };
+
+/* Larger buffers reduces dropout probability. Captured samples are
+   resampled from the device's nominal rate, following it if it changes,
+   and go straight to the queue when the rates already match. Everything
+   capture needs is allocated here, and by api_add_tap for taps; after
+   that the capture callback allocates only when the device's rate
+   changes. */
 audiopipein *api_new(float rate, int isMono, int frameBufferSize);
 
+/* As api_new, but captured samples are kept in storeFormat (STORE_FLOAT or
+   STORE_S16) until they are read. */
+audiopipein *api_new_with_storage(float rate, int isMono, int frameBufferSize, int storeFormat);
+
 unsigned api_read_s8_samples(audiopipein *ap, char *samples, unsigned maxFrameCount);
 unsigned api_read_u8_samples(audiopipein *ap, unsigned char *samples, unsigned maxFrameCount);
 unsigned api_read_s16_samples(audiopipein *ap, short *samples, unsigned maxFrameCount);
@@ -53,6 +147,83 @@ unsigned api_read_s32_samples(audiopipein *ap, long *samples, unsigned maxFrameC
 unsigned api_read_u32_samples(audiopipein *ap, unsigned long *samples, unsigned maxFrameCount);
 unsigned api_read_float_samples(audiopipein *ap, float *samples, unsigned maxFrameCount);
 
+/* Levels of the most recent capture block, and how many blocks there
+   have been. */
+unsigned long api_get_levels(audiopipein *ap, audiolevels *levels);
+
+/* Drop capture blocks quieter than thresholdDb (rms of the louder
+   channel, in dBFS) once the input has been quiet for holdSeconds.
+   A threshold of 0 dB or more turns the gate off. */
+void api_set_silence_gate(audiopipein *ap, float thresholdDb, float holdSeconds);
+
+/* Ranges the gate dropped, in samples of the stream api_read_* returns.
+   A range's position is the count of samples read before the gap. */
+unsigned api_take_skipped_ranges(audiopipein *ap, samplerange ranges[], unsigned maxCount);
+
+/* OVERRUN_DROP_NEWEST (the default) throws away what doesn't fit,
+   OVERRUN_OVERWRITE_OLDEST makes room by throwing away the oldest queued
+   samples, and OVERRUN_SPILL keeps what doesn't fit in a secondary
+   buffer, eight times the queue's size and allocated here, that feeds
+   the queue as it drains. Call it before capture gets going. */
+void api_set_overrun_policy(audiopipein *ap, int policy);
+
+/* Ranges lost to overruns, positioned like api_take_skipped_ranges, and
+   how many overruns there have been. */
+unsigned api_take_overrun_ranges(audiopipein *ap, samplerange ranges[], unsigned maxCount);
+unsigned long api_overrun_count(audiopipein *ap);
+
+/* Resample at quality (RESAMPLER_BOX, the default, up to RESAMPLER_SINC),
+   each channel separately, taps included. With a budget, the share of
+   real time the capture callback may spend (e.g. 0.25), a governor
+   drops a tier at a time while it spends more and comes back as it
+   recovers, crossfading each change; 0 keeps to quality. */
+void api_set_resampler_quality(audiopipein *ap, int quality, float budget);
+
+/* The governor's switches since the last call, positioned in samples
+   queued for api_read_*. */
+unsigned api_take_quality_switches(audiopipein *ap, qualityswitch switches[], unsigned maxCount);
+
+/* Samples returned by api_read_* so far. */
+unsigned long long api_read_position(audiopipein *ap);
+
+/* When the sample at a read position was captured, on the
+   audiodevice_host_time clock, allowing for the resampler's delay.
+   Returns -1 if the device hasn't supplied any timestamps. */
+int api_capture_time(audiopipein *ap, unsigned long long readPosition, double *hostTime);
+
+/* The processing chain applied to captured samples before resampling, at
+   the device's rate, in stereo, and redesigned if that changes. It starts
+   out empty. */
+dspchain *api_dsp(audiopipein *ap);
+
+/* Add an output at rate (per channel) from the same capture, after the
+   processing chain but not the silence gate, kept in storeFormat in a
+   queue of frameBufferSize samples. Taps share their work: the device
+   stream is halved by a cascade of halfband filters as far as the
+   lowest rate needs, each rate is resampled once from the closest level
+   at or above it, and taps with the same rate share that resampler; a
+   rate the cascade reaches exactly needs none. So 44.1 kHz taps at
+   22050, 16000 and 8000 cost two halvings and two resamplers. A tap
+   drops what doesn't fit in its queue. The tap's stages are built here,
+   for the device's rate, and rebuilt by the capture callback only if
+   that changes. Add taps before capture gets going: while one is added
+   the others lose a block. Returns NULL when there are API_MAX_TAPS
+   already. */
+audiopipetap *api_add_tap(audiopipein *ap, float rate, int isMono, int frameBufferSize, int storeFormat);
+
+unsigned api_tap_read_s8_samples(audiopipetap *tap, char *samples, unsigned maxFrameCount);
+unsigned api_tap_read_u8_samples(audiopipetap *tap, unsigned char *samples, unsigned maxFrameCount);
+unsigned api_tap_read_s16_samples(audiopipetap *tap, short *samples, unsigned maxFrameCount);
+unsigned api_tap_read_u16_samples(audiopipetap *tap, unsigned short *samples, unsigned maxFrameCount);
+unsigned api_tap_read_s32_samples(audiopipetap *tap, long *samples, unsigned maxFrameCount);
+unsigned api_tap_read_u32_samples(audiopipetap *tap, unsigned long *samples, unsigned maxFrameCount);
+unsigned api_tap_read_float_samples(audiopipetap *tap, float *samples, unsigned maxFrameCount);
+
+/* Ranges a tap lost, positioned in its own stream, and how many losses. */
+unsigned api_tap_take_overrun_ranges(audiopipetap *tap, samplerange ranges[], unsigned maxCount);
+unsigned long api_tap_overrun_count(audiopipetap *tap);
+
+/* Taps are freed with their pipe. */
 void api_free(audiopipein *ap);
 
 #endif /* __audiopipein_h__ */
@@ -24,105 +24,679 @@
 */
 
 #include "audiopipeout.h"
-#include <CoreAudio/CoreAudio.h>
+#include "trace.h"
 #include <string.h>
+#include <time.h>
 
-static OSStatus audioProc(AudioDeviceID inDevice,
-			  const AudioTimeStamp *inNow,
-			  const AudioBufferList *inInputData,
-			  const AudioTimeStamp *inInputTime,
-			  AudioBufferList *outOutputData, 
-			  const AudioTimeStamp *inOutputTime,
-			  void *inClientData)
-{
-    audiopipeout *pipe = (audiopipeout *)inClientData;
-    AudioBuffer *buffer = outOutputData->mBuffers;
-
-    unsigned readBytes = removeBytesTo(&pipe->tq, buffer->mData, buffer->mDataByteSize, buffer->mDataByteSize);
-    if (readBytes < buffer->mDataByteSize) {
-      /* fill remainder with nulls */
-      bzero(((char*)buffer->mData) + readBytes, buffer->mDataByteSize - readBytes);
+/* ramps in and out of concealment, in frames (about 3 ms) */
+#define CONCEAL_FADE_FRAMES 128
+/* how fast a repeated period dies away, per frame */
+#define CONCEAL_REPEAT_DECAY 0.9995
+#define UNDERRUN_LOG_SIZE 64
+/* silence run through the dsp chain on a drain, to let its filters ring
+   out, and room for a drain's tail past the join, in seconds */
+#define DRAIN_RING_SECONDS 0.02
+#define CARRY_SECONDS 0.25
+
+static unsigned render_s16(audiopipeout *pipe, float *dst, unsigned sampleCount)
+{
+  unsigned rendered = 0;
+
+  /* convert straight out of the queue into the device buffer */
+  while (rendered < sampleCount) {
+    void *src;
+    unsigned count = peekBytesNoWait(&pipe->tq, &src) / sizeof(short);
+    if (count == 0) break;
+    if (count > sampleCount - rendered) count = sampleCount - rendered;
+    convert_s16_to_float(dst + rendered, (const short*)src, count);
+    removeBytes(&pipe->tq, count * sizeof(short));
+    rendered += count;
+  }
+  return rendered;
+}
+
+static void start_concealment(audiopipeout *pipe)
+{
+  pipe->holdFrame[0] = pipe->lastFrame[0];
+  pipe->holdFrame[1] = pipe->lastFrame[1];
+  pipe->concealStep = 0;
+  pipe->historyRead = 0;
+  pipe->historyStart = pipe->historyWrite;
+  pipe->repeatGain = 1.0;
+  pipe->isConcealing = 1;
+}
+
+/* Frame j of the repeated loop. The history is played from CONCEAL_FADE_FRAMES
+   in, and the end of each pass crossfades into the frames before that so
+   the loop point doesn't click. */
+static float repeated_sample(audiopipeout *pipe, unsigned j, unsigned channel)
+{
+  const unsigned loopFrames = CONCEAL_HISTORY_FRAMES - CONCEAL_FADE_FRAMES;
+  const float *h = pipe->history;
+  unsigned at = (pipe->historyStart + CONCEAL_FADE_FRAMES + j) % CONCEAL_HISTORY_FRAMES;
+  float v = h[at * 2 + channel];
+
+  if (j >= loopFrames - CONCEAL_FADE_FRAMES) {
+    unsigned k = j - (loopFrames - CONCEAL_FADE_FRAMES);
+    float w = (float)k / CONCEAL_FADE_FRAMES;
+    unsigned before = (pipe->historyStart + k) % CONCEAL_HISTORY_FRAMES;
+    v = v * (1.0 - w) + h[before * 2 + channel] * w;
+  }
+  return v;
+}
+
+/* The next concealment sample: the last sample played, ramping down, with
+   the repeated history ramping up under it. */
+static float conceal_sample(audiopipeout *pipe, unsigned channel)
+{
+  float hold = 0.0;
+  float v;
+
+  if (pipe->concealment == CONCEAL_SILENCE) return 0.0;
+  if (pipe->concealStep < CONCEAL_FADE_FRAMES) hold = 1.0 - (float)pipe->concealStep / CONCEAL_FADE_FRAMES;
+  v = pipe->holdFrame[channel] * hold;
+  if (pipe->concealment == CONCEAL_REPEAT) {
+    v += repeated_sample(pipe, pipe->historyRead, channel) * (1.0 - hold) * pipe->repeatGain;
+  }
+  if (channel == 1) {
+    pipe->concealStep++;
+    if (pipe->concealment == CONCEAL_REPEAT) {
+      pipe->historyRead = (pipe->historyRead + 1) % (CONCEAL_HISTORY_FRAMES - CONCEAL_FADE_FRAMES);
+      pipe->repeatGain *= CONCEAL_REPEAT_DECAY;
     }
-    return 0;
+  }
+  return v;
+}
+
+static void remember_output(audiopipeout *pipe, const float *samples, unsigned sampleCount)
+{
+  unsigned i;
+
+  for (i = 0; i + 1 < sampleCount; i += 2) {
+    pipe->history[pipe->historyWrite * 2] = samples[i];
+    pipe->history[pipe->historyWrite * 2 + 1] = samples[i + 1];
+    pipe->historyWrite = (pipe->historyWrite + 1) % CONCEAL_HISTORY_FRAMES;
+  }
+}
+
+/* Device buffers always start on a frame, so sample i is channel i & 1. */
+static void audioProc(void *context, float *samples, unsigned sampleCount, double hostTime)
+{
+    audiopipeout *pipe = (audiopipeout *)context;
+    unsigned got, i;
+
+    TRACE_BEGIN(output_callback);
+    TRACE_COUNTER(output_queue_bytes, pipe->tq.bytesInQueue);
+    if (hostTime != 0.0) timeline_mark(&pipe->playTimes, pipe->samplesPlayed, hostTime);
+    rangelog_publish(&pipe->underruns);
+    if (pipe->storeFormat == STORE_S16) {
+      got = render_s16(pipe, samples, sampleCount);
+    } else {
+      got = removeBytesNoWait(&pipe->tq, samples, sampleCount * sizeof(float)) / sizeof(float);
+    }
+    pipe->samplesPlayed += got;
+
+    if (got > 0) {
+      remember_output(pipe, samples, got);
+      /* crossfade from the concealment back to the audio */
+      for (i = 0; i < got && pipe->fadeInRemaining > 0; i++) {
+        float in = 1.0 - (float)pipe->fadeInRemaining / (CONCEAL_FADE_FRAMES * 2);
+        samples[i] = samples[i] * in + conceal_sample(pipe, i & 1) * (1.0 - in);
+        pipe->fadeInRemaining--;
+      }
+      if (pipe->fadeInRemaining == 0) pipe->isConcealing = 0;
+      for (i = (got > 2) ? got - 2 : 0; i < got; i++) pipe->lastFrame[i & 1] = samples[i];
+    }
+
+    if (got < sampleCount) {
+      TRACE_BEGIN(output_underrun);
+      if (pipe->samplesPlayed > 0 && !pipe->isFinished) {
+        rangelog_add_nowait(&pipe->underruns, pipe->samplesPlayed, sampleCount - got);
+      }
+      if (!pipe->isConcealing) start_concealment(pipe);
+      for (i = got; i < sampleCount; i++) samples[i] = conceal_sample(pipe, i & 1);
+      pipe->fadeInRemaining = (pipe->concealment == CONCEAL_SILENCE) ? 0 : CONCEAL_FADE_FRAMES * 2;
+      for (i = (sampleCount > 2) ? sampleCount - 2 : 0; i < sampleCount; i++) pipe->lastFrame[i & 1] = samples[i];
+      TRACE_END(output_underrun);
+    }
+    TRACE_END(output_callback);
+}
+
+/* While governed, time spent waiting for the device isn't processing. */
+static void queue_bytes(audiopipeout *ap, const void *bytes, unsigned length)
+{
+  double started;
+
+  if (ap->governor.budget <= 0.0) {
+    addBytes(&ap->tq, bytes, length);
+    return;
+  }
+  started = audiodevice_host_time();
+  addBytes(&ap->tq, bytes, length);
+  ap->waitSeconds += audiodevice_host_time() - started;
+}
+
+static void queue_float(audiopipeout *ap, const float *samples, unsigned count)
+{
+  short sBuf[1024];
+
+  ap->samplesQueued += count;
+  if (ap->storeFormat == STORE_FLOAT) {
+    queue_bytes(ap, samples, count * sizeof(float));
+    return;
+  }
+  while (count > 0) {
+    unsigned toConvert = count;
+    if (toConvert > 1024) toConvert = 1024;
+    convert_float_to_s16(sBuf, samples, toConvert);
+    queue_bytes(ap, sBuf, toConvert * sizeof(short));
+    samples += toConvert;
+    count -= toConvert;
+  }
+}
+
+/* Keep samples past the join as the tail to add into what follows it. */
+static void carry_tail(audiopipeout *ap, const float *samples, unsigned count)
+{
+  unsigned i;
+
+  if (ap->carryStart + ap->tailCount + count > ap->carryCapacity) {
+    memmove(ap->carry, ap->carry + ap->carryStart, ap->carryCount * sizeof(float));
+    ap->carryStart = 0;
+  }
+  /* past the room there is, the tail has faded and is dropped */
+  if (ap->tailCount + count > ap->carryCapacity) count = ap->carryCapacity - ap->tailCount;
+  for (i = 0; i < count; i++) {
+    unsigned at = ap->tailCount + i;
+    if (at < ap->carryCount) ap->carry[ap->carryStart + at] += samples[i];
+    else ap->carry[ap->carryStart + at] = samples[i];
+  }
+  ap->tailCount += count;
+  if (ap->tailCount > ap->carryCount) ap->carryCount = ap->tailCount;
+}
+
+/* The hook sees samples as they came out of the pipe; the queue gets
+   them with the carried tail added in. While draining, what lands past
+   the join is carried instead. */
+static void enqueue_float(audiopipeout *ap, const float *samples, unsigned count)
+{
+  float mixed[1024];
+  unsigned over = 0;
+
+  if (ap->outputHook != NULL) ap->outputHook(ap->outputHookContext, samples, count);
+  if (ap->isDraining && ap->samplesQueued + count > ap->joinAt) {
+    over = (ap->samplesQueued < ap->joinAt) ? (unsigned)(ap->samplesQueued + count - ap->joinAt) : count;
+    count -= over;
+  }
+  while (count > 0 && ap->carryCount > 0) {
+    unsigned n = count, i;
+    if (n > ap->carryCount) n = ap->carryCount;
+    if (n > 1024) n = 1024;
+    for (i = 0; i < n; i++) mixed[i] = samples[i] + ap->carry[ap->carryStart + i];
+    ap->carryStart += n;
+    ap->carryCount -= n;
+    queue_float(ap, mixed, n);
+    samples += n;
+    count -= n;
+  }
+  if (ap->carryCount == 0) ap->carryStart = 0;
+  if (count > 0) queue_float(ap, samples, count);
+  if (over > 0) carry_tail(ap, samples + count, over);
 }
 
 static void resamplerCallback(void *context, const float *resampledData, unsigned resampledDataCount)
 {
-  threadedqueue *tq = (threadedqueue *)context;
-  addBytes(tq, resampledData, resampledDataCount * sizeof(float));
+  enqueue_float((audiopipeout *)context, resampledData, resampledDataCount);
+}
+
+static void resample_and_enqueue(audiopipeout *ap, float samples[], unsigned count)
+{
+  /* should we adjust for rate shift? */
+  if (ap->resampler != NULL) {
+    resampler_scale_data(ap->resampler, samples, count);
+    resampler_flush(ap->resampler);
+  } else {
+    enqueue_float(ap, samples, count);
+  }
+}
+
+static void stretchCallback(void *context, const float *stretchedData, unsigned stretchedDataCount)
+{
+  resample_and_enqueue((audiopipeout *)context, (float *)stretchedData, stretchedDataCount);
 }
 
 audiopipeout *apo_new(float rate, int isMono, int frameBufferSize)
 {
-  OSStatus s;
-  AudioDeviceID outputDevice;
-  Boolean writeable;
-  UInt32 ioPropertyDataSize;
-  audiopipeout *ap = (audiopipeout*)malloc(sizeof(audiopipeout));
-  init_threadedqueue(&ap->tq, frameBufferSize * sizeof(float));
-  if (isMono) rate = rate / 2.0;
-  ap->resampler = NULL;
-  if (rate != 44100.0) {
-    ap->resampler = resampler_new(rate, 44100.0, resamplerCallback);
+  return apo_new_with_storage(rate, isMono, frameBufferSize, STORE_FLOAT);
+}
+
+/* Set up for the device's current rate: no resampler at all when the
+   stream already matches it. Samples queued before a change play at the
+   new rate. */
+static void configure_rate(audiopipeout *ap)
+{
+  unsigned carryCapacity;
+
+  ap->deviceRate = audiodevice_get_rate(ap->device);
+  carryCapacity = (unsigned)(ap->deviceRate * CARRY_SECONDS) * 2;
+  if (carryCapacity > ap->carryCapacity) {
+    ap->carry = (float*)realloc(ap->carry, carryCapacity * sizeof(float));
+    ap->carryCapacity = carryCapacity;
+  }
+  timeline_set_slope(&ap->queuePositions, ap->deviceRate / (ap->rate * ap->stretchFactor));
+  timeline_set_slope(&ap->playTimes, 1.0 / (ap->deviceRate * 2));
+  if (ap->resampler != NULL) {
+    resampler_drain(ap->resampler);
+    resampler_free(ap->resampler);
+    ap->resampler = NULL;
+  }
+  if (ap->rate != ap->deviceRate) {
+    ap->resampler = resampler_new_with_quality(ap->rate, ap->deviceRate, resamplerCallback, ap->dsp.channelCount, ap->quality);
     resampler_set_buffer_size(ap->resampler, 1024);
     resampler_set_context(ap->resampler, ap);
+    /* a drain's tail and the next start's lead-in add up at the join */
+    resampler_set_overlapping_edges(ap->resampler, 1);
+    resampler_set_quality(ap->resampler, governor_quality(&ap->governor));
   }
-  s = AudioHardwareGetPropertyInfo(kAudioHardwarePropertyDefaultOutputDevice, &ioPropertyDataSize, &writeable);
+}
 
-  s = AudioHardwareGetProperty(kAudioHardwarePropertyDefaultOutputDevice, &ioPropertyDataSize, &outputDevice);
+audiopipeout *apo_new_with_storage(float rate, int isMono, int frameBufferSize, int storeFormat)
+{
+  return apo_new_elastic(rate, isMono, frameBufferSize, frameBufferSize, storeFormat);
+}
 
-  s = AudioDeviceAddIOProc(outputDevice, audioProc, ap);
-  s = AudioDeviceStart(outputDevice, audioProc);
+audiopipeout *apo_new_elastic(float rate, int isMono, int minFrameBufferSize, int maxFrameBufferSize, int storeFormat)
+{
+  audiopipeout *ap = (audiopipeout*)malloc(sizeof(audiopipeout));
+  ap->storeFormat = storeFormat;
+  ap->sampleSize = (storeFormat == STORE_S16) ? sizeof(short) : sizeof(float);
+  init_threadedqueue_elastic(&ap->tq, minFrameBufferSize * ap->sampleSize, maxFrameBufferSize * ap->sampleSize);
+  dsp_init(&ap->dsp, rate, isMono ? 1 : 2);
+  ap->samplesWritten = 0;
+  ap->samplesQueued = 0;
+  ap->samplesPlayed = 0;
+  if (isMono) rate = rate / 2.0;
+  ap->rate = rate;
+  init_timeline(&ap->queuePositions, 1.0);
+  init_timeline(&ap->playTimes, 1.0);
+  ap->resampler = NULL;
+  ap->quality = RESAMPLER_BOX;
+  init_governor(&ap->governor, RESAMPLER_BOX, 0.0);
+  ap->waitSeconds = 0.0;
+  ap->stretch = NULL;
+  ap->stretchFactor = 1.0;
+  ap->concealment = CONCEAL_FADE;
+  ap->isConcealing = 0;
+  ap->fadeInRemaining = 0;
+  ap->lastFrame[0] = ap->lastFrame[1] = 0.0;
+  ap->historyWrite = 0;
+  memset(ap->history, 0, sizeof(ap->history));
+  init_rangelog(&ap->underruns, UNDERRUN_LOG_SIZE);
+  ap->outputHook = NULL;
+  ap->outputHookContext = NULL;
+  ap->isHoldingSample = 0;
+  ap->carry = NULL;
+  ap->carryStart = 0;
+  ap->carryCount = 0;
+  ap->carryCapacity = 0;
+  ap->isDraining = 0;
+  ap->isDrained = 1;
+  ap->isFinished = 0;
+  ap->device = audiodevice_new(AUDIODEVICE_OUTPUT, audioProc, ap);
+  configure_rate(ap);
+  audiodevice_start(ap->device);
   return ap;
 }
 
-#define DECLARE(NAME, TYPE, SUBTRACTAND, DIVISOR) \
+/* Where the next sample written will land in the queue, counting the
+   offset in stretched samples and the resampler's delay. */
+static double next_queue_position(audiopipeout *ap)
+{
+  double ahead = 0.0;
+  if (ap->stretch != NULL) ahead += wsola_next_output_offset(ap->stretch);
+  if (ap->resampler != NULL) ahead -= resampler_next_output_offset(ap->resampler);
+  return ap->samplesQueued + ahead * ap->deviceRate / ap->rate;
+}
+
+static void mark_queue_position(audiopipeout *ap, unsigned frameCount)
+{
+  timeline_mark(&ap->queuePositions, ap->samplesWritten, next_queue_position(ap));
+  ap->samplesWritten += frameCount;
+  ap->isFinished = 0;
+}
+
+/* samples are ours to modify: run the dsp chain in place, then stretch
+   and resample */
+static void process_frames(audiopipeout *ap, float samples[], unsigned frameCount)
+{
+  if (ap->dsp.stageCount > 0) dsp_process(&ap->dsp, samples, frameCount);
+  if (ap->stretch != NULL) {
+    wsola_process(ap->stretch, samples, frameCount);
+  } else {
+    resample_and_enqueue(ap, samples, frameCount);
+  }
+}
+
+static void write_frames(audiopipeout *ap, float samples[], unsigned frameCount)
+{
+  int governed = (ap->governor.budget > 0.0 && ap->resampler != NULL);
+  double started = 0.0;
+
+  if (governed) {
+    started = audiodevice_host_time();
+    ap->waitSeconds = 0.0;
+  }
+  if (audiodevice_get_rate(ap->device) != ap->deviceRate) configure_rate(ap);
+  mark_queue_position(ap, frameCount);
+  ap->isDrained = 0;
+  process_frames(ap, samples, frameCount);
+  if (governed && ap->resampler != NULL) {
+    double spent = audiodevice_host_time() - started - ap->waitSeconds;
+    double heard = frameCount / (ap->rate * 2 * ap->stretchFactor);
+    int quality = governor_block(&ap->governor, spent, heard, ap->samplesWritten);
+    resampler_set_quality(ap->resampler, quality);
+  }
+}
+
+/* The stages all work in whole frames, and a caller reading a stream in
+   arbitrary pieces may end a write half way through one: keep that half
+   until the next write completes it. */
+static void write_converted(audiopipeout *ap, float samples[], unsigned frameCount)
+{
+  if (ap->dsp.channelCount == 1) {
+    write_frames(ap, samples, frameCount);
+    return;
+  }
+  if (frameCount == 0) return;
+  if (ap->isHoldingSample) {
+    float frame[2];
+    frame[0] = ap->heldSample;
+    frame[1] = samples[0];
+    ap->isHoldingSample = 0;
+    write_frames(ap, frame, 2);
+    samples++;
+    frameCount--;
+  }
+  if (frameCount & 1) {
+    ap->heldSample = samples[frameCount - 1];
+    ap->isHoldingSample = 1;
+    frameCount--;
+  }
+  if (frameCount > 0) write_frames(ap, samples, frameCount);
+}
+
+#define DECLARE(NAME, TYPE, FORMAT) \
 void NAME(audiopipeout *ap, TYPE samples[], unsigned frameCount) { \
   const int kMaxSamples = 1024; \
   float fBuf[kMaxSamples]; \
-  float *dst; \
-  TYPE *src = samples; \
   while (frameCount > 0) { \
     unsigned toConvert = frameCount; \
-    unsigned count; \
+    unsigned i; \
     if (toConvert > kMaxSamples) toConvert = kMaxSamples; \
-    dst = fBuf; \
-    count = toConvert; \
-    while (count-- > 0) { \
-      *dst++ = (*src++ - SUBTRACTAND) / ((float)DIVISOR); \
+    for (i = 0; i < toConvert; i++) { \
+      fBuf[i] = FORMAT##_to_float(samples[i]); \
     } \
-    apo_write_float_samples(ap, fBuf, toConvert); \
+    write_converted(ap, fBuf, toConvert); \
+    samples += toConvert; \
     frameCount -= toConvert; \
   } \
 }
 
-DECLARE(apo_write_s8_samples, char, 0, 128)
-DECLARE(apo_write_u8_samples, unsigned char, 128, 128)
-DECLARE(apo_write_s16_samples, short, 0, 32768)
-DECLARE(apo_write_u16_samples, unsigned short, 32768, 32768)
-DECLARE(apo_write_s32_samples, long, 0, 0x80000000)
-DECLARE(apo_write_u32_samples, unsigned long, 2147483648.0, 0x80000000)
+DECLARE(apo_write_s8_samples, char, s8)
+DECLARE(apo_write_u8_samples, unsigned char, u8)
+DECLARE(apo_write_u16_samples, unsigned short, u16)
+DECLARE(apo_write_s32_samples, long, s32)
+DECLARE(apo_write_u32_samples, unsigned long, u32)
+
+void apo_write_s16_samples(audiopipeout *ap, short samples[], unsigned frameCount)
+{
+  const int kMaxSamples = 1024;
+  float fBuf[kMaxSamples];
+
+  /* compact queue and nothing to do: store the samples untouched */
+  if (audiodevice_get_rate(ap->device) != ap->deviceRate) configure_rate(ap);
+  if (ap->storeFormat == STORE_S16 && ap->resampler == NULL && ap->stretch == NULL && ap->dsp.stageCount == 0 &&
+      ap->outputHook == NULL && !ap->isHoldingSample && ap->carryCount == 0) {
+    mark_queue_position(ap, frameCount);
+    ap->samplesQueued += frameCount;
+    addBytes(&ap->tq, samples, frameCount * sizeof(short));
+    return;
+  }
+  while (frameCount > 0) {
+    unsigned toConvert = frameCount;
+    if (toConvert > kMaxSamples) toConvert = kMaxSamples;
+    convert_s16_to_float(fBuf, samples, toConvert);
+    write_converted(ap, fBuf, toConvert);
+    samples += toConvert;
+    frameCount -= toConvert;
+  }
+}
 
 void apo_write_float_samples(audiopipeout *ap, float samples[], unsigned frameCount)
 {
-  /* should we adjust for rate shift? */
-  if (ap->resampler != NULL) {
-    resampler_scale_data(ap->resampler, samples, frameCount);
-    resampler_flush(ap->resampler);
-  } else {
-    addBytes(&ap->tq, samples, frameCount * sizeof(float));
+  const int kMaxSamples = 1024;
+  float fBuf[kMaxSamples];
+
+  if (ap->dsp.stageCount == 0) {
+    write_converted(ap, samples, frameCount);
+    return;
+  }
+  /* leave the caller's samples alone */
+  while (frameCount > 0) {
+    unsigned toCopy = frameCount;
+    if (toCopy > kMaxSamples) toCopy = kMaxSamples;
+    memcpy(fBuf, samples, toCopy * sizeof(float));
+    write_converted(ap, fBuf, toCopy);
+    samples += toCopy;
+    frameCount -= toCopy;
+  }
+}
+
+/* From here to the end of the drain, samples that land in the queue at
+   or past joinAt are carried. */
+static void begin_join(audiopipeout *ap, double joinAt)
+{
+  if (joinAt < ap->samplesQueued) joinAt = ap->samplesQueued;
+  /* a whole stereo frame */
+  ap->joinAt = 2 * (unsigned long long)(joinAt / 2 + 0.5);
+  ap->tailCount = 0;
+  ap->isDraining = 1;
+}
+
+void apo_write_device_samples(audiopipeout *ap, const float samples[], unsigned sampleCount, unsigned long long writtenCount)
+{
+  if (audiodevice_get_rate(ap->device) != ap->deviceRate) configure_rate(ap);
+  apo_drain(ap);
+  timeline_mark(&ap->queuePositions, ap->samplesWritten, ap->samplesQueued);
+  begin_join(ap, ap->samplesQueued + writtenCount * ap->deviceRate / (ap->rate * ap->stretchFactor));
+  ap->samplesWritten += writtenCount;
+  ap->isFinished = 0;
+  enqueue_float(ap, samples, sampleCount);
+  ap->isDraining = 0;
+}
+
+void apo_drain(audiopipeout *ap)
+{
+  float silence[1024];
+  unsigned ringCount;
+  double joinAt;
+
+  if (ap->isDrained) return;
+  joinAt = next_queue_position(ap);
+  /* the resampler starts again a window of output ahead of the next
+     input, to overlap this tail */
+  if (ap->resampler != NULL) joinAt -= (double)ap->resampler->window * ap->resampler->channelCount * ap->deviceRate / ap->rate;
+  begin_join(ap, joinAt);
+  if (ap->dsp.stageCount > 0) {
+    ringCount = (unsigned)(ap->dsp.rate * DRAIN_RING_SECONDS) * ap->dsp.channelCount;
+    while (ringCount > 0) {
+      unsigned n = (ringCount < 1024) ? ringCount : 1024;
+      memset(silence, 0, n * sizeof(float));
+      process_frames(ap, silence, n);
+      ringCount -= n;
+    }
+  }
+  if (ap->stretch != NULL) wsola_flush(ap->stretch);
+  if (ap->resampler != NULL) resampler_drain(ap->resampler);
+  dsp_reset(&ap->dsp);
+  ap->isDraining = 0;
+  ap->isDrained = 1;
+}
+
+void apo_set_output_hook(audiopipeout *ap, apooutputhook hook, void *context)
+{
+  ap->outputHook = hook;
+  ap->outputHookContext = context;
+}
+
+double apo_device_rate(audiopipeout *ap)
+{
+  /* the pipe follows the device at the next write */
+  return audiodevice_get_rate(ap->device);
+}
+
+/* The stretcher works at the stream's rate and channel count, so is
+   rebuilt when they change, after sending on what it holds. */
+static void configure_stretch(audiopipeout *ap)
+{
+  if (ap->stretch != NULL) {
+    wsola_flush(ap->stretch);
+    wsola_free(ap->stretch);
+    ap->stretch = NULL;
+  }
+  if (ap->stretchFactor != 1.0) {
+    ap->stretch = wsola_new(ap->dsp.rate, ap->dsp.channelCount, ap->stretchFactor, stretchCallback);
+    wsola_set_context(ap->stretch, ap);
   }
 }
 
+void apo_set_rate(audiopipeout *ap, float rate, int isMono)
+{
+  /* half a frame of the old format has nothing to pair with */
+  ap->isHoldingSample = 0;
+  if (ap->stretch != NULL) wsola_flush(ap->stretch);
+  dsp_set_rate(&ap->dsp, rate);
+  ap->dsp.channelCount = isMono ? 1 : 2;
+  ap->rate = isMono ? rate / 2.0 : rate;
+  configure_rate(ap);
+  configure_stretch(ap);
+}
+
+void apo_set_time_stretch(audiopipeout *ap, float factor)
+{
+  if (factor < WSOLA_MIN_FACTOR) factor = WSOLA_MIN_FACTOR;
+  if (factor > WSOLA_MAX_FACTOR) factor = WSOLA_MAX_FACTOR;
+  ap->stretchFactor = factor;
+  configure_stretch(ap);
+  configure_rate(ap);
+}
+
+void apo_set_resampler_quality(audiopipeout *ap, int quality, float budget)
+{
+  if (quality < RESAMPLER_BOX) quality = RESAMPLER_BOX;
+  if (quality >= RESAMPLER_QUALITY_COUNT) quality = RESAMPLER_QUALITY_COUNT - 1;
+  ap->quality = quality;
+  governor_set(&ap->governor, quality, budget);
+  configure_rate(ap);
+}
+
+unsigned apo_take_quality_switches(audiopipeout *ap, qualityswitch switches[], unsigned maxCount)
+{
+  return governor_take_switches(&ap->governor, switches, maxCount);
+}
+
+unsigned long apo_quality_switch_count(audiopipeout *ap)
+{
+  return governor_switch_count(&ap->governor);
+}
+
+int apo_resampler_quality(audiopipeout *ap)
+{
+  return governor_quality(&ap->governor);
+}
+
+unsigned apo_queue_capacity(audiopipeout *ap)
+{
+  return queueCapacity(&ap->tq) / ap->sampleSize;
+}
+
+unsigned long long apo_write_position(audiopipeout *ap)
+{
+  return ap->samplesWritten;
+}
+
+int apo_presentation_time(audiopipeout *ap, unsigned long long writePosition, double *hostTime)
+{
+  double queuePosition, playTime;
+  unsigned long long whole;
+
+  if (timeline_lookup(&ap->queuePositions, writePosition, &queuePosition) != 0) return -1;
+  if (queuePosition < 0) queuePosition = 0;
+  whole = (unsigned long long)queuePosition;
+  if (timeline_lookup(&ap->playTimes, whole, &playTime) != 0) return -1;
+  *hostTime = playTime + (queuePosition - whole) * ap->playTimes.slope;
+  return 0;
+}
+
+dspchain *apo_dsp(audiopipeout *ap)
+{
+  return &ap->dsp;
+}
+
+void apo_set_concealment(audiopipeout *ap, int mode)
+{
+  ap->concealment = mode;
+}
+
+unsigned apo_take_underrun_ranges(audiopipeout *ap, samplerange ranges[], unsigned maxCount)
+{
+  return rangelog_take(&ap->underruns, ranges, maxCount);
+}
+
+unsigned long apo_underrun_count(audiopipeout *ap)
+{
+  return rangelog_event_count(&ap->underruns);
+}
+
 void apo_wait_until_done(audiopipeout *ap)
 {
-  /* TODO */
+  unsigned long long end = ap->samplesWritten;
+  double heard;
+
+  apo_drain(ap);
+  /* nothing follows to add the tail into */
+  if (ap->carryCount > 0) {
+    queue_float(ap, ap->carry + ap->carryStart, ap->carryCount);
+    ap->carryCount = 0;
+    ap->carryStart = 0;
+  }
+  /* the queue running dry from here on is the end, not an underrun */
+  ap->isFinished = 1;
+  /* the callback takes partial buffers, so the queue drains completely */
+  waitForMaximumBytes(&ap->tq, 0);
+  /* then for the device to play what it took */
+  if (apo_presentation_time(ap, end, &heard) == 0) {
+    double wait = heard - audiodevice_host_time();
+    if (wait > 1.0) wait = 1.0;
+    if (wait > 0.0) {
+      struct timespec ts;
+      ts.tv_sec = (time_t)wait;
+      ts.tv_nsec = (long)((wait - ts.tv_sec) * 1e9);
+      nanosleep(&ts, NULL);
+    }
+  }
 }
 
 void apo_free(audiopipeout *ap)
 {
+  audiodevice_stop(ap->device);
+  audiodevice_free(ap->device);
   destroy_threadedqueue(&ap->tq);
+  destroy_rangelog(&ap->underruns);
+  destroy_governor(&ap->governor);
   if (ap->resampler) resampler_free(ap->resampler);
+  if (ap->stretch) wsola_free(ap->stretch);
+  free(ap->carry);
   free(ap);
 }
 
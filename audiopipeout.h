@@ -28,15 +28,95 @@
 
 #include "threadedqueue.h"
 #include "resampler.h"
+#include "governor.h"
+#include "wsola.h"
+#include "convert.h"
+#include "audiodevice.h"
+#include "dsp.h"
+#include "timeline.h"
+#include "rangelog.h"
+
+/* Sees each block of samples on its way into the queue: interleaved
+   stereo floats at the device's rate, after every stage of processing. */
+typedef void (*apooutputhook)(void *context, const float *samples, unsigned sampleCount);
+
+/* frames of recent output kept to repeat over an underrun */
+#define CONCEAL_HISTORY_FRAMES 1024
 
 typedef struct {
   threadedqueue tq;
+  audiodevice *device;
   resampler *resampler;
+  int quality;
+  governor governor;
+  double waitSeconds;
+  wsola *stretch;
+  float stretchFactor;
+  float rate;
+  double deviceRate;
+  int storeFormat;
+  unsigned sampleSize;
+  dspchain dsp;
+  unsigned long long samplesWritten;
+  unsigned long long samplesQueued;
+  unsigned long long samplesPlayed;
+  timeline queuePositions;
+  timeline playTimes;
+  int concealment;
+  int isConcealing;
+  unsigned concealStep;
+  unsigned fadeInRemaining;
+  float holdFrame[2];
+  float lastFrame[2];
+  float repeatGain;
+  unsigned historyRead;
+  unsigned historyStart;
+  unsigned historyWrite;
+  float history[CONCEAL_HISTORY_FRAMES * 2];
+  rangelog underruns;
+  apooutputhook outputHook;
+  void *outputHookContext;
+  /* the left half of a stereo frame a write ended on, for the next */
+  int isHoldingSample;
+  float heldSample;
+  /* what drains sent past their join, added into the samples queued
+     after it, from carryStart on */
+  float *carry;
+  unsigned carryStart;
+  unsigned carryCount;
+  unsigned carryCapacity;
+  int isDraining;
+  int isDrained;
+  unsigned long long joinAt;
+  unsigned tailCount;
+  volatile int isFinished;
 } audiopipeout;
 
-/* Larger buffers reduces dropout probability. */
+/* What the playback callback puts in place of samples that haven't
+   arrived. It never waits for the writer. */
+enum { CONCEAL_SILENCE, CONCEAL_FADE, CONCEAL_REPEAT };
+
+/* Larger buffers reduces dropout probability. Samples are resampled to
+   the device's nominal rate, following it if it changes, and go straight
+   to the queue when the rates already match. Everything playback needs
+   is allocated here; after that only changes of rate or stretch
+   allocate. */
 audiopipeout *apo_new(float rate, int isMono, int frameBufferSize);
 
+/* As apo_new, but queued samples are kept in storeFormat (STORE_FLOAT or
+   STORE_S16) and only converted to float when the device asks for them. */
+audiopipeout *apo_new_with_storage(float rate, int isMono, int frameBufferSize, int storeFormat);
+
+/* As apo_new_with_storage, but the queue starts at minFrameBufferSize
+   and grows while the writer bursts ahead, up to maxFrameBufferSize,
+   then gives the memory back once it has stayed nearly empty for a
+   while (init_threadedqueue_elastic). Both of the queue's buffers are
+   allocated here at the largest size; the writing thread does the
+   copying when it resizes. */
+audiopipeout *apo_new_elastic(float rate, int isMono, int minFrameBufferSize, int maxFrameBufferSize, int storeFormat);
+
+/* Samples are interleaved, and a write may end half way through a
+   stereo frame: the pipe keeps that half for the next write. */
 void apo_write_s8_samples(audiopipeout *ap, char samples[], unsigned frameCount);
 void apo_write_u8_samples(audiopipeout *ap, unsigned char samples[], unsigned frameCount);
 void apo_write_s16_samples(audiopipeout *ap, short samples[], unsigned frameCount);
@@ -45,6 +125,89 @@ void apo_write_s32_samples(audiopipeout *ap, long samples[], unsigned frameCount
 void apo_write_u32_samples(audiopipeout *ap, unsigned long samples[], unsigned frameCount);
 void apo_write_float_samples(audiopipeout *ap, float samples[], unsigned frameCount);
 
+/* Switch the rate (and mono hack) of the samples written from here on.
+   What is already queued plays out undisturbed, so consecutive streams
+   join without a gap. */
+void apo_set_rate(audiopipeout *ap, float rate, int isMono);
+
+/* Play samples written from here on factor times faster (0.25 to 4)
+   without changing their pitch. They are time-stretched after the
+   processing chain and before resampling; 1 turns it off. */
+void apo_set_time_stretch(audiopipeout *ap, float factor);
+
+/* Resample at quality (RESAMPLER_BOX, the default, up to RESAMPLER_SINC),
+   each channel separately. With a budget, the share of real time the
+   writer may spend processing (e.g. 0.25), a governor drops a tier at a
+   time while it spends more and comes back as it recovers, crossfading
+   each change; 0 keeps to quality. Time waiting for room in the queue
+   doesn't count. */
+void apo_set_resampler_quality(audiopipeout *ap, int quality, float budget);
+
+/* The governor's switches since the last call, positioned in samples
+   written. */
+unsigned apo_take_quality_switches(audiopipeout *ap, qualityswitch switches[], unsigned maxCount);
+
+/* How many switches the governor has made in all, leaving them to be
+   taken. */
+unsigned long apo_quality_switch_count(audiopipeout *ap);
+
+/* The quality the governor is resampling at now. */
+int apo_resampler_quality(audiopipeout *ap);
+
+/* Queue samples already in the queue's layout, as an output hook saw
+   them between two drains, at the device's current rate: no processing,
+   stretching or resampling at all. They stand for writtenCount samples
+   written; what runs past those is a tail, and is added into what
+   follows just as a drain's would be. What the pipe is still holding
+   back is drained first. */
+void apo_write_device_samples(audiopipeout *ap, const float samples[], unsigned sampleCount, unsigned long long writtenCount);
+
+/* Push everything written so far through to the queue, as if silence
+   followed; the next write starts the dsp chain, stretcher and resampler
+   afresh. The dsp chain rings out briefly first. What comes out past
+   where the next write's samples will land is held back and added into
+   them rather than queued ahead, so what is written after a drain joins
+   what was written before it much as if there had been no drain: to
+   within a fraction of a sample through the filters and resampler, by
+   an overlap through the stretcher. */
+void apo_drain(audiopipeout *ap);
+
+/* Call hook (NULL for none) with every block queued from here on. It
+   runs on the writing thread. */
+void apo_set_output_hook(audiopipeout *ap, apooutputhook hook, void *context);
+
+/* The rate samples written from here on are queued at. */
+double apo_device_rate(audiopipeout *ap);
+
+/* The queue's current size, in samples. */
+unsigned apo_queue_capacity(audiopipeout *ap);
+
+/* Samples passed to apo_write_* so far. */
+unsigned long long apo_write_position(audiopipeout *ap);
+
+/* When the sample at a write position is expected to be heard, on the
+   audiodevice_host_time clock, allowing for the queue and the
+   resampler's delay. Returns -1 until the device has played something. */
+int apo_presentation_time(audiopipeout *ap, unsigned long long writePosition, double *hostTime);
+
+/* The processing chain applied to written samples before resampling, at
+   the stream's rate and channel count. It starts out empty. */
+dspchain *apo_dsp(audiopipeout *ap);
+
+/* CONCEAL_SILENCE leaves a hard gap, CONCEAL_FADE (the default) ramps
+   from the last sample played down to silence, and CONCEAL_REPEAT fades
+   into the most recent output, repeated and dying away. Either way the
+   audio fades back in when samples arrive again. */
+void apo_set_concealment(audiopipeout *ap, int mode);
+
+/* Ranges the device asked for that weren't queued, in samples of the
+   queue at the device's rate. A range's position is the count of queued
+   samples played before the gap. Silence before the first write and
+   after apo_wait_until_done isn't counted. */
+unsigned apo_take_underrun_ranges(audiopipeout *ap, samplerange ranges[], unsigned maxCount);
+unsigned long apo_underrun_count(audiopipeout *ap);
+
+/* Wait until everything written so far has been heard. */
 void apo_wait_until_done(audiopipeout *ap);
 
 void apo_free(audiopipeout *ap);
@@ -0,0 +1,263 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#include "bulkwriter.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+enum { BUFFER_FREE, BUFFER_FILLING, BUFFER_QUEUED, BUFFER_WRITING, BUFFER_DONE };
+
+#define BULK_ALIGNMENT 4096
+
+static int write_fully(bulkwriter *bw, const char *data, unsigned length, unsigned long long offset)
+{
+  while (length > 0) {
+    ssize_t writ;
+    if (bw->isSeekable) writ = pwrite(bw->fd, data, length, (off_t)offset);
+    else writ = write(bw->fd, data, length);
+    if (writ <= 0) return -1;
+    data += writ;
+    offset += writ;
+    length -= writ;
+  }
+  return 0;
+}
+
+/* Called with the lock held. The header is built from bytesDurable
+   under it, but written after letting it go, so bw_write never waits on
+   the disk for a header. One patch at a time, so an older length can't
+   land after a newer one. */
+static void patch_header(bulkwriter *bw)
+{
+  int failed;
+
+  if (bw->headerCallback == NULL || !bw->isSeekable || bw->isPatching) return;
+  bw->headerCallback(bw->headerContext, bw->header, bw->headerSize, bw->bytesDurable);
+  bw->isPatching = 1;
+  pthread_mutex_unlock(&bw->lock);
+  failed = write_fully(bw, (const char*)bw->header, bw->headerSize, bw->headerOffset);
+  pthread_mutex_lock(&bw->lock);
+  bw->isPatching = 0;
+  if (failed) bw->error = 1;
+}
+
+static void *writer_thread(void *context)
+{
+  bulkwriter *bw = (bulkwriter *)context;
+
+  pthread_mutex_lock(&bw->lock);
+  while (1) {
+    bulkbuffer *b;
+    int failed;
+    while (bw->buffers[bw->writeIndex].state != BUFFER_QUEUED) {
+      if (bw->isClosing && bw->writeIndex == bw->fillIndex) {
+        pthread_mutex_unlock(&bw->lock);
+        return NULL;
+      }
+      pthread_cond_wait(&bw->stateChanged, &bw->lock);
+    }
+    b = &bw->buffers[bw->writeIndex];
+    b->state = BUFFER_WRITING;
+    bw->writeIndex = (bw->writeIndex + 1) % bw->bufferCount;
+    /* pipes get a single writer thread, so their writes stay in order */
+    pthread_mutex_unlock(&bw->lock);
+    TRACE_BEGIN(write_output);
+    failed = write_fully(bw, b->data, b->used, b->offset);
+    TRACE_END(write_output);
+    pthread_mutex_lock(&bw->lock);
+    if (failed) bw->error = 1;
+    b->state = BUFFER_DONE;
+
+    /* retire buffers in file order so bytesDurable is a contiguous prefix */
+    while (bw->buffers[bw->retireIndex].state == BUFFER_DONE) {
+      bulkbuffer *r = &bw->buffers[bw->retireIndex];
+      bw->bytesDurable += r->used;
+      r->used = 0;
+      r->state = BUFFER_FREE;
+      bw->retireIndex = (bw->retireIndex + 1) % bw->bufferCount;
+      bw->retiredSincePatch++;
+    }
+    if (bw->patchInterval > 0 && bw->retiredSincePatch >= bw->patchInterval && !bw->isPatching) {
+      bw->retiredSincePatch = 0;
+      patch_header(bw);
+    }
+    pthread_cond_broadcast(&bw->stateChanged);
+  }
+}
+
+bulkwriter *bw_new(int fd, unsigned bufferSize, unsigned bufferCount, unsigned threadCount)
+{
+  unsigned i;
+  struct stat st;
+  bulkwriter *bw = (bulkwriter*)malloc(sizeof(bulkwriter));
+
+  pthread_mutex_init(&bw->lock, NULL);
+  pthread_cond_init(&bw->stateChanged, NULL);
+  bw->fd = fd;
+  bw->isSeekable = (fstat(fd, &st) == 0) && S_ISREG(st.st_mode);
+  bw->isClosing = 0;
+  bw->bufferSize = (bufferSize + BULK_ALIGNMENT - 1) & ~(BULK_ALIGNMENT - 1);
+  bw->bufferCount = bufferCount;
+  bw->buffers = (bulkbuffer*)malloc(bufferCount * sizeof(bulkbuffer));
+  for (i = 0; i < bufferCount; i++) {
+    void *data;
+    if (posix_memalign(&data, BULK_ALIGNMENT, bw->bufferSize) != 0) data = malloc(bw->bufferSize);
+    bw->buffers[i].data = (char*)data;
+    bw->buffers[i].used = 0;
+    bw->buffers[i].offset = 0;
+    bw->buffers[i].state = BUFFER_FREE;
+  }
+  bw->fillIndex = 0;
+  bw->writeIndex = 0;
+  bw->retireIndex = 0;
+  bw->nextOffset = bw->isSeekable ? (unsigned long long)lseek(fd, 0, SEEK_CUR) : 0;
+  bw->bytesSubmitted = 0;
+  bw->bytesDurable = 0;
+  bw->error = 0;
+  bw->headerCallback = NULL;
+  bw->header = NULL;
+  bw->headerContext = NULL;
+  bw->headerSize = 0;
+  bw->headerOffset = 0;
+  bw->patchInterval = 0;
+  bw->retiredSincePatch = 0;
+  bw->isPatching = 0;
+#ifdef F_NOCACHE
+  /* large sequential writes: don't let them evict everything else */
+  if (bw->isSeekable) fcntl(fd, F_NOCACHE, 1);
+#endif
+  if (!bw->isSeekable) threadCount = 1;
+  bw->threadCount = threadCount;
+  bw->threads = (pthread_t*)malloc(threadCount * sizeof(pthread_t));
+  for (i = 0; i < threadCount; i++) {
+    pthread_create(&bw->threads[i], NULL, writer_thread, bw);
+  }
+  return bw;
+}
+
+void bw_set_header(bulkwriter *bw, headerCallback callback, void *context, unsigned headerSize, unsigned patchInterval)
+{
+  /* kept for patching, so the writers never allocate */
+  unsigned char *header = (unsigned char*)malloc(headerSize);
+
+  pthread_mutex_lock(&bw->lock);
+  free(bw->header);
+  bw->header = header;
+  bw->headerCallback = callback;
+  bw->headerContext = context;
+  bw->headerSize = headerSize;
+  bw->headerOffset = bw->nextOffset;
+  bw->patchInterval = patchInterval;
+  callback(context, header, headerSize, bw->isSeekable ? 0 : ~0ULL);
+  if (write_fully(bw, (const char*)header, headerSize, bw->nextOffset) != 0) bw->error = 1;
+  bw->nextOffset += headerSize;
+  pthread_mutex_unlock(&bw->lock);
+}
+
+static void queue_fill_buffer(bulkwriter *bw)
+{
+  bulkbuffer *b = &bw->buffers[bw->fillIndex];
+  b->offset = bw->nextOffset;
+  bw->nextOffset += b->used;
+  b->state = BUFFER_QUEUED;
+  bw->fillIndex = (bw->fillIndex + 1) % bw->bufferCount;
+  pthread_cond_broadcast(&bw->stateChanged);
+}
+
+void bw_write(bulkwriter *bw, const void *bytes, unsigned length)
+{
+  const char *mem = (const char*)bytes;
+
+  pthread_mutex_lock(&bw->lock);
+  bw->bytesSubmitted += length;
+  while (length > 0) {
+    bulkbuffer *b = &bw->buffers[bw->fillIndex];
+    unsigned toCopy;
+    /* only blocks when every buffer is still waiting on the disk */
+    while (b->state != BUFFER_FREE && b->state != BUFFER_FILLING) {
+      TRACE_BEGIN(output_pool_wait);
+      pthread_cond_wait(&bw->stateChanged, &bw->lock);
+      TRACE_END(output_pool_wait);
+    }
+    b->state = BUFFER_FILLING;
+    toCopy = bw->bufferSize - b->used;
+    if (toCopy > length) toCopy = length;
+    memcpy(b->data + b->used, mem, toCopy);
+    b->used += toCopy;
+    mem += toCopy;
+    length -= toCopy;
+    if (b->used == bw->bufferSize) queue_fill_buffer(bw);
+  }
+  pthread_mutex_unlock(&bw->lock);
+}
+
+unsigned long long bw_bytes_submitted(bulkwriter *bw)
+{
+  unsigned long long r;
+  pthread_mutex_lock(&bw->lock);
+  r = bw->bytesSubmitted;
+  pthread_mutex_unlock(&bw->lock);
+  return r;
+}
+
+unsigned long long bw_bytes_durable(bulkwriter *bw)
+{
+  unsigned long long r;
+  pthread_mutex_lock(&bw->lock);
+  r = bw->bytesDurable;
+  pthread_mutex_unlock(&bw->lock);
+  return r;
+}
+
+int bw_free(bulkwriter *bw)
+{
+  unsigned i;
+  int error;
+
+  pthread_mutex_lock(&bw->lock);
+  if (bw->buffers[bw->fillIndex].state == BUFFER_FILLING) queue_fill_buffer(bw);
+  bw->isClosing = 1;
+  pthread_cond_broadcast(&bw->stateChanged);
+  pthread_mutex_unlock(&bw->lock);
+
+  for (i = 0; i < bw->threadCount; i++) pthread_join(bw->threads[i], NULL);
+  pthread_mutex_lock(&bw->lock);
+  patch_header(bw);
+  error = bw->error;
+  pthread_mutex_unlock(&bw->lock);
+
+  for (i = 0; i < bw->bufferCount; i++) free(bw->buffers[i].data);
+  free(bw->buffers);
+  free(bw->threads);
+  free(bw->header);
+  pthread_cond_destroy(&bw->stateChanged);
+  pthread_mutex_destroy(&bw->lock);
+  free(bw);
+  return error;
+}
@@ -0,0 +1,94 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#ifndef __bulkwriter_h__
+#define __bulkwriter_h__
+
+#include <pthread.h>
+
+/* A bulkwriter collects small writes into large aligned buffers and hands
+   full buffers to writer threads, so a slow disk never stalls the thread
+   calling bw_write until every buffer is in flight. When the file is
+   seekable, several buffers are written at once with pwrite. */
+
+typedef void (*headerCallback)(void *context, unsigned char *header, unsigned headerSize, unsigned long long dataBytes);
+
+typedef struct {
+  char *data;
+  unsigned used;
+  unsigned long long offset;
+  int state;
+} bulkbuffer;
+
+typedef struct
+{
+  pthread_mutex_t lock;
+  pthread_cond_t stateChanged;
+  int fd;
+  int isSeekable;
+  int isClosing;
+  unsigned bufferSize;
+  unsigned bufferCount;
+  bulkbuffer *buffers;
+  unsigned fillIndex;
+  unsigned writeIndex;
+  unsigned retireIndex;
+  unsigned long long nextOffset;
+  unsigned long long bytesSubmitted;
+  unsigned long long bytesDurable;
+  int error;
+  unsigned threadCount;
+  pthread_t *threads;
+  headerCallback headerCallback;
+  void *headerContext;
+  unsigned char *header;
+  unsigned headerSize;
+  unsigned long long headerOffset;
+  unsigned patchInterval;
+  unsigned retiredSincePatch;
+  int isPatching;
+} bulkwriter;
+
+/* threadCount writers share bufferCount buffers of bufferSize bytes each. */
+bulkwriter *bw_new(int fd, unsigned bufferSize, unsigned bufferCount, unsigned threadCount);
+
+/* Reserve headerSize bytes at the start of the file. The callback fills
+   them in for the data written so far; it is called now, after every
+   patchInterval buffers reach the disk, and from bw_free. Without a
+   seekable file only the first call is written, and it is passed ~0ULL
+   as the length since it will never be patched. */
+void bw_set_header(bulkwriter *bw, headerCallback callback, void *context, unsigned headerSize, unsigned patchInterval);
+
+void bw_write(bulkwriter *bw, const void *bytes, unsigned length);
+
+/* Bytes handed to bw_write so far, and bytes known to be on disk. */
+unsigned long long bw_bytes_submitted(bulkwriter *bw);
+unsigned long long bw_bytes_durable(bulkwriter *bw);
+
+/* Writes everything still buffered, patches the header and returns
+   nonzero if any write failed. */
+int bw_free(bulkwriter *bw);
+
+#endif /* __bulkwriter_h__ */
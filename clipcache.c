@@ -0,0 +1,307 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#include "clipcache.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CLIPCACHE_MAGIC 0x70696c63
+#define CLIP_MAGIC 0x31706c63
+
+/* at the start of every clip file, so a stray or stale one is noticed */
+typedef struct {
+  unsigned magic;
+  unsigned reserved;
+  clipkey key;
+  unsigned long long sampleCount;
+} clipheader;
+
+void clipkey_init(clipkey *key)
+{
+  key->a = 0xcbf29ce484222325ULL;
+  key->b = 0x84222325cbf29ce4ULL;
+}
+
+/* two differently mixed FNV-1a lanes, so one collision doesn't make two */
+void clipkey_add(clipkey *key, const void *bytes, unsigned long length)
+{
+  const unsigned char *p = (const unsigned char *)bytes;
+  unsigned long long a = key->a, b = key->b;
+  unsigned long i;
+
+  for (i = 0; i < length; i++) {
+    a = (a ^ p[i]) * 0x100000001b3ULL;
+    b = (b ^ p[i]) * 0x9e3779b97f4a7c15ULL;
+    b ^= b >> 29;
+  }
+  key->a = a;
+  key->b = b;
+}
+
+static int same_key(const clipkey *x, const clipkey *y)
+{
+  return x->a == y->a && x->b == y->b;
+}
+
+static char *clip_path(clipcache *cc, const clipkey *key, const char *suffix)
+{
+  unsigned long size = strlen(cc->directory) + 64;
+  char *path = (char *)malloc(size);
+  snprintf(path, size, "%s/%016llx%016llx%s", cc->directory, key->a, key->b, suffix);
+  return path;
+}
+
+static clipentry *find_entry(clipindex *index, const clipkey *key)
+{
+  unsigned i;
+  for (i = 0; i < CLIPCACHE_ENTRIES; i++) {
+    if (index->entries[i].inUse && same_key(&index->entries[i].key, key)) return &index->entries[i];
+  }
+  return NULL;
+}
+
+static void remove_entry(clipcache *cc, clipentry *e)
+{
+  char *path = clip_path(cc, &e->key, ".clip");
+  unlink(path);
+  free(path);
+  cc->index->stats.bytes -= e->bytes;
+  cc->index->stats.clipCount--;
+  e->inUse = 0;
+}
+
+/* Drop the least recently used clip. Returns -1 if there are none. */
+static int evict_one(clipcache *cc)
+{
+  clipentry *oldest = NULL;
+  unsigned i;
+
+  for (i = 0; i < CLIPCACHE_ENTRIES; i++) {
+    clipentry *e = &cc->index->entries[i];
+    if (e->inUse && (oldest == NULL || e->lastUsed < oldest->lastUsed)) oldest = e;
+  }
+  if (oldest == NULL) return -1;
+  remove_entry(cc, oldest);
+  cc->index->stats.evictions++;
+  return 0;
+}
+
+static void lock_index(clipcache *cc)
+{
+  while (flock(cc->indexFd, LOCK_EX) != 0 && errno == EINTR);
+}
+
+static void unlock_index(clipcache *cc)
+{
+  flock(cc->indexFd, LOCK_UN);
+}
+
+clipcache *clipcache_open(const char *directory, unsigned long long maxBytes)
+{
+  clipcache *cc;
+  struct stat st;
+  char *path;
+  void *base;
+  int fd;
+
+  if (mkdir(directory, 0755) != 0 && errno != EEXIST) return NULL;
+  path = (char *)malloc(strlen(directory) + sizeof("/index"));
+  sprintf(path, "%s/index", directory);
+  fd = open(path, O_RDWR | O_CREAT, 0644);
+  free(path);
+  if (fd < 0) return NULL;
+
+  cc = (clipcache *)malloc(sizeof(clipcache));
+  cc->directory = strdup(directory);
+  cc->indexFd = fd;
+  lock_index(cc);
+  if (fstat(fd, &st) != 0 || (st.st_size != sizeof(clipindex) && ftruncate(fd, sizeof(clipindex)) != 0) ||
+      (base = mmap(NULL, sizeof(clipindex), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+    int saved = errno;
+    unlock_index(cc);
+    close(fd);
+    free(cc->directory);
+    free(cc);
+    errno = saved;
+    return NULL;
+  }
+  cc->index = (clipindex *)base;
+  /* a new index, or one laid out differently, starts empty */
+  if (cc->index->magic != CLIPCACHE_MAGIC || cc->index->entryCount != CLIPCACHE_ENTRIES) {
+    memset(cc->index, 0, sizeof(clipindex));
+    cc->index->magic = CLIPCACHE_MAGIC;
+    cc->index->entryCount = CLIPCACHE_ENTRIES;
+  }
+  /* the last to open sets the bound for everyone */
+  cc->index->maxBytes = maxBytes;
+  while (cc->index->stats.bytes > maxBytes && evict_one(cc) == 0);
+  unlock_index(cc);
+  return cc;
+}
+
+void clipcache_close(clipcache *cc)
+{
+  munmap(cc->index, sizeof(clipindex));
+  close(cc->indexFd);
+  free(cc->directory);
+  free(cc);
+}
+
+/* Map the clip file for key, if it is what it says it is. */
+static int map_clip(clipcache *cc, const clipkey *key, clipdata *data)
+{
+  char *path = clip_path(cc, key, ".clip");
+  const clipheader *header;
+  struct stat st;
+  void *base;
+  int fd = open(path, O_RDONLY);
+
+  free(path);
+  if (fd < 0) return -1;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(clipheader)) {
+    close(fd);
+    return -1;
+  }
+  base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) return -1;
+  header = (const clipheader *)base;
+  if (header->magic != CLIP_MAGIC || !same_key(&header->key, key) ||
+      sizeof(clipheader) + header->sampleCount * sizeof(float) != (unsigned long long)st.st_size) {
+    munmap(base, st.st_size);
+    return -1;
+  }
+  data->samples = (const float *)((const char *)base + sizeof(clipheader));
+  data->sampleCount = header->sampleCount;
+  data->mapping = base;
+  data->mappedSize = st.st_size;
+  return 0;
+}
+
+int clipcache_lookup(clipcache *cc, const clipkey *key, clipdata *data)
+{
+  clipentry *e;
+  int found;
+
+  lock_index(cc);
+  found = (find_entry(cc->index, key) != NULL);
+  unlock_index(cc);
+  /* clip files are only ever renamed into place, so need no lock */
+  if (found) found = (map_clip(cc, key, data) == 0);
+
+  lock_index(cc);
+  e = find_entry(cc->index, key);
+  if (found) {
+    cc->index->stats.hits++;
+    if (e != NULL) e->lastUsed = ++cc->index->clock;
+  } else {
+    cc->index->stats.misses++;
+    if (e != NULL) remove_entry(cc, e);
+  }
+  unlock_index(cc);
+  return found ? 0 : -1;
+}
+
+void clipcache_release(clipdata *data)
+{
+  munmap(data->mapping, data->mappedSize);
+}
+
+static int write_clip(const char *path, const clipkey *key, const float *samples, unsigned long sampleCount)
+{
+  clipheader header;
+  FILE *f = fopen(path, "wb");
+  int ok;
+
+  if (f == NULL) return -1;
+  memset(&header, 0, sizeof(header));
+  header.magic = CLIP_MAGIC;
+  header.key = *key;
+  header.sampleCount = sampleCount;
+  ok = (fwrite(&header, sizeof(header), 1, f) == 1);
+  if (ok && sampleCount > 0) ok = (fwrite(samples, sizeof(float), sampleCount, f) == sampleCount);
+  if (fclose(f) != 0) ok = 0;
+  return ok ? 0 : -1;
+}
+
+int clipcache_store(clipcache *cc, const clipkey *key, const float *samples, unsigned long sampleCount)
+{
+  unsigned long long bytes = sizeof(clipheader) + (unsigned long long)sampleCount * sizeof(float);
+  char suffix[32];
+  char *temporary, *path;
+  clipentry *e;
+  unsigned i;
+
+  if (bytes > cc->index->maxBytes) return -1;
+  /* written aside and renamed, so a reader never maps half a clip */
+  snprintf(suffix, sizeof(suffix), ".%d", (int)getpid());
+  temporary = clip_path(cc, key, suffix);
+  path = clip_path(cc, key, ".clip");
+  if (write_clip(temporary, key, samples, sampleCount) != 0 || rename(temporary, path) != 0) {
+    unlink(temporary);
+    free(temporary);
+    free(path);
+    return -1;
+  }
+  free(temporary);
+  free(path);
+
+  lock_index(cc);
+  e = find_entry(cc->index, key);
+  if (e != NULL) {
+    /* someone else stored it meanwhile; ours replaced theirs */
+    cc->index->stats.bytes += bytes - e->bytes;
+    e->bytes = bytes;
+  } else {
+    while (cc->index->stats.bytes + bytes > cc->index->maxBytes || cc->index->stats.clipCount == CLIPCACHE_ENTRIES) {
+      if (evict_one(cc) != 0) break;
+    }
+    for (i = 0; i < CLIPCACHE_ENTRIES && cc->index->entries[i].inUse; i++);
+    e = &cc->index->entries[i];
+    e->key = *key;
+    e->bytes = bytes;
+    e->inUse = 1;
+    cc->index->stats.bytes += bytes;
+    cc->index->stats.clipCount++;
+  }
+  e->lastUsed = ++cc->index->clock;
+  cc->index->stats.stores++;
+  unlock_index(cc);
+  return 0;
+}
+
+void clipcache_get_stats(clipcache *cc, clipcachestats *stats)
+{
+  lock_index(cc);
+  *stats = cc->index->stats;
+  unlock_index(cc);
+}
@@ -0,0 +1,105 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#ifndef __clipcache_h__
+#define __clipcache_h__
+
+/* A cache on disk of clips as they come out of an audiopipeout's
+   processing and resampling, so a clip played again can go straight to
+   the queue. Each clip is a file of floats in a directory, named by a
+   hash of everything that shaped it: its bytes, format and rate, and the
+   pipe's settings. The directory's index is mapped into every process
+   using it and locked (flock) while it changes; it keeps the entries,
+   their last use, and counts of hits, misses and evictions. Past
+   maxBytes, or CLIPCACHE_ENTRIES clips, the least recently used clips
+   are evicted. */
+
+#define CLIPCACHE_ENTRIES 1024
+
+/* a 128 bit hash, built up a piece at a time */
+typedef struct {
+  unsigned long long a;
+  unsigned long long b;
+} clipkey;
+
+typedef struct {
+  unsigned long long hits;
+  unsigned long long misses;
+  unsigned long long stores;
+  unsigned long long evictions;
+  unsigned long long bytes;
+  unsigned clipCount;
+} clipcachestats;
+
+typedef struct {
+  clipkey key;
+  unsigned long long bytes;
+  unsigned long long lastUsed;
+  int inUse;
+} clipentry;
+
+typedef struct {
+  unsigned magic;
+  unsigned entryCount;
+  unsigned long long maxBytes;
+  unsigned long long clock;
+  clipcachestats stats;
+  clipentry entries[CLIPCACHE_ENTRIES];
+} clipindex;
+
+typedef struct {
+  char *directory;
+  int indexFd;
+  clipindex *index;
+} clipcache;
+
+/* A clip found in the cache, mapped read-only. */
+typedef struct {
+  const float *samples;
+  unsigned long sampleCount;
+  void *mapping;
+  unsigned long mappedSize;
+} clipdata;
+
+void clipkey_init(clipkey *key);
+void clipkey_add(clipkey *key, const void *bytes, unsigned long length);
+
+/* Open the cache in directory, creating it if need be, holding at most
+   maxBytes of clips. Returns NULL and sets errno on failure. */
+clipcache *clipcache_open(const char *directory, unsigned long long maxBytes);
+void clipcache_close(clipcache *cc);
+
+/* Map the clip stored under key into data and return 0, or -1 if there
+   is none. Either way it counts towards the statistics. */
+int clipcache_lookup(clipcache *cc, const clipkey *key, clipdata *data);
+void clipcache_release(clipdata *data);
+
+/* Store sampleCount samples under key, evicting as needed. Returns -1
+   if they couldn't be written or would never fit. */
+int clipcache_store(clipcache *cc, const clipkey *key, const float *samples, unsigned long sampleCount);
+
+void clipcache_get_stats(clipcache *cc, clipcachestats *stats);
+
+#endif /* __clipcache_h__ */
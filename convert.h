@@ -0,0 +1,59 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#ifndef __convert_h__
+#define __convert_h__
+
+/* Formats samples can be kept in while they sit in a pipe's queue.
+   STORE_S16 halves the queue memory of a stream at the cost of 16-bit
+   resolution. */
+enum { STORE_FLOAT, STORE_S16 };
+
+/* Per-sample conversions between float and each integer format, shared
+   by the apo_write_* and api_read_* functions and by the C++ layer in
+   audiopipe.hpp. They are inline so they fold into the calling loop.
+   CALC is the type the arithmetic is done in: 32 bit samples need the
+   precision of a double. */
+#define DECLARE_SAMPLE_CONVERSIONS(NAME, TYPE, CALC, OFFSET, SCALE) \
+static __inline__ float NAME##_to_float(TYPE v) { \
+  return (float)((v - (CALC)OFFSET) / (CALC)SCALE); \
+} \
+static __inline__ TYPE float_to_##NAME(float f) { \
+  f = (f > 1.0f) ? 1.0f : f; \
+  f = (f < -1.0f) ? -1.0f : f; \
+  return (TYPE)(f * ((CALC)SCALE - 1) + (CALC)OFFSET); \
+}
+
+DECLARE_SAMPLE_CONVERSIONS(s8, char, float, 0, 128)
+DECLARE_SAMPLE_CONVERSIONS(u8, unsigned char, float, 128, 128)
+DECLARE_SAMPLE_CONVERSIONS(s16, short, float, 0, 32768)
+DECLARE_SAMPLE_CONVERSIONS(u16, unsigned short, float, 32768, 32768)
+DECLARE_SAMPLE_CONVERSIONS(s32, long, double, 0, 2147483648.0)
+DECLARE_SAMPLE_CONVERSIONS(u32, unsigned long, double, 2147483648.0, 2147483648.0)
+
+void convert_s16_to_float(float *dst, const short *src, unsigned count);
+void convert_float_to_s16(short *dst, const float *src, unsigned count);
+
+#endif /* __convert_h__ */
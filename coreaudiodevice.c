@@ -0,0 +1,152 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#include "audiodevice.h"
+#include <CoreAudio/CoreAudio.h>
+#include <stdlib.h>
+
+struct audiodevice {
+  AudioDeviceID deviceID;
+  Boolean isInput;
+  AudioDeviceIOProc ioProc;
+  audiodeviceProc proc;
+  void *context;
+  volatile double rate;
+};
+
+static double read_rate(audiodevice *device)
+{
+  Float64 nominalRate;
+  AudioStreamBasicDescription format;
+  UInt32 size = sizeof(nominalRate);
+
+  if (AudioDeviceGetProperty(device->deviceID, 0, device->isInput, kAudioDevicePropertyNominalSampleRate, &size, &nominalRate) == 0) {
+    return nominalRate;
+  }
+  /* older drivers only publish the stream format */
+  size = sizeof(format);
+  if (AudioDeviceGetProperty(device->deviceID, 0, device->isInput, kAudioDevicePropertyStreamFormat, &size, &format) == 0) {
+    return format.mSampleRate;
+  }
+  return 44100.0;
+}
+
+static OSStatus rateListener(AudioDeviceID inDevice, UInt32 inChannel, Boolean isInput,
+			     AudioDevicePropertyID inPropertyID, void *inClientData)
+{
+  audiodevice *device = (audiodevice *)inClientData;
+  device->rate = read_rate(device);
+  return 0;
+}
+
+static double host_seconds(const AudioTimeStamp *timeStamp)
+{
+  if (timeStamp == NULL || timeStamp->mHostTime == 0) return 0.0;
+  return AudioConvertHostTimeToNanos(timeStamp->mHostTime) / 1e9;
+}
+
+/* Input and output get separate IOProcs, since the default input and
+   output are often the same device. */
+
+static OSStatus inputProc(AudioDeviceID inDevice,
+			  const AudioTimeStamp *inNow,
+			  const AudioBufferList *inInputData,
+			  const AudioTimeStamp *inInputTime,
+			  AudioBufferList *outOutputData, 
+			  const AudioTimeStamp *inOutputTime,
+			  void *inClientData)
+{
+  audiodevice *device = (audiodevice *)inClientData;
+  const AudioBuffer *buffer = inInputData->mBuffers;
+  device->proc(device->context, (float*)buffer->mData, buffer->mDataByteSize / sizeof(float), host_seconds(inInputTime));
+  return 0;
+}
+
+static OSStatus outputProc(AudioDeviceID inDevice,
+			   const AudioTimeStamp *inNow,
+			   const AudioBufferList *inInputData,
+			   const AudioTimeStamp *inInputTime,
+			   AudioBufferList *outOutputData, 
+			   const AudioTimeStamp *inOutputTime,
+			   void *inClientData)
+{
+  audiodevice *device = (audiodevice *)inClientData;
+  AudioBuffer *buffer = outOutputData->mBuffers;
+  device->proc(device->context, (float*)buffer->mData, buffer->mDataByteSize / sizeof(float), host_seconds(inOutputTime));
+  return 0;
+}
+
+audiodevice *audiodevice_new(int direction, audiodeviceProc proc, void *context)
+{
+  Boolean writeable;
+  UInt32 ioPropertyDataSize;
+  AudioHardwarePropertyID property;
+  audiodevice *device = (audiodevice*)malloc(sizeof(audiodevice));
+
+  device->proc = proc;
+  device->context = context;
+  device->isInput = (direction == AUDIODEVICE_INPUT);
+  if (direction == AUDIODEVICE_INPUT) {
+    property = kAudioHardwarePropertyDefaultInputDevice;
+    device->ioProc = inputProc;
+  } else {
+    property = kAudioHardwarePropertyDefaultOutputDevice;
+    device->ioProc = outputProc;
+  }
+
+  AudioHardwareGetPropertyInfo(property, &ioPropertyDataSize, &writeable);
+  AudioHardwareGetProperty(property, &ioPropertyDataSize, &device->deviceID);
+  device->rate = read_rate(device);
+  AudioDeviceAddPropertyListener(device->deviceID, 0, device->isInput, kAudioDevicePropertyNominalSampleRate, rateListener, device);
+  AudioDeviceAddIOProc(device->deviceID, device->ioProc, device);
+  return device;
+}
+
+void audiodevice_start(audiodevice *device)
+{
+  AudioDeviceStart(device->deviceID, device->ioProc);
+}
+
+void audiodevice_stop(audiodevice *device)
+{
+  AudioDeviceStop(device->deviceID, device->ioProc);
+}
+
+void audiodevice_free(audiodevice *device)
+{
+  AudioDeviceRemoveIOProc(device->deviceID, device->ioProc);
+  AudioDeviceRemovePropertyListener(device->deviceID, 0, device->isInput, kAudioDevicePropertyNominalSampleRate, rateListener);
+  free(device);
+}
+
+double audiodevice_get_rate(audiodevice *device)
+{
+  return device->rate;
+}
+
+double audiodevice_host_time(void)
+{
+  return AudioConvertHostTimeToNanos(AudioGetCurrentHostTime()) / 1e9;
+}
@@ -0,0 +1,285 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#include "dsp.h"
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define GAIN_SMOOTHING_SECONDS 0.005
+#define DC_BLOCKER_POLE 0.995
+
+void dsp_init(dspchain *chain, float rate, unsigned channelCount)
+{
+  chain->rate = rate;
+  chain->channelCount = channelCount;
+  chain->stageCount = 0;
+}
+
+static dspstage *new_stage(dspchain *chain, int type)
+{
+  dspstage *stage;
+  if (chain->stageCount >= DSP_MAX_STAGES) return NULL;
+  stage = &chain->stages[chain->stageCount];
+  memset(stage, 0, sizeof(dspstage));
+  stage->type = type;
+  return stage;
+}
+
+int dsp_add_gain(dspchain *chain, float db)
+{
+  dspstage *stage = new_stage(chain, DSP_GAIN);
+  if (stage == NULL) return -1;
+  stage->gain = stage->targetGain = powf(10.0, db / 20.0);
+  stage->smoothing = 1.0 - expf(-1.0 / (GAIN_SMOOTHING_SECONDS * chain->rate));
+  chain->stageCount++;
+  return 0;
+}
+
+int dsp_add_dc_blocker(dspchain *chain)
+{
+  /* y[n] = x[n] - x[n-1] + R y[n-1], run as a biquad */
+  dspstage *stage = new_stage(chain, DSP_DCBLOCK);
+  if (stage == NULL) return -1;
+  stage->b0 = 1.0;
+  stage->b1 = -1.0;
+  stage->a1 = -DC_BLOCKER_POLE;
+  chain->stageCount++;
+  return 0;
+}
+
+static int design_biquad(dspstage *stage, float rate)
+{
+  double w0, cosw, alpha, A, b0, b1, b2, a0, a1, a2;
+  float frequency = stage->frequency;
+  float q = stage->q;
+
+  if (frequency > 0.49 * rate) frequency = 0.49 * rate;
+  w0 = 2 * M_PI * frequency / rate;
+  cosw = cos(w0);
+  alpha = sin(w0) / (2 * q);
+  A = pow(10.0, stage->gainDb / 40.0);
+  switch (stage->kind) {
+  case BIQUAD_LOWPASS:
+    b0 = (1 - cosw) / 2; b1 = 1 - cosw; b2 = (1 - cosw) / 2;
+    a0 = 1 + alpha; a1 = -2 * cosw; a2 = 1 - alpha;
+    break;
+  case BIQUAD_HIGHPASS:
+    b0 = (1 + cosw) / 2; b1 = -(1 + cosw); b2 = (1 + cosw) / 2;
+    a0 = 1 + alpha; a1 = -2 * cosw; a2 = 1 - alpha;
+    break;
+  case BIQUAD_PEAK:
+    b0 = 1 + alpha * A; b1 = -2 * cosw; b2 = 1 - alpha * A;
+    a0 = 1 + alpha / A; a1 = -2 * cosw; a2 = 1 - alpha / A;
+    break;
+  case BIQUAD_LOWSHELF:
+    b0 = A * ((A + 1) - (A - 1) * cosw + 2 * sqrt(A) * alpha);
+    b1 = 2 * A * ((A - 1) - (A + 1) * cosw);
+    b2 = A * ((A + 1) - (A - 1) * cosw - 2 * sqrt(A) * alpha);
+    a0 = (A + 1) + (A - 1) * cosw + 2 * sqrt(A) * alpha;
+    a1 = -2 * ((A - 1) + (A + 1) * cosw);
+    a2 = (A + 1) + (A - 1) * cosw - 2 * sqrt(A) * alpha;
+    break;
+  case BIQUAD_HIGHSHELF:
+    b0 = A * ((A + 1) + (A - 1) * cosw + 2 * sqrt(A) * alpha);
+    b1 = -2 * A * ((A - 1) + (A + 1) * cosw);
+    b2 = A * ((A + 1) + (A - 1) * cosw - 2 * sqrt(A) * alpha);
+    a0 = (A + 1) - (A - 1) * cosw + 2 * sqrt(A) * alpha;
+    a1 = 2 * ((A - 1) - (A + 1) * cosw);
+    a2 = (A + 1) - (A - 1) * cosw - 2 * sqrt(A) * alpha;
+    break;
+  default:
+    return -1;
+  }
+  stage->b0 = b0 / a0;
+  stage->b1 = b1 / a0;
+  stage->b2 = b2 / a0;
+  stage->a1 = a1 / a0;
+  stage->a2 = a2 / a0;
+  return 0;
+}
+
+int dsp_add_biquad(dspchain *chain, int kind, float frequency, float q, float gainDb)
+{
+  dspstage *stage;
+
+  if (frequency <= 0 || frequency >= chain->rate / 2 || q <= 0) return -1;
+  stage = new_stage(chain, DSP_BIQUAD);
+  if (stage == NULL) return -1;
+  stage->kind = kind;
+  stage->frequency = frequency;
+  stage->q = q;
+  stage->gainDb = gainDb;
+  if (design_biquad(stage, chain->rate) != 0) return -1;
+  chain->stageCount++;
+  return 0;
+}
+
+void dsp_set_rate(dspchain *chain, float rate)
+{
+  unsigned i;
+  chain->rate = rate;
+  for (i = 0; i < chain->stageCount; i++) {
+    dspstage *stage = &chain->stages[i];
+    if (stage->type == DSP_GAIN) stage->smoothing = 1.0 - expf(-1.0 / (GAIN_SMOOTHING_SECONDS * rate));
+    if (stage->type == DSP_BIQUAD) design_biquad(stage, rate);
+  }
+}
+
+int dsp_parse(dspchain *chain, const char *spec)
+{
+  static const struct { const char *name; int kind; } filters[] = {
+    { "lowpass", BIQUAD_LOWPASS }, { "highpass", BIQUAD_HIGHPASS },
+    { "peak", BIQUAD_PEAK }, { "lowshelf", BIQUAD_LOWSHELF },
+    { "highshelf", BIQUAD_HIGHSHELF }
+  };
+  char name[32];
+  float a = 0.0, b = 0.7071, c = 0.0;
+  int fields = sscanf(spec, "%31s %f %f %f", name, &a, &b, &c);
+  unsigned i;
+
+  if (fields < 1) return -1;
+  if (!strcmp(name, "gain")) return (fields == 2) ? dsp_add_gain(chain, a) : -1;
+  if (!strcmp(name, "dcblock")) return (fields == 1) ? dsp_add_dc_blocker(chain) : -1;
+  for (i = 0; i < sizeof(filters) / sizeof(filters[0]); i++) {
+    if (strcmp(name, filters[i].name)) continue;
+    if (filters[i].kind == BIQUAD_LOWPASS || filters[i].kind == BIQUAD_HIGHPASS) {
+      if (fields < 2) return -1;
+    } else if (fields < 4) return -1;
+    return dsp_add_biquad(chain, filters[i].kind, a, b, c);
+  }
+  return -1;
+}
+
+int dsp_load(dspchain *chain, const char *path)
+{
+  char line[256];
+  int result = 0;
+  FILE *f = fopen(path, "r");
+
+  if (f == NULL) return -1;
+  while (result == 0 && fgets(line, sizeof(line), f) != NULL) {
+    char *p = line + strspn(line, " \t");
+    if (*p == '#' || *p == '\n' || *p == '\0') continue;
+    result = dsp_parse(chain, p);
+  }
+  fclose(f);
+  return result;
+}
+
+void dsp_set_gain(dspchain *chain, float db)
+{
+  unsigned i;
+  for (i = 0; i < chain->stageCount; i++) {
+    if (chain->stages[i].type == DSP_GAIN) chain->stages[i].targetGain = powf(10.0, db / 20.0);
+  }
+}
+
+void dsp_reset(dspchain *chain)
+{
+  unsigned i;
+  for (i = 0; i < chain->stageCount; i++) {
+    dspstage *stage = &chain->stages[i];
+    stage->gain = stage->targetGain;
+    memset(stage->z1, 0, sizeof(stage->z1));
+    memset(stage->z2, 0, sizeof(stage->z2));
+  }
+}
+
+static void process_gain(dspstage *stage, float *samples, unsigned frameCount, unsigned channelCount)
+{
+  float gain = stage->gain;
+  float target = stage->targetGain;
+  unsigned i, c;
+
+  if (gain == target) {
+    /* steady state: a plain vectorizable multiply */
+    unsigned n = frameCount * channelCount;
+    for (i = 0; i < n; i++) samples[i] *= gain;
+    return;
+  }
+  for (i = 0; i < frameCount; i++) {
+    gain += (target - gain) * stage->smoothing;
+    for (c = 0; c < channelCount; c++) samples[i * channelCount + c] *= gain;
+  }
+  if (fabsf(gain - target) < 1e-6) gain = target;
+  stage->gain = gain;
+}
+
+static void process_biquad_stereo(dspstage *stage, float *samples, unsigned frameCount)
+{
+  /* transposed direct form II; left and right are independent lanes */
+  float b0 = stage->b0, b1 = stage->b1, b2 = stage->b2, a1 = stage->a1, a2 = stage->a2;
+  float z1L = stage->z1[0], z2L = stage->z2[0];
+  float z1R = stage->z1[1], z2R = stage->z2[1];
+  unsigned i;
+
+  for (i = 0; i < frameCount; i++) {
+    float xL = samples[2*i];
+    float xR = samples[2*i+1];
+    float yL = b0 * xL + z1L;
+    float yR = b0 * xR + z1R;
+    z1L = b1 * xL - a1 * yL + z2L;
+    z1R = b1 * xR - a1 * yR + z2R;
+    z2L = b2 * xL - a2 * yL;
+    z2R = b2 * xR - a2 * yR;
+    samples[2*i] = yL;
+    samples[2*i+1] = yR;
+  }
+  stage->z1[0] = z1L; stage->z2[0] = z2L;
+  stage->z1[1] = z1R; stage->z2[1] = z2R;
+}
+
+static void process_biquad_mono(dspstage *stage, float *samples, unsigned frameCount)
+{
+  float b0 = stage->b0, b1 = stage->b1, b2 = stage->b2, a1 = stage->a1, a2 = stage->a2;
+  float z1 = stage->z1[0], z2 = stage->z2[0];
+  unsigned i;
+
+  for (i = 0; i < frameCount; i++) {
+    float x = samples[i];
+    float y = b0 * x + z1;
+    z1 = b1 * x - a1 * y + z2;
+    z2 = b2 * x - a2 * y;
+    samples[i] = y;
+  }
+  stage->z1[0] = z1;
+  stage->z2[0] = z2;
+}
+
+void dsp_process(dspchain *chain, float *samples, unsigned sampleCount)
+{
+  unsigned frameCount = sampleCount / chain->channelCount;
+  unsigned i;
+
+  assert(sampleCount % chain->channelCount == 0);
+  for (i = 0; i < chain->stageCount; i++) {
+    dspstage *stage = &chain->stages[i];
+    if (stage->type == DSP_GAIN) process_gain(stage, samples, frameCount, chain->channelCount);
+    else if (chain->channelCount == 2) process_biquad_stereo(stage, samples, frameCount);
+    else process_biquad_mono(stage, samples, frameCount);
+  }
+}
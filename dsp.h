@@ -0,0 +1,90 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#ifndef __dsp_h__
+#define __dsp_h__
+
+/* A short chain of processing stages run over interleaved float samples:
+   smoothed gain, a DC blocker and biquad filters (RBJ cookbook). Each
+   stage runs over every channel in the same pass. */
+
+#define DSP_MAX_STAGES 16
+#define DSP_MAX_CHANNELS 2
+
+enum { DSP_GAIN, DSP_DCBLOCK, DSP_BIQUAD };
+enum { BIQUAD_LOWPASS, BIQUAD_HIGHPASS, BIQUAD_PEAK, BIQUAD_LOWSHELF, BIQUAD_HIGHSHELF };
+
+typedef struct {
+  int type;
+  float gain;
+  float targetGain;
+  float smoothing;
+  float b0, b1, b2, a1, a2;
+  /* a biquad's design, to recompute it at another rate */
+  int kind;
+  float frequency, q, gainDb;
+  float z1[DSP_MAX_CHANNELS];
+  float z2[DSP_MAX_CHANNELS];
+} dspstage;
+
+typedef struct {
+  float rate;
+  unsigned channelCount;
+  unsigned stageCount;
+  dspstage stages[DSP_MAX_STAGES];
+} dspchain;
+
+void dsp_init(dspchain *chain, float rate, unsigned channelCount);
+
+/* These return 0, or -1 when the chain is full or the stage is bad. */
+int dsp_add_gain(dspchain *chain, float db);
+int dsp_add_dc_blocker(dspchain *chain);
+int dsp_add_biquad(dspchain *chain, int kind, float frequency, float q, float gainDb);
+
+/* One stage from text, as in a config file line:
+     gain <dB>
+     dcblock
+     lowpass|highpass <Hz> [q]
+     peak|lowshelf|highshelf <Hz> <q> <dB> */
+int dsp_parse(dspchain *chain, const char *spec);
+
+/* A file of dsp_parse lines; blank lines and # comments are skipped. */
+int dsp_load(dspchain *chain, const char *path);
+
+/* Redesign the stages for a new sample rate, keeping their state. A
+   filter above the new Nyquist frequency is pinned just below it. */
+void dsp_set_rate(dspchain *chain, float rate);
+
+/* Ramp every gain stage to db over a few milliseconds. */
+void dsp_set_gain(dspchain *chain, float db);
+
+/* Forget what the stages have seen: filters start again from silence and
+   gains jump to where they were ramping. */
+void dsp_reset(dspchain *chain);
+
+/* sampleCount is interleaved samples, whole frames of them. */
+void dsp_process(dspchain *chain, float *samples, unsigned sampleCount);
+
+#endif /* __dsp_h__ */
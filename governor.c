@@ -0,0 +1,141 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#include "governor.h"
+#include "resampler.h"
+
+/* the load is smoothed over about this much audio */
+#define SMOOTHING_SECONDS 0.25
+/* no switch sooner than this after the last, unless a block overran */
+#define HOLD_SECONDS 0.5
+/* the load must have looked low enough for this long to step up */
+#define RECOVER_SECONDS 2.0
+/* and low enough means the next tier up would use this much of the budget */
+#define RECOVER_SHARE 0.6
+
+/* rough cost of each tier against linear, to guess the load a step up
+   would bring */
+static const double tierCost[RESAMPLER_QUALITY_COUNT] = { 1.0, 1.0, 3.0, 12.0 };
+
+void init_governor(governor *g, int maxQuality, float budget)
+{
+  governor_set(g, maxQuality, budget);
+  pthread_mutex_init(&g->lock, NULL);
+  g->switchCount = 0;
+  g->switchesTaken = 0;
+}
+
+void destroy_governor(governor *g)
+{
+  pthread_mutex_destroy(&g->lock);
+}
+
+void governor_set(governor *g, int maxQuality, float budget)
+{
+  g->budget = budget;
+  g->maxQuality = maxQuality;
+  g->quality = maxQuality;
+  g->load = 0.0;
+  g->heldSeconds = 0.0;
+  g->calmSeconds = 0.0;
+}
+
+static void log_switch(governor *g, unsigned long long position, int toQuality)
+{
+  qualityswitch *qs = &g->switches[g->switchCount % GOVERNOR_LOG_SIZE];
+  qs->position = position;
+  qs->fromQuality = g->quality;
+  qs->toQuality = toQuality;
+  qs->load = g->load;
+  /* publish the switch before the count that makes it visible */
+  __sync_synchronize();
+  g->switchCount++;
+  g->quality = toQuality;
+  g->heldSeconds = 0.0;
+  g->calmSeconds = 0.0;
+}
+
+int governor_block(governor *g, double secondsSpent, double secondsOfAudio, unsigned long long position)
+{
+  double blockLoad;
+
+  if (g->budget <= 0.0 || secondsOfAudio <= 0.0) return g->quality;
+  blockLoad = secondsSpent / secondsOfAudio;
+  g->load += (blockLoad - g->load) * secondsOfAudio / (secondsOfAudio + SMOOTHING_SECONDS);
+  g->heldSeconds += secondsOfAudio;
+
+  if (g->quality > RESAMPLER_BOX && g->load > g->budget && (g->heldSeconds >= HOLD_SECONDS || blockLoad > 1.0)) {
+    log_switch(g, position, g->quality - 1);
+    return g->quality;
+  }
+  if (g->quality < g->maxQuality) {
+    double guess = g->load * tierCost[g->quality + 1] / tierCost[g->quality];
+    if (guess < g->budget * RECOVER_SHARE) g->calmSeconds += secondsOfAudio;
+    else g->calmSeconds = 0.0;
+    if (g->calmSeconds >= RECOVER_SECONDS && g->heldSeconds >= HOLD_SECONDS) {
+      log_switch(g, position, g->quality + 1);
+      /* the step up is expected to cost this much */
+      g->load = guess;
+    }
+  }
+  return g->quality;
+}
+
+int governor_quality(governor *g)
+{
+  return g->quality;
+}
+
+float governor_load(governor *g)
+{
+  return g->load;
+}
+
+unsigned governor_take_switches(governor *g, qualityswitch switches[], unsigned maxCount)
+{
+  unsigned taken = 0;
+  pthread_mutex_lock(&g->lock);
+  while (taken < maxCount) {
+    unsigned long count = g->switchCount;
+    /* the slot at count is the one being written, so it isn't kept */
+    unsigned long oldest = (count > GOVERNOR_LOG_SIZE - 1) ? count - (GOVERNOR_LOG_SIZE - 1) : 0;
+    if (g->switchesTaken < oldest) g->switchesTaken = oldest;
+    if (g->switchesTaken == count) break;
+    __sync_synchronize();
+    switches[taken] = g->switches[g->switchesTaken % GOVERNOR_LOG_SIZE];
+    __sync_synchronize();
+    /* if the writer lapped us the switch may be torn: try again */
+    if (g->switchCount - g->switchesTaken >= GOVERNOR_LOG_SIZE) continue;
+    g->switchesTaken++;
+    taken++;
+  }
+  pthread_mutex_unlock(&g->lock);
+  return taken;
+}
+
+unsigned long governor_switch_count(governor *g)
+{
+  return g->switchCount;
+}
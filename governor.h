@@ -0,0 +1,82 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#ifndef __governor_h__
+#define __governor_h__
+
+#include <pthread.h>
+
+/* A governor watches how long a stream takes to process each block
+   against the block's length in real time, and picks the resampler
+   quality (resampler.h) to use next: one tier down as soon as the
+   smoothed load passes its budget, and one tier back up once the load
+   has looked low enough for that tier for a couple of seconds. Every
+   switch is logged, the newest GOVERNOR_LOG_SIZE - 1 kept, without the
+   stream's thread taking a lock. */
+
+#define GOVERNOR_LOG_SIZE 64
+
+typedef struct {
+  unsigned long long position;
+  int fromQuality;
+  int toQuality;
+  float load;
+} qualityswitch;
+
+typedef struct {
+  float budget;
+  int maxQuality;
+  int quality;
+  double load;
+  double heldSeconds;
+  double calmSeconds;
+  /* written by the stream's thread alone; the lock is the readers' */
+  qualityswitch switches[GOVERNOR_LOG_SIZE];
+  volatile unsigned long switchCount;
+  pthread_mutex_t lock;
+  unsigned long switchesTaken;
+} governor;
+
+/* budget is the share of real time the stream may spend processing,
+   e.g. 0.25; 0 leaves the quality at maxQuality. */
+void init_governor(governor *g, int maxQuality, float budget);
+void destroy_governor(governor *g);
+
+/* Start over with a new top tier and budget, keeping the log. */
+void governor_set(governor *g, int maxQuality, float budget);
+
+/* Account for a block of secondsOfAudio that took secondsSpent, at
+   position in the stream; returns the quality for what comes next. */
+int governor_block(governor *g, double secondsSpent, double secondsOfAudio, unsigned long long position);
+
+int governor_quality(governor *g);
+float governor_load(governor *g);
+
+/* Switches since the last call, oldest first, and how many in all. When
+   the log is full the oldest is dropped. */
+unsigned governor_take_switches(governor *g, qualityswitch switches[], unsigned maxCount);
+unsigned long governor_switch_count(governor *g);
+
+#endif /* __governor_h__ */
@@ -0,0 +1,75 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#include "halfband.h"
+#include <strings.h>
+
+/* taps 1, 3, 5 ... 15 frames either side of the centre, which is 0.5;
+   the even ones are zero */
+static const float oddTaps[] = {
+  0.314440966, -0.094999961, 0.046591482, -0.024252350,
+  0.011989686, -0.005209006, 0.001767811, -0.000315606
+};
+
+void init_halfband(halfband *hb)
+{
+  bzero(hb->line, sizeof(hb->line));
+  hb->position = 0;
+  hb->skipNext = 0;
+}
+
+static float filter(const float *window)
+{
+  const float *centre = window + HALFBAND_DELAY;
+  float sum = 0.5 * centre[0];
+  unsigned i;
+  for (i = 0; i < sizeof(oddTaps) / sizeof(oddTaps[0]); i++) {
+    sum += oddTaps[i] * (centre[-1 - 2 * (int)i] + centre[1 + 2 * i]);
+  }
+  return sum;
+}
+
+unsigned halfband_process(halfband *hb, const float *input, unsigned sampleCount, float *output)
+{
+  unsigned frameCount = sampleCount / 2;
+  unsigned outputCount = 0;
+  unsigned position = hb->position;
+  int skipNext = hb->skipNext;
+  unsigned i;
+
+  for (i = 0; i < frameCount; i++) {
+    /* newest first, so the window runs from position onward */
+    position = (position == 0) ? HALFBAND_LENGTH - 1 : position - 1;
+    hb->line[0][position] = hb->line[0][position + HALFBAND_LENGTH] = input[2 * i];
+    hb->line[1][position] = hb->line[1][position + HALFBAND_LENGTH] = input[2 * i + 1];
+    skipNext = !skipNext;
+    if (!skipNext) continue;
+    output[outputCount++] = filter(&hb->line[0][position]);
+    output[outputCount++] = filter(&hb->line[1][position]);
+  }
+  hb->position = position;
+  hb->skipNext = skipNext;
+  return outputCount;
+}
@@ -0,0 +1,52 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#ifndef __halfband_h__
+#define __halfband_h__
+
+/* Halves the rate of interleaved stereo float samples: a 31 tap
+   halfband lowpass (Kaiser window, beta 6) keeps everything below 0.36
+   of the new Nyquist frequency and holds what would alias back into it
+   about 60 dB down, and every second frame is kept. Half the taps are
+   zero and the rest symmetric, so each output costs eight multiplies per
+   channel. Output lags input by HALFBAND_DELAY input frames. */
+
+#define HALFBAND_LENGTH 31
+#define HALFBAND_DELAY ((HALFBAND_LENGTH - 1) / 2)
+
+typedef struct {
+  /* each channel's recent input, stored twice so a window never wraps */
+  float line[2][2 * HALFBAND_LENGTH];
+  unsigned position;
+  int skipNext;
+} halfband;
+
+void init_halfband(halfband *hb);
+
+/* Filter sampleCount samples (whole frames) and write about half as many
+   to output, which may not be input. Returns the count written. */
+unsigned halfband_process(halfband *hb, const float *input, unsigned sampleCount, float *output);
+
+#endif /* __halfband_h__ */
@@ -0,0 +1,544 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+/*
+ * jitterreplay drives audiopipeout and audiopipein from a timing trace
+ * instead of audio hardware. It links in its own audiodevice, runs the
+ * output and input callbacks on their own threads at the times the trace
+ * gives, and runs a producer (like speakerpipe) and a consumer (like
+ * mikepipe) against the real queue and resampler. It reports underruns,
+ * overruns, how long the callbacks and producer were blocked, and the
+ * worst queue latency seen.
+ *
+ * Trace lines are "<kind> <time in us> <value>", in time order:
+ *   out   <t> <frames>   output callback asking for frames
+ *   in    <t> <frames>   input callback delivering frames
+ *   pstall <t> <us>      producer stops writing for us
+ *   cstall <t> <us>      consumer stops reading for us
+ * Without -t a synthetic trace is generated from the other options.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include "audiopipeout.h"
+#include "audiopipein.h"
+#include "allocguard.h"
+#include "trace.h"
+#include "version.h"
+
+#define MAX_CALLBACK_FRAMES 8192
+#define CLIENT_FRAME_COUNT 4096
+
+enum { EVENT_OUT, EVENT_IN, EVENT_PSTALL, EVENT_CSTALL };
+
+typedef struct {
+  int kind;
+  double time;
+  unsigned value;
+} traceevent;
+
+typedef struct {
+  traceevent *events;
+  unsigned count;
+  unsigned capacity;
+} trace;
+
+/* results for one side of the pipe, in seconds unless noted */
+typedef struct {
+  unsigned long callbacks;
+  unsigned long xruns;
+  unsigned long lateCallbacks;
+  double worstLateness;
+  double worstCallbackTime;
+  double totalCallbackTime;
+  double worstQueueLatency;
+  double clientBlockTime;
+  double worstClientBlock;
+  double worstEndToEnd;
+} sidestats;
+
+struct audiodevice {
+  int direction;
+  audiodeviceProc proc;
+  void *context;
+};
+
+static char *tool;
+static audiodevice *devices[2];
+static trace theTrace;
+static double startTime;
+static double timeScale = 1.0;
+static float streamRate = 44100;
+static double deviceRate = 44100;
+static int storeFormat = STORE_FLOAT;
+static volatile int traceDone = 0;
+static int guardAllocations = 0;
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+static sidestats outStats, inStats;
+static audiopipeout *apo;
+static audiopipein *api;
+static audiopipetap *tap;
+
+static void usage() {
+  fprintf(stderr, "usage: %s [-v] [-t traceFile] [-d seconds] [-p periodFrames] [-j jitterUs] [-S stallEveryMs] [-L stallMs] [-e seed] [-q queueFrames] [-G maxQueueFrames] [-r rate] [-R deviceRate] [-o drop|overwrite|spill] [-z silence|fade|repeat] [-k] [-a speed] [-T tapRate] [-Q quality] [-m]\n", tool);
+  fprintf(stderr, " -v : show version and exit\n");
+  fprintf(stderr, " -t : replay this trace instead of a synthetic one\n");
+  fprintf(stderr, " -d : synthetic trace length, defaults to 10 seconds\n");
+  fprintf(stderr, " -p : synthetic callback size, defaults to 512 frames\n");
+  fprintf(stderr, " -j : synthetic callback jitter, defaults to 2000 us\n");
+  fprintf(stderr, " -S : inject a producer and consumer stall this often\n");
+  fprintf(stderr, " -L : length of each injected stall, defaults to 50 ms\n");
+  fprintf(stderr, " -e : random seed for the synthetic trace\n");
+  fprintf(stderr, " -q : queue size in frames, defaults to 16384\n");
+  fprintf(stderr, " -G : let the playback queue grow from -q up to this many frames\n");
+  fprintf(stderr, " -r : stream sample rate, defaults to 44.1 kHz\n");
+  fprintf(stderr, " -R : rate the stand-in device reports, defaults to 44.1 kHz\n");
+  fprintf(stderr, " -o : capture overrun policy, defaults to drop\n");
+  fprintf(stderr, " -z : playback underrun concealment, defaults to fade\n");
+  fprintf(stderr, " -k : keep queued samples as 16 bit\n");
+  fprintf(stderr, " -a : replay this many times faster than real time\n");
+  fprintf(stderr, " -T : also read a capture tap at this rate, defaults to 16 kHz; 0 for none\n");
+  fprintf(stderr, " -Q : resample with box (the default), linear, short or sinc\n");
+  fprintf(stderr, " -m : fail if the callbacks, producer or consumer touch the heap\n");
+  exit(1);
+}
+
+/* stand-in device: remember the pipes' callbacks so the trace can call them */
+
+audiodevice *audiodevice_new(int direction, audiodeviceProc proc, void *context)
+{
+  audiodevice *device = (audiodevice*)malloc(sizeof(audiodevice));
+  device->direction = direction;
+  device->proc = proc;
+  device->context = context;
+  devices[direction] = device;
+  return device;
+}
+
+void audiodevice_start(audiodevice *device)
+{
+}
+
+void audiodevice_stop(audiodevice *device)
+{
+}
+
+void audiodevice_free(audiodevice *device)
+{
+  devices[device->direction] = NULL;
+  free(device);
+}
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double audiodevice_get_rate(audiodevice *device)
+{
+  return deviceRate;
+}
+
+double audiodevice_host_time(void)
+{
+  return now();
+}
+
+static double trace_now()
+{
+  return (now() - startTime) * timeScale;
+}
+
+static void sleep_until(double traceTime)
+{
+  double delay = (traceTime - trace_now()) / timeScale;
+  if (delay > 0) {
+    struct timespec ts;
+    ts.tv_sec = (time_t)delay;
+    ts.tv_nsec = (long)((delay - ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+  }
+}
+
+static void trace_add(trace *t, int kind, double time, unsigned value)
+{
+  if (t->count == t->capacity) {
+    t->capacity = t->capacity ? t->capacity * 2 : 1024;
+    t->events = (traceevent*)realloc(t->events, t->capacity * sizeof(traceevent));
+  }
+  t->events[t->count].kind = kind;
+  t->events[t->count].time = time;
+  t->events[t->count].value = value;
+  t->count++;
+}
+
+static void trace_load(trace *t, const char *path)
+{
+  char line[256];
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    perror(path);
+    exit(1);
+  }
+  while (fgets(line, sizeof(line), f) != NULL) {
+    char kind[16];
+    double us;
+    unsigned value;
+    if (line[0] == '#' || sscanf(line, "%15s %lf %u", kind, &us, &value) != 3) continue;
+    if (!strcmp(kind, "out")) trace_add(t, EVENT_OUT, us / 1e6, value);
+    else if (!strcmp(kind, "in")) trace_add(t, EVENT_IN, us / 1e6, value);
+    else if (!strcmp(kind, "pstall")) trace_add(t, EVENT_PSTALL, us / 1e6, value);
+    else if (!strcmp(kind, "cstall")) trace_add(t, EVENT_CSTALL, us / 1e6, value);
+  }
+  fclose(f);
+}
+
+static void trace_synthesize(trace *t, double seconds, unsigned period, double jitterUs, double stallEveryMs, double stallMs)
+{
+  double nominal = period / deviceRate;
+  double t0;
+  unsigned i, count = seconds / nominal;
+
+  /* callbacks land at their nominal time plus uniform jitter */
+  for (i = 0; i < count; i++) {
+    t0 = i * nominal + (rand() / (double)RAND_MAX) * jitterUs / 1e6;
+    trace_add(t, EVENT_OUT, t0, period);
+    t0 = i * nominal + (rand() / (double)RAND_MAX) * jitterUs / 1e6;
+    trace_add(t, EVENT_IN, t0, period);
+  }
+  if (stallEveryMs > 0) {
+    for (t0 = stallEveryMs / 1e3; t0 < seconds; t0 += stallEveryMs / 1e3) {
+      trace_add(t, EVENT_PSTALL, t0, stallMs * 1e3);
+      trace_add(t, EVENT_CSTALL, t0 + stallEveryMs / 2e3, stallMs * 1e3);
+    }
+  }
+}
+
+static void note_max(double *worst, double value)
+{
+  if (value > *worst) *worst = value;
+}
+
+static void *callback_thread(void *context)
+{
+  int kind = (int)(long)context;
+  int direction = (kind == EVENT_OUT) ? AUDIODEVICE_OUTPUT : AUDIODEVICE_INPUT;
+  sidestats *stats = (kind == EVENT_OUT) ? &outStats : &inStats;
+  threadedqueue *tq = (kind == EVENT_OUT) ? &apo->tq : &api->tq;
+  unsigned sampleSize = (kind == EVENT_OUT) ? apo->sampleSize : api->sampleSize;
+  float *samples = (float*)malloc(MAX_CALLBACK_FRAMES * 2 * sizeof(float));
+  /* output queues hold device-rate samples, input queues stream-rate */
+  double bytesPerSecond = ((kind == EVENT_OUT) ? deviceRate : streamRate) * 2 * sampleSize;
+  unsigned long phase = 0;
+  unsigned i;
+
+  TRACE_THREAD_NAME((kind == EVENT_OUT) ? "output device" : "input device");
+  if (guardAllocations) allocguard_watch_thread();
+  for (i = 0; i < theTrace.count; i++) {
+    traceevent *e = &theTrace.events[i];
+    unsigned frames = e->value;
+    unsigned used, j;
+    double entry, elapsed, stamp;
+
+    if (e->kind != kind) continue;
+    if (frames > MAX_CALLBACK_FRAMES) frames = MAX_CALLBACK_FRAMES;
+    sleep_until(e->time);
+
+    if (kind == EVENT_IN) {
+      for (j = 0; j < frames; j++, phase++) {
+        samples[2*j] = samples[2*j+1] = 0.5 * sin(phase * 2 * M_PI * 440.0 / deviceRate);
+      }
+    }
+    entry = trace_now();
+    used = spaceUsed(tq);
+    /* an input block started a buffer ago; an output block plays now */
+    stamp = now();
+    if (kind == EVENT_IN) stamp -= frames / deviceRate;
+    devices[direction]->proc(devices[direction]->context, samples, frames * 2, stamp);
+    elapsed = trace_now() - entry;
+
+    pthread_mutex_lock(&statsLock);
+    stats->callbacks++;
+    if (entry - e->time > frames / deviceRate) stats->lateCallbacks++;
+    note_max(&stats->worstLateness, entry - e->time);
+    note_max(&stats->worstCallbackTime, elapsed);
+    stats->totalCallbackTime += elapsed;
+    note_max(&stats->worstQueueLatency, used / bytesPerSecond);
+    pthread_mutex_unlock(&statsLock);
+  }
+  allocguard_unwatch_thread();
+  free(samples);
+  return NULL;
+}
+
+static double next_stall(int kind, unsigned *cursor, double *length)
+{
+  while (*cursor < theTrace.count) {
+    traceevent *e = &theTrace.events[(*cursor)++];
+    if (e->kind == kind) {
+      *length = e->value / 1e6;
+      return e->time;
+    }
+  }
+  return -1.0;
+}
+
+static void *producer_thread(void *context)
+{
+  short buf[CLIENT_FRAME_COUNT];
+  unsigned long phase = 0;
+  unsigned cursor = 0;
+  double stallLength = 0.0;
+  double stallAt = next_stall(EVENT_PSTALL, &cursor, &stallLength);
+
+  TRACE_THREAD_NAME("producer");
+  if (guardAllocations) allocguard_watch_thread();
+  while (!traceDone) {
+    double entry, blocked, heard;
+    unsigned j;
+    if (stallAt >= 0 && trace_now() >= stallAt) {
+      sleep_until(stallAt + stallLength);
+      stallAt = next_stall(EVENT_PSTALL, &cursor, &stallLength);
+    }
+    for (j = 0; j < CLIENT_FRAME_COUNT; j++, phase++) {
+      buf[j] = 16000 * sin((phase / 2) * 2 * M_PI * 440.0 / streamRate);
+    }
+    entry = trace_now();
+    apo_write_s16_samples(apo, buf, CLIENT_FRAME_COUNT);
+    blocked = trace_now() - entry;
+    /* how far ahead of the device the last sample written is */
+    if (apo_presentation_time(apo, apo_write_position(apo) - 1, &heard) == 0) {
+      note_max(&outStats.worstEndToEnd, heard - audiodevice_host_time());
+    }
+    pthread_mutex_lock(&statsLock);
+    outStats.clientBlockTime += blocked;
+    note_max(&outStats.worstClientBlock, blocked);
+    pthread_mutex_unlock(&statsLock);
+  }
+  return NULL;
+}
+
+static void *consumer_thread(void *context)
+{
+  short buf[CLIENT_FRAME_COUNT];
+  unsigned cursor = 0;
+  double stallLength = 0.0;
+  double stallAt = next_stall(EVENT_CSTALL, &cursor, &stallLength);
+
+  TRACE_THREAD_NAME("consumer");
+  if (guardAllocations) allocguard_watch_thread();
+  while (!traceDone) {
+    double entry, blocked, captured;
+    if (stallAt >= 0 && trace_now() >= stallAt) {
+      sleep_until(stallAt + stallLength);
+      stallAt = next_stall(EVENT_CSTALL, &cursor, &stallLength);
+    }
+    entry = trace_now();
+    api_read_s16_samples(api, buf, CLIENT_FRAME_COUNT);
+    blocked = trace_now() - entry;
+    /* how long ago the last sample read was captured */
+    if (api_capture_time(api, api_read_position(api) - 1, &captured) == 0) {
+      note_max(&inStats.worstEndToEnd, audiodevice_host_time() - captured);
+    }
+    pthread_mutex_lock(&statsLock);
+    inStats.clientBlockTime += blocked;
+    note_max(&inStats.worstClientBlock, blocked);
+    pthread_mutex_unlock(&statsLock);
+  }
+  return NULL;
+}
+
+/* the tap is read as fast as it fills */
+static void *tap_thread(void *context)
+{
+  short buf[CLIENT_FRAME_COUNT];
+
+  TRACE_THREAD_NAME("tap reader");
+  if (guardAllocations) allocguard_watch_thread();
+  while (!traceDone) api_tap_read_s16_samples(tap, buf, CLIENT_FRAME_COUNT);
+  return NULL;
+}
+
+static void report(const char *name, const char *xrunName, const char *clientName, const char *endToEndName, sidestats *s)
+{
+  printf("%s: %lu callbacks, %lu %s, %lu late (worst %.3f ms)\n", name, s->callbacks, s->xruns, xrunName, s->lateCallbacks, s->worstLateness * 1e3);
+  printf("  callback time: worst %.3f ms, mean %.3f ms\n", s->worstCallbackTime * 1e3, s->callbacks ? s->totalCallbackTime * 1e3 / s->callbacks : 0.0);
+  printf("  %s blocked: total %.3f s, worst %.3f ms\n", clientName, s->clientBlockTime, s->worstClientBlock * 1e3);
+  printf("  worst queue latency: %.3f ms\n", s->worstQueueLatency * 1e3);
+  printf("  worst %s: %.3f ms (from timestamps)\n", endToEndName, s->worstEndToEnd * 1e3);
+}
+
+int main(int argc, char *argv[]) {
+  int ch;
+  char *tracePath = NULL;
+  double seconds = 10.0;
+  unsigned period = 512;
+  double jitterUs = 2000.0;
+  double stallEveryMs = 0.0;
+  double stallMs = 50.0;
+  unsigned queueFrames = 16384;
+  unsigned maxQueueFrames = 0;
+  int overrunPolicy = OVERRUN_DROP_NEWEST;
+  int concealment = CONCEAL_FADE;
+  float tapRate = 16000;
+  int quality = RESAMPLER_BOX;
+  pthread_t outThread, inThread, producer, consumer, tapReader;
+
+  TRACE_INIT();
+  tool = argv[0];
+  while ((ch = getopt(argc, argv, "vt:d:p:j:S:L:e:q:G:r:R:o:z:ka:T:Q:m")) != -1)
+    switch(ch) {
+    case 'v':
+      fprintf(stderr, "%s version %s\n", tool, VERSION);
+      exit(-1);
+      break;
+    case 't':
+      tracePath = optarg;
+      break;
+    case 'd':
+      seconds = atof(optarg);
+      break;
+    case 'p':
+      period = atoi(optarg);
+      break;
+    case 'j':
+      jitterUs = atof(optarg);
+      break;
+    case 'S':
+      stallEveryMs = atof(optarg);
+      break;
+    case 'L':
+      stallMs = atof(optarg);
+      break;
+    case 'e':
+      srand(atoi(optarg));
+      break;
+    case 'q':
+      queueFrames = atoi(optarg);
+      break;
+    case 'G':
+      maxQueueFrames = atoi(optarg);
+      break;
+    case 'r':
+      streamRate = atof(optarg);
+      break;
+    case 'R':
+      deviceRate = atof(optarg);
+      break;
+    case 'o':
+      if (!strcmp(optarg, "drop")) overrunPolicy = OVERRUN_DROP_NEWEST;
+      else if (!strcmp(optarg, "overwrite")) overrunPolicy = OVERRUN_OVERWRITE_OLDEST;
+      else if (!strcmp(optarg, "spill")) overrunPolicy = OVERRUN_SPILL;
+      else usage();
+      break;
+    case 'z':
+      if (!strcmp(optarg, "silence")) concealment = CONCEAL_SILENCE;
+      else if (!strcmp(optarg, "fade")) concealment = CONCEAL_FADE;
+      else if (!strcmp(optarg, "repeat")) concealment = CONCEAL_REPEAT;
+      else usage();
+      break;
+    case 'k':
+      storeFormat = STORE_S16;
+      break;
+    case 'a':
+      timeScale = atof(optarg);
+      break;
+    case 'T':
+      tapRate = atof(optarg);
+      break;
+    case 'Q':
+      quality = resampler_quality_named(optarg);
+      if (quality < 0) usage();
+      break;
+    case 'm':
+      if (!allocguard_supported()) {
+        fprintf(stderr, "%s: can't watch the allocator on this platform\n", tool);
+        exit(1);
+      }
+      guardAllocations = 1;
+      break;
+    case '?':
+    default:
+      usage();
+    }
+  argc -= optind;
+  argv += optind;
+
+  if (argc > 0 || period == 0 || timeScale <= 0) usage();
+
+  if (tracePath != NULL) trace_load(&theTrace, tracePath);
+  else trace_synthesize(&theTrace, seconds, period, jitterUs, stallEveryMs, stallMs);
+
+  if (maxQueueFrames < queueFrames) maxQueueFrames = queueFrames;
+  apo = apo_new_elastic(streamRate, 0, queueFrames * 2, maxQueueFrames * 2, storeFormat);
+  api = api_new_with_storage(streamRate, 0, queueFrames * 2, storeFormat);
+  apo_set_concealment(apo, concealment);
+  api_set_overrun_policy(api, overrunPolicy);
+  if (tapRate > 0) tap = api_add_tap(api, tapRate, 0, queueFrames * 2, STORE_S16);
+  /* as mikepipe does it, after the pipe is running */
+  if (quality != RESAMPLER_BOX) {
+    apo_set_resampler_quality(apo, quality, 0);
+    api_set_resampler_quality(api, quality, 0);
+  }
+
+  startTime = now();
+  pthread_create(&producer, NULL, producer_thread, NULL);
+  pthread_create(&consumer, NULL, consumer_thread, NULL);
+  if (tap != NULL) pthread_create(&tapReader, NULL, tap_thread, NULL);
+  pthread_create(&outThread, NULL, callback_thread, (void*)(long)EVENT_OUT);
+  pthread_create(&inThread, NULL, callback_thread, (void*)(long)EVENT_IN);
+  pthread_join(outThread, NULL);
+  pthread_join(inThread, NULL);
+  traceDone = 1;
+
+  /* the producer and consumer may be parked on the queue forever now, so
+     report and exit without joining them */
+  pthread_mutex_lock(&statsLock);
+  outStats.xruns = apo_underrun_count(apo);
+  inStats.xruns = api_overrun_count(api);
+  printf("queue %u frames, stream rate %.0f Hz, %s storage, %u trace events\n", queueFrames, streamRate, storeFormat == STORE_S16 ? "s16" : "float", theTrace.count);
+  if (maxQueueFrames > queueFrames) printf("playback queue now %u frames\n", apo_queue_capacity(apo) / 2);
+  report("output", "underruns", "producer", "write to presentation", &outStats);
+  printf("  samples concealed: %llu\n", rangelog_total_length(&apo->underruns));
+  report("input", "overruns", "consumer", "capture to read", &inStats);
+  printf("  samples lost to overruns: %llu\n", rangelog_total_length(&api->overruns));
+  if (tap != NULL) {
+    printf("tap at %.0f Hz: %lu overruns, %llu samples lost\n", tapRate, api_tap_overrun_count(tap), rangelog_total_length(&tap->overruns));
+  }
+  pthread_mutex_unlock(&statsLock);
+  if (guardAllocations) {
+    unsigned long heapCalls = allocguard_count();
+    printf("heap calls while streaming: %lu\n", heapCalls);
+    if (heapCalls > 0) exit(1);
+  }
+  exit(0);
+}
@@ -0,0 +1,67 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#include "levels.h"
+#include <math.h>
+
+void levels_measure(audiolevels *levels, const float *samples, unsigned frameCount)
+{
+  /* one pass, with independent left and right accumulators so the loop
+     body is a pair of identical lanes */
+  float sumL = 0.0, sumR = 0.0;
+  float sqL = 0.0, sqR = 0.0;
+  float peakL = 0.0, peakR = 0.0;
+  unsigned i;
+
+  for (i = 0; i < frameCount; i++) {
+    float l = samples[2*i];
+    float r = samples[2*i+1];
+    float al = fabsf(l);
+    float ar = fabsf(r);
+    sumL += l;
+    sumR += r;
+    sqL += l * l;
+    sqR += r * r;
+    peakL = (al > peakL) ? al : peakL;
+    peakR = (ar > peakR) ? ar : peakR;
+  }
+  if (frameCount == 0) frameCount = 1;
+  levels->peak[0] = peakL;
+  levels->peak[1] = peakR;
+  levels->rms[0] = sqrtf(sqL / frameCount);
+  levels->rms[1] = sqrtf(sqR / frameCount);
+  levels->dc[0] = sumL / frameCount;
+  levels->dc[1] = sumR / frameCount;
+}
+
+float levels_loudest_rms(const audiolevels *levels)
+{
+  return (levels->rms[0] > levels->rms[1]) ? levels->rms[0] : levels->rms[1];
+}
+
+float levels_db_to_linear(float db)
+{
+  return powf(10.0, db / 20.0);
+}
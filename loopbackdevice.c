@@ -0,0 +1,184 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+/*
+ * A stand-in audiodevice that needs no hardware: whatever the output
+ * device plays comes back on the input device after a fixed delay. One
+ * thread runs both callbacks in real time, a period at a time. It is
+ * configured from the environment:
+ *   LOOPBACK_DELAY_MS   from a sample being played to it being
+ *                       captured, by the devices' timestamps, default 10
+ *   LOOPBACK_PERIOD     frames per callback, default 512
+ *   LOOPBACK_RATE       nominal sample rate, default 44100
+ *   LOOPBACK_RATE_CHANGE  "<seconds>:<rate>" switches to another rate
+ *                       that many seconds after starting
+ */
+
+#include "audiodevice.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+struct audiodevice {
+  int direction;
+  audiodeviceProc proc;
+  void *context;
+  int isRunning;
+};
+
+static pthread_mutex_t loopbackLock = PTHREAD_MUTEX_INITIALIZER;
+static audiodevice *devices[2];
+static int threadStarted = 0;
+static volatile double loopbackRate = 0;
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned env_unsigned(const char *name, unsigned defaultValue)
+{
+  const char *value = getenv(name);
+  return (value != NULL) ? (unsigned)atof(value) : defaultValue;
+}
+
+static void *loopback_thread(void *context)
+{
+  unsigned period = env_unsigned("LOOPBACK_PERIOD", 512);
+  unsigned delay = env_unsigned("LOOPBACK_DELAY_MS", 10) * loopbackRate / 1000;
+  /* a period is captured over the period before its callback, and played
+     over the one after, so the line is a period longer than the delay */
+  unsigned lineFrames = delay + 2 * period;
+  float *line = (float*)calloc(lineFrames * 2, sizeof(float));
+  float *block = (float*)malloc(period * 2 * sizeof(float));
+  unsigned writeAt = delay + period;
+  unsigned readAt = 0;
+  double start = now();
+  unsigned long periods = 0;
+  const char *change = getenv("LOOPBACK_RATE_CHANGE");
+  double changeAt = 0, changeRate = 0;
+
+  TRACE_THREAD_NAME("loopback device");
+  if (change != NULL && sscanf(change, "%lf:%lf", &changeAt, &changeRate) == 2) changeAt += start;
+  else changeRate = 0;
+
+  while (1) {
+    audiodevice *in, *out;
+    double wake = start + (periods * period) / loopbackRate;
+    double delayToWake = wake - now();
+    unsigned i;
+
+    if (changeRate > 0 && wake >= changeAt) {
+      /* the delay line keeps its length in frames */
+      loopbackRate = changeRate;
+      changeRate = 0;
+      start = wake;
+      periods = 0;
+    }
+    if (delayToWake > 0) {
+      struct timespec ts;
+      ts.tv_sec = (time_t)delayToWake;
+      ts.tv_nsec = (long)((delayToWake - ts.tv_sec) * 1e9);
+      nanosleep(&ts, NULL);
+    }
+    pthread_mutex_lock(&loopbackLock);
+    in = (devices[AUDIODEVICE_INPUT] && devices[AUDIODEVICE_INPUT]->isRunning) ? devices[AUDIODEVICE_INPUT] : NULL;
+    out = (devices[AUDIODEVICE_OUTPUT] && devices[AUDIODEVICE_OUTPUT]->isRunning) ? devices[AUDIODEVICE_OUTPUT] : NULL;
+    pthread_mutex_unlock(&loopbackLock);
+
+    memset(block, 0, period * 2 * sizeof(float));
+    if (out != NULL) out->proc(out->context, block, period * 2, now());
+    for (i = 0; i < period; i++) {
+      line[2 * writeAt] = block[2 * i];
+      line[2 * writeAt + 1] = block[2 * i + 1];
+      writeAt = (writeAt + 1) % lineFrames;
+    }
+    for (i = 0; i < period; i++) {
+      block[2 * i] = line[2 * readAt];
+      block[2 * i + 1] = line[2 * readAt + 1];
+      readAt = (readAt + 1) % lineFrames;
+    }
+    if (in != NULL) in->proc(in->context, block, period * 2, now() - period / loopbackRate);
+    periods++;
+  }
+  return NULL;
+}
+
+audiodevice *audiodevice_new(int direction, audiodeviceProc proc, void *context)
+{
+  audiodevice *device = (audiodevice*)malloc(sizeof(audiodevice));
+  device->direction = direction;
+  device->proc = proc;
+  device->context = context;
+  device->isRunning = 0;
+  pthread_mutex_lock(&loopbackLock);
+  if (loopbackRate == 0) loopbackRate = env_unsigned("LOOPBACK_RATE", 44100);
+  devices[direction] = device;
+  pthread_mutex_unlock(&loopbackLock);
+  return device;
+}
+
+void audiodevice_start(audiodevice *device)
+{
+  pthread_t thread;
+  pthread_mutex_lock(&loopbackLock);
+  device->isRunning = 1;
+  if (!threadStarted) {
+    threadStarted = 1;
+    pthread_create(&thread, NULL, loopback_thread, NULL);
+    pthread_detach(thread);
+  }
+  pthread_mutex_unlock(&loopbackLock);
+}
+
+void audiodevice_stop(audiodevice *device)
+{
+  pthread_mutex_lock(&loopbackLock);
+  device->isRunning = 0;
+  pthread_mutex_unlock(&loopbackLock);
+}
+
+void audiodevice_free(audiodevice *device)
+{
+  pthread_mutex_lock(&loopbackLock);
+  if (devices[device->direction] == device) devices[device->direction] = NULL;
+  pthread_mutex_unlock(&loopbackLock);
+  free(device);
+}
+
+double audiodevice_get_rate(audiodevice *device)
+{
+  return loopbackRate;
+}
+
+double audiodevice_host_time(void)
+{
+  return now();
+}
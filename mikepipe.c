@@ -25,15 +25,23 @@
 
 #include <CoreAudio/AudioHardware.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
 #include "audiopipein.h"
+#include "bulkwriter.h"
+#include "shmring.h"
+#include "wavfile.h"
 #include "swap.h"
+#include "trace.h"
 #include "version.h"
 
 static char *tool;
 
 static void usage() {
-  fprintf(stderr, "usage: %s [-v] [-c channelCount (1 or 2)] [-s|-u|-f] [-b|-w|-l] [-x] [-r rate]\n", tool);
+  fprintf(stderr, "usage: %s [-v] [-c channelCount (1 or 2)] [-s|-u|-f] [-b|-w|-l] [-x] [-r rate] [-k] [-W] [-q dB] [-i indexFile] [-o drop|overwrite|spill] [-g dB] [-d stage]... [-D dspFile] [-Q quality] [-A percent] [-S ringName] [-T rate:file]...\n", tool);
   fprintf(stderr, " -v : show version and exit\n");
   fprintf(stderr, " -s : signed samples\n");
   fprintf(stderr, " -u : unsigned\n");
@@ -43,13 +51,96 @@ static void usage() {
   fprintf(stderr, " -l : 4 bytes per sample\n");
   fprintf(stderr, " -x : use opposite endian\n");
   fprintf(stderr, " -r : sample rate, defaults to 44.1 kHz\n");
+  fprintf(stderr, " -k : keep queued samples as 16 bit (halves buffer memory)\n");
+  fprintf(stderr, " -g : apply gain in dB\n");
+  fprintf(stderr, " -d : add a processing stage, e.g. \"dcblock\" or \"highpass 80\"\n");
+  fprintf(stderr, " -D : add the processing stages listed in dspFile\n");
+  fprintf(stderr, " -W : write a WAV header (RF64 past 4 GB)\n");
+  fprintf(stderr, " -q : drop audio quieter than dB (e.g. -50) after a short hold\n");
+  fprintf(stderr, " -i : log dropped ranges (sample offset and length) to indexFile\n");
+  fprintf(stderr, " -o : when output falls behind, drop new audio (default), overwrite\n");
+  fprintf(stderr, "      the oldest queued audio, or spill up to eight queues more to memory\n");
+  fprintf(stderr, " -Q : resample with box (default), linear, short or sinc\n");
+  fprintf(stderr, " -A : step the resampling down when it takes more than percent of real\n");
+  fprintf(stderr, "      time (default 25), and back up when it can; 0 never steps\n");
+  fprintf(stderr, " -S : instead of stdout, write signed or float samples into a new\n");
+  fprintf(stderr, "      shared-memory ring for another process to read\n");
+  fprintf(stderr, " -T : also write the capture at rate to file, in the same format\n");
   exit(1);
 }
 
 #define MAX_FRAME_COUNT 4096
 #define MAX_FRAME_SIZE (sizeof(float))
 
+/* output is handed to a bulkwriter so slow disks don't back up capture */
+#define BULK_BUFFER_SIZE (1024*1024)
+#define BULK_BUFFER_COUNT 16
+#define BULK_THREAD_COUNT 4
+#define HEADER_PATCH_INTERVAL 4
+
+/* about 20 seconds of 16 bit stereo at 48 kHz */
+#define RING_BYTES (4*1024*1024)
+
+#define GATE_HOLD_SECONDS 0.25
+
+/* each tap (-T) gets a smaller writer of its own */
+#define TAP_BUFFER_COUNT 4
+#define TAP_THREAD_COUNT 1
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void stop(int sig) {
+  stopRequested = 1;
+}
+
+static void wavHeaderCallback(void *context, unsigned char *header, unsigned headerSize, unsigned long long dataBytes) {
+  wav_build_header(header, (const wavformat *)context, dataBytes);
+}
+
+static int isBigEndian() {
+  union { short s; char c[2]; } u;
+  u.s = 1;
+  return u.c[0] == 0;
+}
+
 typedef unsigned (*ReadSamplesFunction)(audiopipein *, void *samples, unsigned maxFrameCount);
+typedef unsigned (*ReadTapFunction)(audiopipetap *, void *samples, unsigned maxFrameCount);
+
+typedef struct {
+  float rate;
+  char *path;
+  audiopipetap *tap;
+  int fd;
+  bulkwriter *bw;
+  wavformat wf;
+  pthread_t thread;
+} tapoutput;
+
+/* how every tap is read, the same as the main output */
+static ReadTapFunction readTapFunction;
+static int tapBytesPerSample;
+static int tapSwapEndian;
+
+static void *tap_thread(void *context) {
+  tapoutput *to = (tapoutput *)context;
+  char sampleBuffer[MAX_FRAME_COUNT * MAX_FRAME_SIZE];
+
+  while (!stopRequested) {
+    samplerange ranges[16];
+    unsigned i, count;
+    unsigned frames = readTapFunction(to->tap, sampleBuffer, MAX_FRAME_COUNT);
+    if (tapSwapEndian) {
+      if (tapBytesPerSample == 2) swap_16_samples((short*)sampleBuffer, frames);
+      if (tapBytesPerSample == 4) swap_32_samples((long*)sampleBuffer, frames);
+    }
+    bw_write(to->bw, sampleBuffer, frames * tapBytesPerSample);
+    count = api_tap_take_overrun_ranges(to->tap, ranges, 16);
+    for (i = 0; i < count; i++) {
+      fprintf(stderr, "%s: overrun in %s, lost %llu samples at %llu\n", tool, to->path, ranges[i].length, ranges[i].position);
+    }
+  }
+  return NULL;
+}
 
 int main(int argc, char *argv[]) {
   char ch;
@@ -59,12 +150,33 @@ int main(int argc, char *argv[]) {
   int channelCount = 2;
   float sampleRate = 44100;
   int bytesPerSample = 2;
+  int storeFormat = STORE_FLOAT;
+  int i;
+  char *dspStages[DSP_MAX_STAGES];
+  int dspStageCount = 0;
+  char *dspPath = NULL;
+  float gainDb = 0.0;
   char sampleBuffer[MAX_FRAME_COUNT * MAX_FRAME_SIZE];
+  int writeWav = 0;
+  float gateDb = 0.0;
+  char *indexPath = NULL;
+  FILE *indexFile = NULL;
+  int overrunPolicy = OVERRUN_DROP_NEWEST;
   ReadSamplesFunction readSamplesFunction;
   audiopipein *ap;
+  bulkwriter *bw = NULL;
+  wavformat wf;
+  char *ringName = NULL;
+  shmring *ring = NULL;
+  tapoutput taps[API_MAX_TAPS];
+  int tapCount = 0;
+  int quality = RESAMPLER_BOX;
+  float budgetPercent = 25;
+  int failed = 0;
 
+  TRACE_INIT();
   tool = argv[0];
-  while ((ch = getopt(argc, argv, "c:sufbwlxr:v")) != -1)
+  while ((ch = getopt(argc, argv, "c:sufbwlxr:vkWq:i:o:g:d:D:Q:A:S:T:")) != -1)
     switch(ch) {
     case 'v':
       fprintf(stderr, "%s version %s\n", tool, VERSION);
@@ -98,6 +210,51 @@ int main(int argc, char *argv[]) {
     case 'r':
       sampleRate = atof(optarg);
       break;
+    case 'k':
+      storeFormat = STORE_S16;
+      break;
+    case 'g':
+      gainDb = atof(optarg);
+      break;
+    case 'd':
+      if (dspStageCount == DSP_MAX_STAGES) usage();
+      dspStages[dspStageCount++] = optarg;
+      break;
+    case 'D':
+      dspPath = optarg;
+      break;
+    case 'W':
+      writeWav = 1;
+      break;
+    case 'q':
+      gateDb = atof(optarg);
+      break;
+    case 'i':
+      indexPath = optarg;
+      break;
+    case 'o':
+      if (!strcmp(optarg, "drop")) overrunPolicy = OVERRUN_DROP_NEWEST;
+      else if (!strcmp(optarg, "overwrite")) overrunPolicy = OVERRUN_OVERWRITE_OLDEST;
+      else if (!strcmp(optarg, "spill")) overrunPolicy = OVERRUN_SPILL;
+      else usage();
+      break;
+    case 'Q':
+      quality = resampler_quality_named(optarg);
+      if (quality < 0) usage();
+      break;
+    case 'A':
+      budgetPercent = atof(optarg);
+      break;
+    case 'S':
+      ringName = optarg;
+      break;
+    case 'T':
+      if (tapCount == API_MAX_TAPS || strchr(optarg, ':') == NULL) usage();
+      taps[tapCount].rate = atof(optarg);
+      taps[tapCount].path = strchr(optarg, ':') + 1;
+      if (taps[tapCount].rate <= 0.0 || *taps[tapCount].path == '\0') usage();
+      tapCount++;
+      break;
     case '?':
     default:
       usage();
@@ -113,6 +270,24 @@ int main(int argc, char *argv[]) {
     usage();
   }
 
+  if (ringName != NULL && (writeWav || swapEndian || sampleFormat == UNSIGNED)) {
+    fprintf(stderr, "A ring (-S) takes native signed or float samples, without -W, -x or -u\n");
+    usage();
+  }
+
+  if (writeWav) {
+    /* WAV wants unsigned bytes, signed words and little endian */
+    if ((sampleFormat == UNSIGNED) != (bytesPerSample == 1)) {
+      fprintf(stderr, "WAV (-W) needs unsigned 8 bit, or signed 16/32 bit samples\n");
+      usage();
+    }
+    if (swapEndian) {
+      fprintf(stderr, "Can't use swap (-x) with WAV (-W)\n");
+      usage();
+    }
+    swapEndian = isBigEndian();
+  }
+
   switch (sampleFormat) {
   case SIGNED:
     if (bytesPerSample == 1) readSamplesFunction = (ReadSamplesFunction)api_read_s8_samples;
@@ -127,19 +302,158 @@ int main(int argc, char *argv[]) {
   case FLOAT:
     readSamplesFunction = (ReadSamplesFunction)api_read_float_samples;
   }
+  switch (sampleFormat) {
+  case SIGNED:
+    if (bytesPerSample == 1) readTapFunction = (ReadTapFunction)api_tap_read_s8_samples;
+    else if (bytesPerSample == 2) readTapFunction = (ReadTapFunction)api_tap_read_s16_samples;
+    else if (bytesPerSample == 4) readTapFunction = (ReadTapFunction)api_tap_read_s32_samples;
+    break;
+  case UNSIGNED:
+    if (bytesPerSample == 1) readTapFunction = (ReadTapFunction)api_tap_read_u8_samples;
+    else if (bytesPerSample == 2) readTapFunction = (ReadTapFunction)api_tap_read_u16_samples;
+    else if (bytesPerSample == 4) readTapFunction = (ReadTapFunction)api_tap_read_u32_samples;
+    break;
+  case FLOAT:
+    readTapFunction = (ReadTapFunction)api_tap_read_float_samples;
+  }
+  tapBytesPerSample = bytesPerSample;
+  tapSwapEndian = swapEndian;
 
   if ((channelCount < 1) || (channelCount > 2)) usage();
+  if (budgetPercent < 0 || budgetPercent > 100) usage();
+
+  ap = api_new_with_storage(sampleRate, channelCount == 1, MAX_FRAME_COUNT, storeFormat);
+  if (quality != RESAMPLER_BOX) api_set_resampler_quality(ap, quality, budgetPercent / 100);
+
+  for (i = 0; i < dspStageCount; i++) {
+    if (dsp_parse(api_dsp(ap), dspStages[i]) != 0) {
+      fprintf(stderr, "%s: bad processing stage \"%s\"\n", tool, dspStages[i]);
+      exit(1);
+    }
+  }
+  if (dspPath != NULL && dsp_load(api_dsp(ap), dspPath) != 0) {
+    fprintf(stderr, "%s: bad processing stages in %s\n", tool, dspPath);
+    exit(1);
+  }
+  if (gainDb != 0.0) dsp_add_gain(api_dsp(ap), gainDb);
 
-  ap = api_new(sampleRate, channelCount == 1, MAX_FRAME_COUNT);
+  if (gateDb < 0.0) api_set_silence_gate(ap, gateDb, GATE_HOLD_SECONDS);
+  api_set_overrun_policy(ap, overrunPolicy);
+  if (indexPath != NULL) {
+    indexFile = fopen(indexPath, "w");
+    if (indexFile == NULL) {
+      perror(indexPath);
+      exit(1);
+    }
+  }
 
-  while (1) {
-    unsigned frames = readSamplesFunction(ap, sampleBuffer, MAX_FRAME_COUNT);
+  if (ringName != NULL) {
+    shmringformat rf;
+    rf.rate = sampleRate;
+    rf.channelCount = channelCount;
+    rf.bytesPerSample = bytesPerSample;
+    rf.isFloat = (sampleFormat == FLOAT);
+    ring = shmring_create(ringName, RING_BYTES, &rf);
+    if (ring == NULL) {
+      perror(ringName);
+      exit(1);
+    }
+  } else {
+    bw = bw_new(1, BULK_BUFFER_SIZE, BULK_BUFFER_COUNT, BULK_THREAD_COUNT);
+  }
+  if (writeWav) {
+    wf.rate = sampleRate;
+    wf.channelCount = channelCount;
+    wf.bitsPerSample = bytesPerSample * 8;
+    wf.isFloat = (sampleFormat == FLOAT);
+    bw_set_header(bw, wavHeaderCallback, &wf, WAV_HEADER_SIZE, HEADER_PATCH_INTERVAL);
+  }
+  for (i = 0; i < tapCount; i++) {
+    tapoutput *to = &taps[i];
+    to->fd = open(to->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (to->fd < 0) {
+      perror(to->path);
+      exit(1);
+    }
+    to->tap = api_add_tap(ap, to->rate, channelCount == 1, MAX_FRAME_COUNT, storeFormat);
+    to->bw = bw_new(to->fd, BULK_BUFFER_SIZE, TAP_BUFFER_COUNT, TAP_THREAD_COUNT);
+    if (writeWav) {
+      to->wf = wf;
+      to->wf.rate = to->rate;
+      bw_set_header(to->bw, wavHeaderCallback, &to->wf, WAV_HEADER_SIZE, HEADER_PATCH_INTERVAL);
+    }
+    pthread_create(&to->thread, NULL, tap_thread, to);
+  }
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+
+  while (!stopRequested) {
+    unsigned frames;
+    void *samples = sampleBuffer;
+    unsigned maxFrames = MAX_FRAME_COUNT;
+    if (ring != NULL) {
+      /* capture straight into the ring; its reader may be behind */
+      unsigned space = shmring_reserve(ring, &samples) / bytesPerSample;
+      if (space == 0) continue;
+      if (space < maxFrames) maxFrames = space;
+    }
+    TRACE_BEGIN(read_capture);
+    frames = readSamplesFunction(ap, samples, maxFrames);
+    TRACE_END(read_capture);
     if (swapEndian) {
-      if (bytesPerSample == 2) swap_16_samples((short*)sampleBuffer, frames);
-      if (bytesPerSample == 4) swap_32_samples((long*)sampleBuffer, frames);
+      if (bytesPerSample == 2) swap_16_samples((short*)samples, frames);
+      if (bytesPerSample == 4) swap_32_samples((long*)samples, frames);
+    }
+    TRACE_BEGIN(submit_output);
+    if (ring != NULL) shmring_commit(ring, frames * bytesPerSample);
+    else bw_write(bw, samples, frames * bytesPerSample);
+    TRACE_END(submit_output);
+    {
+      samplerange ranges[16];
+      qualityswitch switches[16];
+      unsigned i, count;
+      if (indexFile != NULL) {
+        count = api_take_skipped_ranges(ap, ranges, 16);
+        for (i = 0; i < count; i++) {
+          fprintf(indexFile, "%llu %llu\n", ranges[i].position, ranges[i].length);
+        }
+      }
+      /* overruns are lost audio, not silence, so always say so */
+      count = api_take_overrun_ranges(ap, ranges, 16);
+      for (i = 0; i < count; i++) {
+        fprintf(stderr, "%s: overrun, lost %llu samples at %llu\n", tool, ranges[i].length, ranges[i].position);
+        if (indexFile != NULL) fprintf(indexFile, "%llu %llu overrun\n", ranges[i].position, ranges[i].length);
+      }
+      count = api_take_quality_switches(ap, switches, 16);
+      for (i = 0; i < count; i++) {
+        fprintf(stderr, "%s: resampling %s -> %s at %llu (load %.0f%%)\n", tool,
+                resampler_quality_name(switches[i].fromQuality), resampler_quality_name(switches[i].toQuality),
+                switches[i].position, switches[i].load * 100);
+      }
     }
-    write(1, sampleBuffer, frames * bytesPerSample);
   }
+  if (indexFile != NULL) fclose(indexFile);
 
-  while (1) sleep(5);
+  /* capture is still running, so no tap thread stays stuck in a read */
+  for (i = 0; i < tapCount; i++) {
+    pthread_join(taps[i].thread, NULL);
+    if (bw_free(taps[i].bw) != 0) {
+      fprintf(stderr, "%s: error writing %s\n", tool, taps[i].path);
+      failed = 1;
+    }
+    close(taps[i].fd);
+  }
+  api_free(ap);
+  if (ring != NULL) {
+    /* a reader already attached keeps its mapping */
+    shmring_close_writer(ring);
+    shmring_free(ring);
+    shmring_unlink(ringName);
+    exit(failed);
+  }
+  if (bw_free(bw) != 0) {
+    fprintf(stderr, "%s: error writing output\n", tool);
+    exit(1);
+  }
+  exit(failed);
 }
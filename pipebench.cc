@@ -0,0 +1,198 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+/*
+ * pipebench times the C read/write functions, called through a function
+ * pointer with a separate byte-swap pass the way speakerpipe and mikepipe
+ * call them, against the compile-time specialized AudioPipeOut and
+ * AudioPipeIn templates. A stand-in device drains the output queue and
+ * fills the input queue as fast as it can, so the figures are the cost of
+ * conversion and queueing alone. Each test's pipe, and with it the
+ * device's thread, is gone before the next one starts.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "audiopipe.hpp"
+extern "C" {
+#include "swap.h"
+#include "version.h"
+}
+
+#define DEVICE_FRAMES 512
+#define CLIENT_SAMPLES 4096
+
+struct audiodevice {
+  audiodeviceProc proc;
+  void *context;
+  pthread_t thread;
+  volatile int running;
+};
+
+static char *tool;
+
+static void usage() {
+  fprintf(stderr, "usage: %s [-v] [-n megasamples]\n", tool);
+  fprintf(stderr, " -v : show version and exit\n");
+  fprintf(stderr, " -n : samples to move per test, in millions, defaults to 20\n");
+  exit(1);
+}
+
+static void *device_thread(void *context)
+{
+  audiodevice *device = (audiodevice *)context;
+  float buffer[DEVICE_FRAMES * 2];
+  memset(buffer, 0, sizeof(buffer));
+  /* the pipes' callbacks never wait, so this sees a stop promptly */
+  while (device->running) device->proc(device->context, buffer, DEVICE_FRAMES * 2, 0.0);
+  return NULL;
+}
+
+audiodevice *audiodevice_new(int direction, audiodeviceProc proc, void *context)
+{
+  audiodevice *device = (audiodevice*)malloc(sizeof(audiodevice));
+  device->proc = proc;
+  device->context = context;
+  device->running = 0;
+  return device;
+}
+
+void audiodevice_start(audiodevice *device)
+{
+  device->running = 1;
+  pthread_create(&device->thread, NULL, device_thread, device);
+}
+
+void audiodevice_stop(audiodevice *device)
+{
+  if (!device->running) return;
+  device->running = 0;
+  pthread_join(device->thread, NULL);
+}
+
+void audiodevice_free(audiodevice *device)
+{
+  free(device);
+}
+
+double audiodevice_get_rate(audiodevice *device)
+{
+  return 44100.0;
+}
+
+double audiodevice_host_time(void)
+{
+  return 0.0;
+}
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef void (*WriteSamplesFunction)(audiopipeout *, void *samples, unsigned frameCount);
+typedef unsigned (*ReadSamplesFunction)(audiopipein *, void *samples, unsigned maxFrameCount);
+
+static void report(const char *name, double seconds, unsigned long samples)
+{
+  printf("%-44s %7.2f ns/sample\n", name, seconds * 1e9 / samples);
+}
+
+int main(int argc, char *argv[])
+{
+  int ch;
+  unsigned long total = 20000000;
+  static unsigned short source[CLIENT_SAMPLES];
+  static unsigned short scratch[CLIENT_SAMPLES];
+  unsigned long moved;
+  double start;
+  unsigned i;
+
+  tool = argv[0];
+  while ((ch = getopt(argc, argv, "vn:")) != -1)
+    switch(ch) {
+    case 'v':
+      fprintf(stderr, "%s version %s\n", tool, VERSION);
+      exit(-1);
+      break;
+    case 'n':
+      total = atof(optarg) * 1e6;
+      break;
+    case '?':
+    default:
+      usage();
+    }
+  if (total == 0) usage();
+
+  for (i = 0; i < CLIENT_SAMPLES; i++) source[i] = (i * 37) & 0xffff;
+
+  {
+    WriteSamplesFunction write = (WriteSamplesFunction)apo_write_u16_samples;
+    audiopipeout *ap = apo_new(44100, 0, 131072);
+    start = now();
+    for (moved = 0; moved < total; moved += CLIENT_SAMPLES) {
+      memcpy(scratch, source, sizeof(scratch));
+      swap_16_samples((short*)scratch, CLIENT_SAMPLES);
+      write(ap, scratch, CLIENT_SAMPLES);
+    }
+    report("write u16 swapped, C function pointer", now() - start, moved);
+    apo_free(ap);
+  }
+  {
+    audiopipe::AudioPipeOut<unsigned short, 2, audiopipe::SwappedEndian> pipe(44100);
+    start = now();
+    for (moved = 0; moved < total; moved += CLIENT_SAMPLES) {
+      pipe.write(source, CLIENT_SAMPLES);
+    }
+    report("write u16 swapped, AudioPipeOut template", now() - start, moved);
+  }
+  {
+    ReadSamplesFunction read = (ReadSamplesFunction)api_read_u16_samples;
+    audiopipein *ap = api_new(44100, 0, 131072);
+    start = now();
+    for (moved = 0; moved < total; ) {
+      unsigned n = read(ap, scratch, CLIENT_SAMPLES);
+      swap_16_samples((short*)scratch, n);
+      moved += n;
+    }
+    report("read u16 swapped, C function pointer", now() - start, moved);
+    api_free(ap);
+  }
+  {
+    audiopipe::AudioPipeIn<unsigned short, 2, audiopipe::SwappedEndian> pipe(44100, 131072);
+    start = now();
+    for (moved = 0; moved < total; ) {
+      moved += pipe.read(scratch, CLIENT_SAMPLES);
+    }
+    report("read u16 swapped, AudioPipeIn template", now() - start, moved);
+  }
+  exit(0);
+}
@@ -0,0 +1,419 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+/*
+ * pipelatency measures the round trip from an audiopipeout, through the
+ * audio device, back into an audiopipein. It plays a probe (a maximum
+ * length sequence, or a single impulse with -i) at regular intervals on
+ * both channels while reading the capture on another thread, then finds
+ * each probe in the capture by cross-correlation. For every trial it
+ * reports two latencies:
+ *   chain   from the write of the probe returning to the read that
+ *           returned it: what a speakerpipe | ... | mikepipe user sees
+ *   device  from the probe's presentation time to its capture time, by
+ *           the pipes' timestamps: the hardware's share of the chain
+ * followed by their spread over the trials. Connect output to input
+ * with a cable, or link it with loopbackdevice.c to run without any
+ * audio hardware.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <pthread.h>
+#include "audiopipeout.h"
+#include "audiopipein.h"
+#include "trace.h"
+#include "version.h"
+
+#define PROBE_LEVEL 0.25
+#define DETECT_THRESHOLD 0.2
+
+static char *tool;
+
+static void usage() {
+  fprintf(stderr, "usage: %s [-v] [-n trials] [-r rate] [-q outQueue] [-Q inQueue] [-b chunkFrames] [-s spacing] [-L maxLatency] [-m order] [-i] [-k]\n", tool);
+  fprintf(stderr, " -v : show version and exit\n");
+  fprintf(stderr, " -n : number of probes, defaults to 20\n");
+  fprintf(stderr, " -r : sample rate of both pipes, defaults to 44.1 kHz\n");
+  fprintf(stderr, " -q : output queue size in samples, defaults to speakerpipe's 131072\n");
+  fprintf(stderr, " -Q : input queue size in samples, defaults to mikepipe's 4096\n");
+  fprintf(stderr, " -b : frames per write and read, defaults to 1024\n");
+  fprintf(stderr, " -s : seconds between probes, defaults to 0.5\n");
+  fprintf(stderr, " -L : longest round trip to look for, in seconds, defaults to 5\n");
+  fprintf(stderr, " -m : maximum length sequence order (8 to 16), defaults to 12\n");
+  fprintf(stderr, " -i : probe with a single impulse instead\n");
+  fprintf(stderr, " -k : keep queued samples as 16 bit\n");
+  exit(1);
+}
+
+/* a read, and where the stream was when it returned */
+typedef struct {
+  unsigned long long startPosition;
+  unsigned long long endPosition;
+  double returnTime;
+  double captureTime;
+  int hasCaptureTime;
+} readrecord;
+
+typedef struct {
+  audiopipein *ap;
+  unsigned chunkFrames;
+  float *capture;
+  unsigned long captureFrames;
+  unsigned long captureCapacity;
+  readrecord *reads;
+  unsigned long readCount;
+  unsigned long readCapacity;
+  volatile int done;
+} capturestate;
+
+/* a probe as written */
+typedef struct {
+  unsigned long long writePosition;
+  double writeTime;
+  double presentationTime;
+  int hasPresentationTime;
+} proberecord;
+
+typedef struct {
+  double min, max, sum, sumSquares;
+  unsigned count;
+} stats;
+
+static void stats_add(stats *s, double value)
+{
+  if (s->count == 0 || value < s->min) s->min = value;
+  if (s->count == 0 || value > s->max) s->max = value;
+  s->sum += value;
+  s->sumSquares += value * value;
+  s->count++;
+}
+
+static void stats_print(const char *name, const stats *s)
+{
+  double mean, variance;
+  if (s->count == 0) {
+    printf("%-7s no measurements\n", name);
+    return;
+  }
+  mean = s->sum / s->count;
+  variance = s->sumSquares / s->count - mean * mean;
+  if (variance < 0) variance = 0;
+  printf("%-7s min %8.3f  mean %8.3f  max %8.3f ms   jitter: stddev %.3f  spread %.3f ms\n",
+         name, s->min * 1000, mean * 1000, s->max * 1000, sqrt(variance) * 1000, (s->max - s->min) * 1000);
+}
+
+/* Galois feedback masks giving a maximal sequence for each order */
+static const unsigned mlsMasks[] = {
+  0xB8, 0x110, 0x240, 0x500, 0xE08, 0x1C80, 0x3802, 0x6000, 0xD008
+};
+
+static unsigned make_mls(float *probe, int order)
+{
+  unsigned length = (1 << order) - 1;
+  unsigned mask = mlsMasks[order - 8];
+  unsigned state = 1;
+  unsigned i;
+  for (i = 0; i < length; i++) {
+    int bit = state & 1;
+    state >>= 1;
+    if (bit) state ^= mask;
+    probe[i] = bit ? PROBE_LEVEL : -PROBE_LEVEL;
+  }
+  return length;
+}
+
+static void *capture_thread(void *context)
+{
+  capturestate *cs = (capturestate *)context;
+  float *buffer = (float*)malloc(cs->chunkFrames * 2 * sizeof(float));
+
+  TRACE_THREAD_NAME("capture");
+  while (cs->captureFrames < cs->captureCapacity) {
+    readrecord *r;
+    unsigned long long start = api_read_position(cs->ap);
+    unsigned count = api_read_float_samples(cs->ap, buffer, cs->chunkFrames * 2);
+    double now = audiodevice_host_time();
+    unsigned i;
+
+    /* keep the left channel */
+    for (i = 0; i + 1 < count && cs->captureFrames < cs->captureCapacity; i += 2) {
+      cs->capture[cs->captureFrames++] = buffer[i];
+    }
+    if (cs->readCount == cs->readCapacity) {
+      cs->readCapacity *= 2;
+      cs->reads = (readrecord*)realloc(cs->reads, cs->readCapacity * sizeof(readrecord));
+    }
+    r = &cs->reads[cs->readCount++];
+    r->startPosition = start;
+    r->endPosition = start + count;
+    r->returnTime = now;
+    r->hasCaptureTime = (api_capture_time(cs->ap, start, &r->captureTime) == 0);
+  }
+  free(buffer);
+  cs->done = 1;
+  return NULL;
+}
+
+/* normalised so a clean copy of the probe scores 1 */
+static double correlate(const float *capture, const float *probe, unsigned probeLength, double probeEnergy)
+{
+  double sum = 0;
+  unsigned j;
+  for (j = 0; j < probeLength; j++) sum += probe[j] * capture[j];
+  return sum / probeEnergy;
+}
+
+/* Best lag in [from, to), to a fraction of a frame. Returns its score. */
+static double find_peak(const capturestate *cs, const float *probe, unsigned probeLength, double probeEnergy,
+                        long from, long to, int takeFirst, double *lag)
+{
+  long i, best = -1;
+  double bestScore = 0;
+
+  if (from < 1) from = 1;
+  if (to > (long)(cs->captureFrames - probeLength - 1)) to = cs->captureFrames - probeLength - 1;
+  for (i = from; i < to; i++) {
+    double score = correlate(cs->capture + i, probe, probeLength, probeEnergy);
+    if (score > bestScore) {
+      bestScore = score;
+      best = i;
+    } else if (takeFirst && bestScore > DETECT_THRESHOLD && i > best + (long)probeLength) {
+      /* past the first probe: don't wander on to the next */
+      break;
+    }
+  }
+  if (best < 0) return 0;
+  {
+    double a = correlate(cs->capture + best - 1, probe, probeLength, probeEnergy);
+    double c = correlate(cs->capture + best + 1, probe, probeLength, probeEnergy);
+    double curvature = a - 2 * bestScore + c;
+    *lag = best + ((curvature < 0) ? 0.5 * (a - c) / curvature : 0);
+  }
+  return bestScore;
+}
+
+/* the first read after a time, or after a capture frame */
+static const readrecord *read_returning_after(const capturestate *cs, double time)
+{
+  unsigned long i;
+  for (i = 0; i < cs->readCount; i++) {
+    if (cs->reads[i].returnTime > time) return &cs->reads[i];
+  }
+  return NULL;
+}
+
+static const readrecord *read_containing(const capturestate *cs, unsigned long frame)
+{
+  unsigned long i;
+  for (i = 0; i < cs->readCount; i++) {
+    if (cs->reads[i].endPosition > 2 * (unsigned long long)frame) return &cs->reads[i];
+  }
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  char ch;
+  int trialCount = 20;
+  float sampleRate = 44100;
+  int outQueueSize = 131072;
+  int inQueueSize = 4096;
+  unsigned chunkFrames = 1024;
+  float spacing = 0.5;
+  float maxLatency = 5.0;
+  int mlsOrder = 12;
+  int useImpulse = 0;
+  int storeFormat = STORE_FLOAT;
+  float *probe, *block;
+  unsigned probeLength;
+  double probeEnergy = 0;
+  unsigned long spacingFrames;
+  unsigned long framesWritten = 0;
+  proberecord *probes;
+  int probesWritten = 0;
+  capturestate cs;
+  pthread_t thread;
+  audiopipeout *out;
+  stats chain, device;
+  double firstLag = 0;
+  int i;
+
+  TRACE_INIT();
+  tool = argv[0];
+  while ((ch = getopt(argc, argv, "vn:r:q:Q:b:s:L:m:ik")) != -1)
+    switch(ch) {
+    case 'v':
+      fprintf(stderr, "%s version %s\n", tool, VERSION);
+      exit(-1);
+      break;
+    case 'n':
+      trialCount = atoi(optarg);
+      break;
+    case 'r':
+      sampleRate = atof(optarg);
+      break;
+    case 'q':
+      outQueueSize = atoi(optarg);
+      break;
+    case 'Q':
+      inQueueSize = atoi(optarg);
+      break;
+    case 'b':
+      chunkFrames = atoi(optarg);
+      break;
+    case 's':
+      spacing = atof(optarg);
+      break;
+    case 'L':
+      maxLatency = atof(optarg);
+      break;
+    case 'm':
+      mlsOrder = atoi(optarg);
+      break;
+    case 'i':
+      useImpulse = 1;
+      break;
+    case 'k':
+      storeFormat = STORE_S16;
+      break;
+    case '?':
+    default:
+      usage();
+    }
+  argc -= optind;
+  argv += optind;
+
+  if (argc > 0) usage();
+  if (trialCount < 1 || sampleRate <= 0 || outQueueSize < 2 || inQueueSize < 2 || chunkFrames < 1) usage();
+  if (mlsOrder < 8 || mlsOrder > 16) usage();
+
+  if (useImpulse) {
+    probe = (float*)malloc(sizeof(float));
+    probe[0] = 4 * PROBE_LEVEL;
+    probeLength = 1;
+  } else {
+    probe = (float*)malloc(((1 << mlsOrder) - 1) * sizeof(float));
+    probeLength = make_mls(probe, mlsOrder);
+  }
+  for (i = 0; i < (int)probeLength; i++) probeEnergy += probe[i] * probe[i];
+
+  spacingFrames = spacing * sampleRate;
+  if (spacingFrames < 2 * probeLength) {
+    fprintf(stderr, "%s: probes need to be at least %.3f seconds apart\n", tool, 2.0 * probeLength / sampleRate);
+    exit(1);
+  }
+
+  memset(&cs, 0, sizeof(cs));
+  cs.chunkFrames = chunkFrames;
+  /* room for every probe plus the longest round trip we look for */
+  cs.captureCapacity = (trialCount + 1) * spacingFrames + maxLatency * sampleRate;
+  cs.capture = (float*)malloc(cs.captureCapacity * sizeof(float));
+  cs.readCapacity = 1024;
+  cs.reads = (readrecord*)malloc(cs.readCapacity * sizeof(readrecord));
+  probes = (proberecord*)malloc(trialCount * sizeof(proberecord));
+  block = (float*)malloc(chunkFrames * 2 * sizeof(float));
+
+  out = apo_new_with_storage(sampleRate, 0, outQueueSize, storeFormat);
+  cs.ap = api_new_with_storage(sampleRate, 0, inQueueSize, storeFormat);
+  pthread_create(&thread, NULL, capture_thread, &cs);
+
+  /* probe k starts (k + 1) * spacingFrames in; writes are split so each
+     probe starts a write */
+  while (!cs.done) {
+    unsigned long frames = chunkFrames - framesWritten % chunkFrames;
+    unsigned long toBoundary = spacingFrames - framesWritten % spacingFrames;
+    int startsProbe = (framesWritten % spacingFrames == 0 && probesWritten < trialCount && framesWritten > 0);
+    unsigned long long writePosition = apo_write_position(out);
+    unsigned long f;
+
+    if (frames > toBoundary) frames = toBoundary;
+    for (f = 0; f < frames; f++) {
+      unsigned long frame = framesWritten + f;
+      long k = (long)(frame / spacingFrames) - 1;
+      unsigned long offset = frame % spacingFrames;
+      float value = (k >= 0 && k < trialCount && offset < probeLength) ? probe[offset] : 0;
+      block[2 * f] = value;
+      block[2 * f + 1] = value;
+    }
+    apo_write_float_samples(out, block, frames * 2);
+    if (startsProbe) {
+      proberecord *p = &probes[probesWritten++];
+      p->writePosition = writePosition;
+      p->writeTime = audiodevice_host_time();
+      p->hasPresentationTime = (apo_presentation_time(out, writePosition, &p->presentationTime) == 0);
+    }
+    framesWritten += frames;
+  }
+  pthread_join(thread, NULL);
+
+  printf("%d trials, %s probe of %u frames, queues %d out / %d in samples, %u frame chunks\n",
+         probesWritten, useImpulse ? "impulse" : "MLS", probeLength, outQueueSize, inQueueSize, chunkFrames);
+
+  memset(&chain, 0, sizeof(chain));
+  memset(&device, 0, sizeof(device));
+  for (i = 0; i < probesWritten; i++) {
+    proberecord *p = &probes[i];
+    const readrecord *r;
+    double lag = 0, score;
+    long from, to;
+
+    if (i == 0) {
+      /* nothing read before the probe was written can hold it */
+      r = read_returning_after(&cs, p->writeTime);
+      from = (r != NULL) ? r->startPosition / 2 : cs.captureFrames;
+      to = from + maxLatency * sampleRate;
+      score = find_peak(&cs, probe, probeLength, probeEnergy, from, to, 1, &lag);
+      if (score >= DETECT_THRESHOLD) firstLag = lag;
+    } else {
+      /* later probes keep their spacing unless the stream broke */
+      from = firstLag + i * spacingFrames - spacingFrames / 4;
+      to = firstLag + i * spacingFrames + spacingFrames / 4;
+      score = (firstLag > 0) ? find_peak(&cs, probe, probeLength, probeEnergy, from, to, 0, &lag) : 0;
+    }
+    if (score < DETECT_THRESHOLD) {
+      printf("trial %3d: not found (best score %.2f)\n", i + 1, score);
+      continue;
+    }
+    r = read_containing(&cs, (unsigned long)ceil(lag));
+    if (r == NULL) continue;
+    stats_add(&chain, r->returnTime - p->writeTime);
+    printf("trial %3d: chain %8.3f ms", i + 1, (r->returnTime - p->writeTime) * 1000);
+    if (p->hasPresentationTime && r->hasCaptureTime) {
+      double captureTime = r->captureTime + (lag - r->startPosition / 2.0) / sampleRate;
+      stats_add(&device, captureTime - p->presentationTime);
+      printf("  device %8.3f ms", (captureTime - p->presentationTime) * 1000);
+    }
+    printf("  score %.2f\n", score);
+  }
+  stats_print("chain", &chain);
+  stats_print("device", &device);
+  printf("output underruns: %lu (%llu samples concealed)\n", apo_underrun_count(out), rangelog_total_length(&out->underruns));
+
+  /* the capture thread may be blocked in a read, so leave the pipes alone */
+  exit(chain.count == probesWritten ? 0 : 1);
+}
@@ -0,0 +1,142 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#include "rangelog.h"
+#include <stdlib.h>
+#include <string.h>
+
+void init_rangelog(rangelog *rl, unsigned capacity)
+{
+  pthread_mutex_init(&rl->lock, NULL);
+  rl->ranges = (samplerange*)malloc(capacity * sizeof(samplerange));
+  rl->capacity = capacity;
+  rl->head = 0;
+  rl->count = 0;
+  rl->eventCount = 0;
+  rl->totalLength = 0;
+  rl->pendingCount = 0;
+  rl->pendingEvents = 0;
+  rl->pendingLength = 0;
+}
+
+void destroy_rangelog(rangelog *rl)
+{
+  pthread_mutex_destroy(&rl->lock);
+  free(rl->ranges);
+}
+
+/* Called with the lock held. */
+static void append_range(rangelog *rl, unsigned long long position, unsigned long long length)
+{
+  if (rl->count > 0) {
+    samplerange *last = &rl->ranges[(rl->head + rl->count - 1) % rl->capacity];
+    if (last->position == position) {
+      last->length += length;
+      return;
+    }
+  }
+  if (rl->count == rl->capacity) {
+    /* full: forget the oldest */
+    rl->head = (rl->head + 1) % rl->capacity;
+    rl->count--;
+  }
+  rl->ranges[(rl->head + rl->count) % rl->capacity].position = position;
+  rl->ranges[(rl->head + rl->count) % rl->capacity].length = length;
+  rl->count++;
+}
+
+void rangelog_add(rangelog *rl, unsigned long long position, unsigned long long length)
+{
+  pthread_mutex_lock(&rl->lock);
+  rl->eventCount++;
+  rl->totalLength += length;
+  append_range(rl, position, length);
+  pthread_mutex_unlock(&rl->lock);
+}
+
+void rangelog_add_nowait(rangelog *rl, unsigned long long position, unsigned long long length)
+{
+  rl->pendingEvents++;
+  rl->pendingLength += length;
+  if (rl->pendingCount > 0 && rl->pending[rl->pendingCount - 1].position == position) {
+    rl->pending[rl->pendingCount - 1].length += length;
+  } else {
+    if (rl->pendingCount == RANGELOG_PENDING) {
+      /* full: forget the oldest, as the log does */
+      memmove(rl->pending, rl->pending + 1, (RANGELOG_PENDING - 1) * sizeof(samplerange));
+      rl->pendingCount--;
+    }
+    rl->pending[rl->pendingCount].position = position;
+    rl->pending[rl->pendingCount].length = length;
+    rl->pendingCount++;
+  }
+  rangelog_publish(rl);
+}
+
+void rangelog_publish(rangelog *rl)
+{
+  unsigned i;
+
+  if (rl->pendingCount == 0) return;
+  if (pthread_mutex_trylock(&rl->lock) != 0) return;
+  for (i = 0; i < rl->pendingCount; i++) append_range(rl, rl->pending[i].position, rl->pending[i].length);
+  rl->eventCount += rl->pendingEvents;
+  rl->totalLength += rl->pendingLength;
+  pthread_mutex_unlock(&rl->lock);
+  rl->pendingCount = 0;
+  rl->pendingEvents = 0;
+  rl->pendingLength = 0;
+}
+
+unsigned rangelog_take(rangelog *rl, samplerange ranges[], unsigned maxCount)
+{
+  unsigned taken = 0;
+  pthread_mutex_lock(&rl->lock);
+  while (taken < maxCount && rl->count > 0) {
+    ranges[taken++] = rl->ranges[rl->head];
+    rl->head = (rl->head + 1) % rl->capacity;
+    rl->count--;
+  }
+  pthread_mutex_unlock(&rl->lock);
+  return taken;
+}
+
+unsigned long rangelog_event_count(rangelog *rl)
+{
+  unsigned long r;
+  pthread_mutex_lock(&rl->lock);
+  r = rl->eventCount;
+  pthread_mutex_unlock(&rl->lock);
+  return r;
+}
+
+unsigned long long rangelog_total_length(rangelog *rl)
+{
+  unsigned long long r;
+  pthread_mutex_lock(&rl->lock);
+  r = rl->totalLength;
+  pthread_mutex_unlock(&rl->lock);
+  return r;
+}
@@ -0,0 +1,74 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#ifndef __rangelog_h__
+#define __rangelog_h__
+
+#include <pthread.h>
+
+/* A rangelog is a small bounded FIFO of (position, length) sample ranges,
+   filled from the audio thread and drained by the reader. Positions are
+   in the stream the reader sees, so a range at the same position as the
+   previous one continues the same gap and is merged. When the log is
+   full the oldest range is dropped, but totalLength still counts it.
+   The audio thread adds with rangelog_add_nowait, which never waits for
+   a reader: if the log is busy the range is held in pending, owned by
+   the adding thread, and goes in at the next add or rangelog_publish
+   that finds the log free. That thread calls rangelog_publish once a
+   block, so a held range isn't left waiting for the next one. */
+
+#define RANGELOG_PENDING 8
+
+typedef struct {
+  unsigned long long position;
+  unsigned long long length;
+} samplerange;
+
+typedef struct
+{
+  pthread_mutex_t lock;
+  samplerange *ranges;
+  unsigned capacity;
+  unsigned head;
+  unsigned count;
+  unsigned long eventCount;
+  unsigned long long totalLength;
+  samplerange pending[RANGELOG_PENDING];
+  unsigned pendingCount;
+  unsigned long pendingEvents;
+  unsigned long long pendingLength;
+} rangelog;
+
+void init_rangelog(rangelog *rl, unsigned capacity);
+void rangelog_add(rangelog *rl, unsigned long long position, unsigned long long length);
+/* Only one thread at a time may call these on a log. */
+void rangelog_add_nowait(rangelog *rl, unsigned long long position, unsigned long long length);
+void rangelog_publish(rangelog *rl);
+unsigned rangelog_take(rangelog *rl, samplerange ranges[], unsigned maxCount);
+unsigned long rangelog_event_count(rangelog *rl);
+unsigned long long rangelog_total_length(rangelog *rl);
+void destroy_rangelog(rangelog *rl);
+
+#endif /* __rangelog_h__ */
@@ -24,26 +24,148 @@
  */
 
 #include "resampler.h"
+#include "trace.h"
 #include <assert.h>
+#include <math.h>
 #include <stdlib.h>
+#include <string.h>
+
+/* kernel table entries per input frame; between them it interpolates */
+#define KERNEL_STEPS 64
+/* input frames the history holds besides the filter's window */
+#define HISTORY_FRAMES 1024
+/* a sinc's reach is capped; past it, fewer zero crossings fit */
+#define MAX_HALF_WIDTH 192
+/* passband edge, as a share of the lower Nyquist frequency */
+#define ROLLOFF 0.9
+
+static const unsigned zeroCrossings[RESAMPLER_QUALITY_COUNT] = { 0, 0, 4, 16 };
+static const double kaiserBeta[RESAMPLER_QUALITY_COUNT] = { 0.0, 0.0, 5.0, 8.0 };
+
+static const char *qualityNames[RESAMPLER_QUALITY_COUNT] = { "box", "linear", "short sinc", "sinc" };
+
+const char *resampler_quality_name(int quality)
+{
+    if (quality < 0 || quality >= RESAMPLER_QUALITY_COUNT) return "?";
+    return qualityNames[quality];
+}
+
+int resampler_quality_named(const char *name)
+{
+    int quality;
+    if (!strcmp(name, "short")) return RESAMPLER_SHORT_SINC;
+    for (quality = 0; quality < RESAMPLER_QUALITY_COUNT; quality++)
+    {
+        if (!strcmp(name, qualityNames[quality])) return quality;
+    }
+    return -1;
+}
+
+static double bessel_i0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    int k;
+    for (k = 1; k < 30; k++)
+    {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+/* The windowed sinc, tabulated from distance 0 to halfWidth input frames
+   and zero just past it. */
+static float *build_kernel(unsigned halfWidth, double cutoff, double beta)
+{
+    unsigned size = halfWidth * KERNEL_STEPS + 2;
+    float *kernel = (float*)malloc(size * sizeof(float));
+    unsigned i;
+    for (i = 0; i < size; i++)
+    {
+        double d = (double)i / KERNEL_STEPS;
+        double r = d / halfWidth;
+        double x = M_PI * cutoff * d;
+        double sinc = (i == 0) ? 1.0 : sin(x) / x;
+        kernel[i] = (r < 1.0) ? cutoff * sinc * bessel_i0(beta * sqrt(1.0 - r * r)) / bessel_i0(beta) : 0.0;
+    }
+    return kernel;
+}
 
 resampler *resampler_new(float inputRate, float outputRate, outputCallback callback)
+{
+    return resampler_new_with_quality(inputRate, outputRate, callback, 1, RESAMPLER_BOX);
+}
+
+/* A window of silence behind the first input, so the first output falls
+   on it; with overlapping edges, a window more ahead of it. */
+static void restart(resampler *rs)
+{
+    unsigned lead = rs->overlapsEdges ? rs->window : 0;
+
+    memset(rs->history, 0, (rs->window + lead) * rs->channelCount * sizeof(float));
+    rs->historyUsed = rs->window + lead;
+    rs->position = rs->window;
+    rs->fadeRemaining = 0;
+}
+
+resampler *resampler_new_with_quality(float inputRate, float outputRate, outputCallback callback, unsigned channelCount, int maxQuality)
 {
     resampler *rs = (resampler *)malloc(sizeof(resampler));
+    double widen;
+    int q;
+
+    assert(channelCount >= 1 && channelCount <= RESAMPLER_MAX_CHANNELS);
     rs->inputRate = inputRate;
     rs->outputRate = outputRate;
+    rs->step = (double)inputRate / outputRate;
+    rs->channelCount = channelCount;
     rs->context = NULL;
     rs->callback = callback;
-    rs->currentSampleCountRemaining = inputRate;
-    rs->currentSampleCumulative = 0.0;
     rs->outBufferSize = 2048;
     rs->outBufferUsed = 0;
     rs->outBuffer = (float*)malloc(rs->outBufferSize * sizeof(float));
+    if (maxQuality < RESAMPLER_BOX) maxQuality = RESAMPLER_BOX;
+    if (maxQuality >= RESAMPLER_QUALITY_COUNT) maxQuality = RESAMPLER_QUALITY_COUNT - 1;
+    rs->maxQuality = maxQuality;
+    rs->quality = maxQuality;
+    rs->fadeFrom = maxQuality;
+    rs->fadeRemaining = 0;
+
+    /* downsampling, the filter stretches to cut at the output's Nyquist */
+    widen = (rs->step > 1.0) ? rs->step : 1.0;
+    rs->window = 0;
+    for (q = 0; q < RESAMPLER_QUALITY_COUNT; q++)
+    {
+        unsigned halfWidth = 0;
+        rs->kernels[q] = NULL;
+        if (q <= maxQuality)
+        {
+            if (q == RESAMPLER_BOX) halfWidth = (unsigned)ceil(rs->step / 2) + 1;
+            else if (q == RESAMPLER_LINEAR) halfWidth = 1;
+            else
+            {
+                halfWidth = (unsigned)ceil(zeroCrossings[q] * widen);
+                if (halfWidth > MAX_HALF_WIDTH) halfWidth = MAX_HALF_WIDTH;
+                rs->kernels[q] = build_kernel(halfWidth, ROLLOFF / widen, kaiserBeta[q]);
+            }
+        }
+        rs->halfWidths[q] = halfWidth;
+        if (halfWidth > rs->window) rs->window = halfWidth;
+    }
+
+    /* room for a drain's silence on top of what's kept */
+    rs->historyCapacity = 3 * rs->window + HISTORY_FRAMES;
+    rs->history = (float*)calloc(rs->historyCapacity * channelCount, sizeof(float));
+    rs->overlapsEdges = 0;
+    restart(rs);
     return rs;
 }
 
 void resampler_free(resampler *rs)
 {
+    int q;
+    for (q = 0; q < RESAMPLER_QUALITY_COUNT; q++) free(rs->kernels[q]);
+    free(rs->history);
     free(rs->outBuffer);
     free(rs);
 }
@@ -53,60 +175,197 @@ void resampler_set_context(resampler *rs, void *context)
     rs->context = context;
 }
 
-void resampler_scale_data(resampler *rs, float *inputData, unsigned inputDataCount)
+void resampler_set_quality(resampler *rs, int quality)
 {
-    unsigned outputDataCount = rs->outBufferUsed;
-    float currentSampleCountRemaining = rs->currentSampleCountRemaining;
-    float outputRate = rs->outputRate;
-    float currentSampleCumulative = rs->currentSampleCumulative;
-    float *outBuffer = rs->outBuffer;
+    if (quality < RESAMPLER_BOX) quality = RESAMPLER_BOX;
+    if (quality > rs->maxQuality) quality = rs->maxQuality;
+    if (quality == rs->quality) return;
+    rs->fadeFrom = rs->quality;
+    rs->quality = quality;
+    rs->fadeRemaining = RESAMPLER_CROSSFADE_FRAMES;
+}
+
+int resampler_get_quality(resampler *rs)
+{
+    return rs->quality;
+}
+
+/* Input sample i covers [i, i+1) shifted half a frame back, so each
+   output averages the step's worth of input centred on it. */
+static void box_frame(resampler *rs, long centre, double frac, float *frame)
+{
+    unsigned channelCount = rs->channelCount;
+    double a = centre + frac - rs->step / 2 + 0.5;
+    double b = a + rs->step;
+    long first = (long)a, last = (long)b;
+    float firstWeight = (first + 1 - a) / rs->step;
+    float lastWeight = (b - last) / rs->step;
+    const float *x = rs->history + first * channelCount;
+    unsigned c;
+    long j;
+
+    if (first == last)
+    {
+        for (c = 0; c < channelCount; c++) frame[c] = x[c];
+        return;
+    }
+    for (c = 0; c < channelCount; c++)
+    {
+        float sum = x[c] * firstWeight;
+        for (j = 1; j < last - first; j++) sum += x[j * channelCount + c] / rs->step;
+        frame[c] = sum + x[(last - first) * channelCount + c] * lastWeight;
+    }
+}
+
+static void linear_frame(resampler *rs, long centre, double frac, float *frame)
+{
+    unsigned channelCount = rs->channelCount;
+    const float *x = rs->history + centre * channelCount;
+    unsigned c;
+    for (c = 0; c < channelCount; c++)
+    {
+        frame[c] = x[c] + frac * (x[c + channelCount] - x[c]);
+    }
+}
+
+static void sinc_frame(resampler *rs, int quality, long centre, double frac, float *frame)
+{
+    unsigned channelCount = rs->channelCount;
+    unsigned halfWidth = rs->halfWidths[quality];
+    const float *kernel = rs->kernels[quality];
+    float weights[2 * MAX_HALF_WIDTH];
+    unsigned taps = 2 * halfWidth;
+    const float *x = rs->history + (centre - halfWidth + 1) * channelCount;
+    unsigned i, c;
+
+    /* the weights are shared by every channel */
+    for (i = 0; i < taps; i++)
+    {
+        double d = fabs((double)i - (halfWidth - 1) - frac) * KERNEL_STEPS;
+        unsigned index = (unsigned)d;
+        float f = d - index;
+        weights[i] = kernel[index] + f * (kernel[index + 1] - kernel[index]);
+    }
+    if (channelCount == 2)
+    {
+        float left = 0.0, right = 0.0;
+        for (i = 0; i < taps; i++)
+        {
+            left += weights[i] * x[2 * i];
+            right += weights[i] * x[2 * i + 1];
+        }
+        frame[0] = left;
+        frame[1] = right;
+        return;
+    }
+    for (c = 0; c < channelCount; c++)
+    {
+        float sum = 0.0;
+        for (i = 0; i < taps; i++) sum += weights[i] * x[i * channelCount + c];
+        frame[c] = sum;
+    }
+}
+
+static void compute_frame(resampler *rs, int quality, long centre, double frac, float *frame)
+{
+    switch (quality)
+    {
+    case RESAMPLER_BOX:
+        box_frame(rs, centre, frac, frame);
+        break;
+    case RESAMPLER_LINEAR:
+        linear_frame(rs, centre, frac, frame);
+        break;
+    default:
+        sinc_frame(rs, quality, centre, frac, frame);
+    }
+}
+
+/* Everything the window reaches is in: produce outputs, then keep only
+   what the next one needs. */
+static void produce(resampler *rs, double end)
+{
+    unsigned channelCount = rs->channelCount;
     unsigned outBufferSize = rs->outBufferSize;
-    float inputRate = rs->inputRate;
-    void *context = rs->context;
-    outputCallback callback = rs->callback;
+    unsigned outputDataCount = rs->outBufferUsed;
+    float frame[RESAMPLER_MAX_CHANNELS], fadeFrame[RESAMPLER_MAX_CHANNELS];
+    unsigned c, keepFrom;
 
-    while (inputDataCount > 0)
+    while ((long)floor(rs->position) + (long)rs->window < (long)rs->historyUsed && rs->position < end)
     {
-        // iterate over input sample
-        float inputAvailableNumerator = outputRate;
-        float currentSample = *inputData;
-        // figure out how much of input to use
-        while (currentSampleCountRemaining <= inputAvailableNumerator)
+        long centre = (long)floor(rs->position);
+        double frac = rs->position - centre;
+        compute_frame(rs, rs->quality, centre, frac, frame);
+        if (rs->fadeRemaining > 0)
         {
-            // finish off current sample
-            currentSampleCumulative += currentSample * currentSampleCountRemaining;
-            inputAvailableNumerator -= currentSampleCountRemaining;
-            if (outputDataCount >= outBufferSize)
-            {
-                if (callback == NULL)
-                {
-                    // double buffer size
-                    outBufferSize += outBufferSize;
-                    outBuffer = rs->outBuffer = (float*)realloc(outBuffer, outBufferSize * sizeof(float));
-                    rs->outBufferSize = outBufferSize;
-                }
-                else
-                {
-                    callback(context, outBuffer, outputDataCount);
-                    outputDataCount = 0;
-                }
-            }
-            outBuffer[outputDataCount++] = currentSampleCumulative / inputRate;
-            currentSampleCumulative = 0.0;
-            currentSampleCountRemaining = rs->inputRate;
+            float g = (float)rs->fadeRemaining / RESAMPLER_CROSSFADE_FRAMES;
+            compute_frame(rs, rs->fadeFrom, centre, frac, fadeFrame);
+            for (c = 0; c < channelCount; c++) frame[c] += g * (fadeFrame[c] - frame[c]);
+            rs->fadeRemaining--;
         }
-        if (inputAvailableNumerator > 0.0)
+        if (outputDataCount + channelCount > outBufferSize && rs->callback != NULL)
         {
-            currentSampleCountRemaining -= inputAvailableNumerator;
-            currentSampleCumulative += currentSample * inputAvailableNumerator;
-            inputAvailableNumerator = 0.0;
+            rs->callback(rs->context, rs->outBuffer, outputDataCount);
+            outputDataCount = 0;
         }
-        inputDataCount--;
-        inputData++;
+        // with nowhere to send it, output past the buffer is dropped
+        if (outputDataCount + channelCount <= outBufferSize)
+        {
+            for (c = 0; c < channelCount; c++) rs->outBuffer[outputDataCount++] = frame[c];
+        }
+        rs->position += rs->step;
     }
-    rs->currentSampleCountRemaining = currentSampleCountRemaining;
-    rs->currentSampleCumulative = currentSampleCumulative;
     rs->outBufferUsed = outputDataCount;
+
+    keepFrom = (unsigned)floor(rs->position) + 1 - rs->window;
+    if (keepFrom > 0 && keepFrom <= rs->historyUsed)
+    {
+        memmove(rs->history, rs->history + keepFrom * channelCount, (rs->historyUsed - keepFrom) * channelCount * sizeof(float));
+        rs->historyUsed -= keepFrom;
+        rs->position -= keepFrom;
+    }
+}
+
+void resampler_scale_data(resampler *rs, float *inputData, unsigned inputDataCount)
+{
+    unsigned channelCount = rs->channelCount;
+    unsigned frameCount = inputDataCount / channelCount;
+
+    assert(inputDataCount % channelCount == 0);
+    TRACE_BEGIN(resample);
+    while (frameCount > 0)
+    {
+        unsigned room = rs->historyCapacity - rs->historyUsed;
+        unsigned toCopy = (frameCount < room) ? frameCount : room;
+        memcpy(rs->history + rs->historyUsed * channelCount, inputData, toCopy * channelCount * sizeof(float));
+        rs->historyUsed += toCopy;
+        inputData += toCopy * channelCount;
+        frameCount -= toCopy;
+        produce(rs, rs->historyUsed);
+    }
+    TRACE_END(resample);
+}
+
+void resampler_drain(resampler *rs)
+{
+    unsigned channelCount = rs->channelCount;
+    unsigned past = rs->overlapsEdges ? rs->window : 0;
+    double end = rs->historyUsed + past;
+
+    /* enough silence to reach past the last input, which was kept below
+       a window behind, and past the outputs it still reaches */
+    memset(rs->history + rs->historyUsed * channelCount, 0, (rs->window + past) * channelCount * sizeof(float));
+    rs->historyUsed += rs->window + past;
+    produce(rs, end);
+    /* and start again as if new */
+    restart(rs);
+    if (rs->callback != NULL) resampler_flush(rs);
+}
+
+void resampler_set_overlapping_edges(resampler *rs, int isOverlapping)
+{
+    rs->overlapsEdges = isOverlapping;
+    restart(rs);
 }
 
 void resampler_flush(resampler *rs)
@@ -123,6 +382,11 @@ void resampler_set_buffer_size(resampler *rs, unsigned newSize)
     rs->outBufferSize = newSize;
 }
 
+float resampler_next_output_offset(resampler *rs)
+{
+    return (rs->position - rs->historyUsed) * rs->channelCount;
+}
+
 unsigned resampler_get_available_data(resampler *rs, float **bufferReference)
 {
     *bufferReference = rs->outBuffer;
@@ -28,27 +28,94 @@
 
 typedef void (*outputCallback)(void *context, const float *resampledData, unsigned resampledDataCount);
 
+/* Quality tiers, cheapest first. Every tier computes each output frame
+   at the same position from the same recent input, so switching between
+   them never moves the output in time. RESAMPLER_BOX averages the input
+   under each output, RESAMPLER_LINEAR interpolates between neighbours,
+   and the sinc tiers are Kaiser-windowed sinc filters with 4 and 16 zero
+   crossings a side, widened when downsampling so they also stop
+   aliasing. */
+enum { RESAMPLER_BOX, RESAMPLER_LINEAR, RESAMPLER_SHORT_SINC, RESAMPLER_SINC, RESAMPLER_QUALITY_COUNT };
+
+#define RESAMPLER_MAX_CHANNELS 8
+
+/* a change of quality is crossfaded over this many output frames */
+#define RESAMPLER_CROSSFADE_FRAMES 256
+
 typedef struct
 {
     float inputRate;
     float outputRate;
-    float currentSampleCountRemaining;
-    float currentSampleCumulative;
+    double step;
+    unsigned channelCount;
     void *context;
     outputCallback callback;
     unsigned outBufferSize;
     unsigned outBufferUsed;
     float *outBuffer;
+    /* recent input, interleaved, and where in it the next output falls */
+    float *history;
+    unsigned historyCapacity;
+    unsigned historyUsed;
+    double position;
+    /* frames either side of an output each tier reads, and the widest */
+    unsigned halfWidths[RESAMPLER_QUALITY_COUNT];
+    unsigned window;
+    float *kernels[RESAMPLER_QUALITY_COUNT];
+    int maxQuality;
+    int quality;
+    int fadeFrom;
+    unsigned fadeRemaining;
+    int overlapsEdges;
 } resampler;
 
+/* A box filter over a single channel, as channel-blind as the stereo
+   and mono hacks need. */
 resampler *resampler_new(float inputRate, float outputRate, outputCallback callback);
+
+/* Resample channelCount interleaved channels separately, at maxQuality
+   or any tier below it. The tables for each tier are built here, so
+   changing tier later doesn't allocate. */
+resampler *resampler_new_with_quality(float inputRate, float outputRate, outputCallback callback, unsigned channelCount, int maxQuality);
+
 void resampler_free(resampler *rs);
 void resampler_set_context(resampler *rs, void *context);
+/* Output goes to the callback a buffer at a time. With no callback it
+   collects for resampler_get_available_data, and anything past the
+   buffer is dropped, so size it for the largest block first. Input comes
+   in whole frames. */
 void resampler_scale_data(resampler *rs, float *inputData, unsigned inputDataCount);
 void resampler_flush(resampler *rs);
+
+/* Resample what the filter is still holding back for want of later
+   input, as if silence followed, and flush it. The next input starts
+   afresh. */
+void resampler_drain(resampler *rs);
+
+/* Give every run of input, from the start or a drain to the next drain,
+   the whole of the filter's response: a window of output ahead of its
+   first sample, and a drain that goes on a window past its last. Runs
+   whose edges are then added together come out as one continuous run
+   would. Set it before the first input. */
+void resampler_set_overlapping_edges(resampler *rs, int isOverlapping);
+
+/* Crossfade to another tier, no higher than the one it was made with. */
+void resampler_set_quality(resampler *rs, int quality);
+int resampler_get_quality(resampler *rs);
+
+/* Reallocates the buffer: call it while setting up, not while streaming. */
 void resampler_set_buffer_size(resampler *rs, unsigned newSize);
 
+/* How far past the start of the next input block the centre of the next
+   output sample falls, in input samples; negative while the filter is
+   still waiting for input past it. Used to line up timestamps. */
+float resampler_next_output_offset(resampler *rs);
+
 unsigned resampler_get_available_data(resampler *rs, float **bufferReference);
 void resampler_clear_available_data(resampler *rs);
 
+const char *resampler_quality_name(int quality);
+/* The tier called name ("short" will do for short sinc), or -1. */
+int resampler_quality_named(const char *name);
+
 #endif /* __resampler_h__ */
@@ -0,0 +1,339 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+/*
+ * rsscore runs every resampler quality tier over generated test signals
+ * at a list of rate pairs, and prints one table of how good and how
+ * fast each is:
+ *
+ *   SNR     a multitone spread over the passband, against the tones
+ *           fitted back out of the output
+ *   THD+N   everything but a 997 Hz tone, relative to the tone
+ *   alias   rejection of a tone between the two Nyquist frequencies when
+ *           downsampling, which would alias back into the output band;
+ *           when upsampling, of the images of a tone near the top of the
+ *           passband
+ *   flat    the spread of gains across a stepped sine sweep from 20 Hz
+ *           to the passband edge, 80% of the lower Nyquist frequency
+ *           (the sinc tiers are half down at 90%)
+ *   delay   how late the 997 Hz tone comes out, from its phase, in
+ *           microseconds; every tier should say 0
+ *   ns      time per output sample, one channel
+ *
+ * Fits are least squares at the known frequencies, over the output past
+ * the filters' start-up.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include "resampler.h"
+#include "version.h"
+
+#define SIGNAL_SECONDS 0.5
+#define BLOCK_FRAMES 1024
+/* output ignored at each end, past anything a filter reaches */
+#define SETTLE_FRAMES 512
+#define MULTITONES 8
+#define SWEEP_STEPS 16
+#define PASSBAND 0.8
+#define MAX_TERMS (2 * MULTITONES + 1)
+
+static const float standardRates[] = { 8000, 11025, 16000, 22050, 32000, 44100, 48000, 96000 };
+#define STANDARD_RATE_COUNT (sizeof(standardRates) / sizeof(standardRates[0]))
+
+/* the pairs run without -a or -r: the usual conversions either way */
+static const float defaultPairs[][2] = {
+  { 44100, 48000 }, { 48000, 44100 }, { 22050, 44100 }, { 44100, 22050 },
+  { 16000, 48000 }, { 48000, 16000 }, { 8000, 44100 }, { 96000, 44100 }
+};
+#define DEFAULT_PAIR_COUNT (sizeof(defaultPairs) / sizeof(defaultPairs[0]))
+
+static char *tool;
+
+/* where the resampler's output collects */
+static float *output;
+static unsigned long outputCount;
+static unsigned long outputCapacity;
+
+static void usage() {
+  fprintf(stderr, "usage: %s [-v] [-a] [-r inRate:outRate]... [-q quality]\n", tool);
+  fprintf(stderr, " -v : show version and exit\n");
+  fprintf(stderr, " -a : every pair of the standard rates, 8 to 96 kHz\n");
+  fprintf(stderr, " -r : this pair of rates; repeat for more\n");
+  fprintf(stderr, " -q : only box, linear, short or sinc\n");
+  exit(1);
+}
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void collect(void *context, const float *samples, unsigned count)
+{
+  if (outputCount + count > outputCapacity) count = outputCapacity - outputCount;
+  memcpy(output + outputCount, samples, count * sizeof(float));
+  outputCount += count;
+}
+
+/* Resample input (one channel) into output; returns the seconds it took. */
+static double run(float inRate, float outRate, int quality, float *input, unsigned long frameCount)
+{
+  resampler *rs = resampler_new_with_quality(inRate, outRate, collect, 1, quality);
+  unsigned long done;
+  double start;
+
+  resampler_set_buffer_size(rs, BLOCK_FRAMES * 4);
+  outputCount = 0;
+  outputCapacity = (unsigned long)(frameCount * (double)outRate / inRate) + 2 * BLOCK_FRAMES;
+  output = (float *)realloc(output, outputCapacity * sizeof(float));
+  start = now();
+  for (done = 0; done < frameCount; done += BLOCK_FRAMES) {
+    unsigned count = (frameCount - done < BLOCK_FRAMES) ? frameCount - done : BLOCK_FRAMES;
+    resampler_scale_data(rs, input + done, count);
+  }
+  resampler_flush(rs);
+  start = now() - start;
+  resampler_drain(rs);
+  resampler_free(rs);
+  return start;
+}
+
+/* Least squares fit of a cosine and sine at each frequency (cycles per
+   output sample) plus a constant, over output[from, to). Returns the
+   power of the fit and of the residual, and each tone's gain and phase
+   if asked. */
+static void fit_tones(const double *frequencies, unsigned toneCount, unsigned long from, unsigned long to,
+                      double *fitPower, double *residualPower, double *amplitudes, double *phases)
+{
+  unsigned terms = 2 * toneCount + 1;
+  double m[MAX_TERMS][MAX_TERMS + 1];
+  double basis[MAX_TERMS], coefficients[MAX_TERMS];
+  double fitSum = 0, residualSum = 0;
+  unsigned long k;
+  unsigned i, j, r;
+
+  memset(m, 0, sizeof(m));
+  for (k = from; k < to; k++) {
+    for (i = 0; i < toneCount; i++) {
+      basis[2 * i] = cos(2 * M_PI * frequencies[i] * k);
+      basis[2 * i + 1] = sin(2 * M_PI * frequencies[i] * k);
+    }
+    basis[terms - 1] = 1.0;
+    for (i = 0; i < terms; i++) {
+      for (j = 0; j < terms; j++) m[i][j] += basis[i] * basis[j];
+      m[i][terms] += basis[i] * output[k];
+    }
+  }
+  /* Gauss-Jordan with partial pivoting; the system is small */
+  for (i = 0; i < terms; i++) {
+    unsigned pivot = i;
+    for (r = i + 1; r < terms; r++) if (fabs(m[r][i]) > fabs(m[pivot][i])) pivot = r;
+    for (j = 0; j <= terms; j++) {
+      double t = m[i][j];
+      m[i][j] = m[pivot][j];
+      m[pivot][j] = t;
+    }
+    for (r = 0; r < terms; r++) {
+      double factor;
+      if (r == i || m[i][i] == 0.0) continue;
+      factor = m[r][i] / m[i][i];
+      for (j = i; j <= terms; j++) m[r][j] -= factor * m[i][j];
+    }
+  }
+  for (i = 0; i < terms; i++) coefficients[i] = (m[i][i] != 0.0) ? m[i][terms] / m[i][i] : 0.0;
+
+  for (k = from; k < to; k++) {
+    double fit = 0;
+    for (i = 0; i < toneCount; i++) {
+      fit += coefficients[2 * i] * cos(2 * M_PI * frequencies[i] * k) + coefficients[2 * i + 1] * sin(2 * M_PI * frequencies[i] * k);
+    }
+    fitSum += fit * fit;
+    residualSum += (output[k] - fit - coefficients[terms - 1]) * (output[k] - fit - coefficients[terms - 1]);
+  }
+  *fitPower = fitSum / (to - from);
+  *residualPower = residualSum / (to - from);
+  for (i = 0; i < toneCount; i++) {
+    if (amplitudes != NULL) amplitudes[i] = hypot(coefficients[2 * i], coefficients[2 * i + 1]);
+    if (phases != NULL) phases[i] = atan2(-coefficients[2 * i + 1], coefficients[2 * i]);
+  }
+}
+
+static void make_tones(float *input, unsigned long frameCount, float rate, const double *hz, unsigned toneCount, double amplitude)
+{
+  unsigned long n;
+  unsigned i;
+  for (n = 0; n < frameCount; n++) {
+    double sum = 0;
+    for (i = 0; i < toneCount; i++) sum += cos(2 * M_PI * hz[i] * n / rate);
+    input[n] = amplitude * sum;
+  }
+}
+
+static double decibels(double ratio)
+{
+  return (ratio > 0) ? 10 * log10(ratio) : -999.0;
+}
+
+/* One row of the table. */
+static void score(float inRate, float outRate, int quality)
+{
+  unsigned long frameCount = (unsigned long)(inRate * SIGNAL_SECONDS);
+  float *input = (float *)malloc(frameCount * sizeof(float));
+  double edge = PASSBAND * ((inRate < outRate) ? inRate : outRate) / 2;
+  double hz[SWEEP_STEPS], frequencies[SWEEP_STEPS];
+  double fitPower, residualPower, seconds;
+  double snr, thdn, alias, flatness, delay, nanoseconds, phase;
+  double lowest = 1e9, highest = 0, sum = 0;
+  unsigned long from, to, k;
+  unsigned i;
+
+  /* SNR: tones spread over the passband, 0.1 apart */
+  for (i = 0; i < MULTITONES; i++) {
+    hz[i] = edge * (i + 0.7) / MULTITONES;
+    frequencies[i] = hz[i] / outRate;
+  }
+  make_tones(input, frameCount, inRate, hz, MULTITONES, 0.9 / MULTITONES);
+  seconds = run(inRate, outRate, quality, input, frameCount);
+  nanoseconds = seconds * 1e9 / outputCount;
+  from = SETTLE_FRAMES;
+  to = outputCount - SETTLE_FRAMES;
+  fit_tones(frequencies, MULTITONES, from, to, &fitPower, &residualPower, NULL, NULL);
+  snr = decibels(fitPower / residualPower);
+
+  /* THD+N: one tone, as audio analysers use */
+  hz[0] = 997;
+  frequencies[0] = hz[0] / outRate;
+  make_tones(input, frameCount, inRate, hz, 1, 0.5);
+  run(inRate, outRate, quality, input, frameCount);
+  fit_tones(frequencies, 1, from, to, &fitPower, &residualPower, NULL, &phase);
+  thdn = decibels(residualPower / fitPower);
+  delay = -phase / (2 * M_PI * hz[0]) * 1e6;
+
+  if (outRate < inRate) {
+    /* between the Nyquist frequencies, where nothing should come out,
+       off any simple ratio so no filter nulls it by luck */
+    hz[0] = outRate / 2 + (inRate - outRate) / 2 * 0.37;
+    make_tones(input, frameCount, inRate, hz, 1, 0.5);
+    run(inRate, outRate, quality, input, frameCount);
+    for (k = from; k < to; k++) sum += output[k] * output[k];
+    alias = -decibels(sum / (to - from) / (0.5 * 0.5 / 2));
+  } else {
+    /* at the passband edge, where images sit closest */
+    hz[0] = edge;
+    frequencies[0] = hz[0] / outRate;
+    make_tones(input, frameCount, inRate, hz, 1, 0.5);
+    run(inRate, outRate, quality, input, frameCount);
+    fit_tones(frequencies, 1, from, to, &fitPower, &residualPower, NULL, NULL);
+    alias = -decibels(residualPower / fitPower);
+  }
+
+  /* flatness: a stepped sweep, a tone at a time */
+  for (i = 0; i < SWEEP_STEPS; i++) {
+    double amplitude;
+    hz[0] = 20 * pow(edge / 20, (double)i / (SWEEP_STEPS - 1));
+    frequencies[0] = hz[0] / outRate;
+    make_tones(input, frameCount, inRate, hz, 1, 0.5);
+    run(inRate, outRate, quality, input, frameCount);
+    fit_tones(frequencies, 1, from, to, &fitPower, &residualPower, &amplitude, NULL);
+    amplitude /= 0.5;
+    if (amplitude < lowest) lowest = amplitude;
+    if (amplitude > highest) highest = amplitude;
+  }
+  flatness = 20 * log10(highest / lowest);
+
+  printf("%6.0f %6.0f  %-10s %7.1f %7.1f %7.1f %7.3f %8.1f %7.1f\n", inRate, outRate, resampler_quality_name(quality),
+         snr, thdn, alias, flatness, delay, nanoseconds);
+  free(input);
+}
+
+int main(int argc, char *argv[])
+{
+  int ch;
+  float pairs[STANDARD_RATE_COUNT * STANDARD_RATE_COUNT][2];
+  unsigned pairCount = 0;
+  int allPairs = 0;
+  int onlyQuality = -1;
+  unsigned i, j;
+
+  tool = argv[0];
+  while ((ch = getopt(argc, argv, "var:q:")) != -1)
+    switch(ch) {
+    case 'v':
+      fprintf(stderr, "%s version %s\n", tool, VERSION);
+      exit(-1);
+      break;
+    case 'a':
+      allPairs = 1;
+      break;
+    case 'r':
+      if (pairCount == sizeof(pairs) / sizeof(pairs[0]) || strchr(optarg, ':') == NULL) usage();
+      pairs[pairCount][0] = atof(optarg);
+      pairs[pairCount][1] = atof(strchr(optarg, ':') + 1);
+      if (pairs[pairCount][0] < 1000 || pairs[pairCount][1] < 1000 || pairs[pairCount][0] == pairs[pairCount][1]) usage();
+      pairCount++;
+      break;
+    case 'q':
+      onlyQuality = resampler_quality_named(optarg);
+      if (onlyQuality < 0) usage();
+      break;
+    case '?':
+    default:
+      usage();
+    }
+  if (allPairs) {
+    pairCount = 0;
+    for (i = 0; i < STANDARD_RATE_COUNT; i++) {
+      for (j = 0; j < STANDARD_RATE_COUNT; j++) {
+        if (i == j) continue;
+        pairs[pairCount][0] = standardRates[i];
+        pairs[pairCount][1] = standardRates[j];
+        pairCount++;
+      }
+    }
+  } else if (pairCount == 0) {
+    for (i = 0; i < DEFAULT_PAIR_COUNT; i++) {
+      pairs[i][0] = defaultPairs[i][0];
+      pairs[i][1] = defaultPairs[i][1];
+    }
+    pairCount = DEFAULT_PAIR_COUNT;
+  }
+
+  printf("    in    out  quality     SNR dB THD+N dB alias dB flat dB delay us  ns/out\n");
+  for (i = 0; i < pairCount; i++) {
+    int quality;
+    for (quality = 0; quality < RESAMPLER_QUALITY_COUNT; quality++) {
+      if (onlyQuality < 0 || quality == onlyQuality) score(pairs[i][0], pairs[i][1], quality);
+    }
+  }
+  free(output);
+  return 0;
+}
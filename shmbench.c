@@ -0,0 +1,198 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+/*
+ * shmbench moves the same samples from a child process to its parent
+ * twice: down a pipe, written and fread 4096 samples at a time the way
+ * a synthesizer feeds speakerpipe over stdin, and through a shmring,
+ * generated straight into the ring and read in place. The reader sums what it gets
+ * in both cases, so each byte is really looked at.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "shmring.h"
+#include "version.h"
+
+#define CHUNK_SAMPLES 4096
+
+static char *tool;
+
+static void usage() {
+  fprintf(stderr, "usage: %s [-v] [-m megabytes] [-s ringBytes] [-n name]\n", tool);
+  fprintf(stderr, " -v : show version and exit\n");
+  fprintf(stderr, " -m : how much to move each way, defaults to 512 MB\n");
+  fprintf(stderr, " -s : ring size, defaults to 1 MB\n");
+  fprintf(stderr, " -n : ring name, defaults to /shmbench\n");
+  exit(1);
+}
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fill_samples(short *samples, unsigned long long offset, unsigned count)
+{
+  unsigned i;
+  for (i = 0; i < count; i++) samples[i] = (short)(offset + i);
+}
+
+static long sum_samples(const short *samples, unsigned count)
+{
+  long sum = 0;
+  unsigned i;
+  for (i = 0; i < count; i++) sum += samples[i];
+  return sum;
+}
+
+static double report(const char *name, double seconds, unsigned long long bytes, long sum)
+{
+  printf("%-8s %8.1f MB/s  (%.3f s, checksum %ld)\n", name, bytes / seconds / 1e6, seconds, sum);
+  return bytes / seconds;
+}
+
+static double run_pipe(unsigned long long bytes)
+{
+  short chunk[CHUNK_SAMPLES];
+  unsigned long long moved = 0;
+  long sum = 0;
+  double start;
+  int fds[2];
+  FILE *in;
+  size_t got;
+
+  if (pipe(fds) != 0) {
+    perror("pipe");
+    exit(1);
+  }
+  start = now();
+  if (fork() == 0) {
+    close(fds[0]);
+    while (moved < bytes) {
+      fill_samples(chunk, moved / sizeof(short), CHUNK_SAMPLES);
+      if (write(fds[1], chunk, sizeof(chunk)) != sizeof(chunk)) _exit(1);
+      moved += sizeof(chunk);
+    }
+    _exit(0);
+  }
+  close(fds[1]);
+  in = fdopen(fds[0], "r");
+  while ((got = fread(chunk, sizeof(short), CHUNK_SAMPLES, in)) > 0) {
+    sum += sum_samples(chunk, got);
+    moved += got * sizeof(short);
+  }
+  fclose(in);
+  wait(NULL);
+  return report("pipe", now() - start, moved, sum);
+}
+
+static double run_ring(unsigned long long bytes, const char *name, unsigned ringBytes)
+{
+  shmringformat format;
+  unsigned long long moved = 0;
+  long sum = 0;
+  double start;
+  shmring *r;
+
+  format.rate = 44100;
+  format.channelCount = 2;
+  format.bytesPerSample = sizeof(short);
+  format.isFloat = 0;
+  r = shmring_create(name, ringBytes, &format);
+  if (r == NULL) {
+    perror(name);
+    exit(1);
+  }
+  start = now();
+  if (fork() == 0) {
+    /* attach by name, as an unrelated producer would */
+    shmring *w = shmring_open(name);
+    if (w == NULL) _exit(1);
+    while (moved < bytes) {
+      void *space;
+      unsigned length = shmring_reserve(w, &space);
+      if (length > bytes - moved) length = bytes - moved;
+      fill_samples((short *)space, moved / sizeof(short), length / sizeof(short));
+      shmring_commit(w, length);
+      moved += length;
+    }
+    shmring_close_writer(w);
+    _exit(0);
+  }
+  while (!shmring_finished(r)) {
+    void *samples;
+    unsigned got = shmring_peek(r, &samples);
+    sum += sum_samples((const short *)samples, got / sizeof(short));
+    shmring_consume(r, got);
+    moved += got;
+  }
+  wait(NULL);
+  shmring_free(r);
+  shmring_unlink(name);
+  return report("shmring", now() - start, moved, sum);
+}
+
+int main(int argc, char *argv[])
+{
+  int ch;
+  unsigned long long bytes = 512ULL << 20;
+  unsigned ringBytes = 1 << 20;
+  char *name = "/shmbench";
+  double pipeRate, ringRate;
+
+  tool = argv[0];
+  while ((ch = getopt(argc, argv, "vm:s:n:")) != -1)
+    switch(ch) {
+    case 'v':
+      fprintf(stderr, "%s version %s\n", tool, VERSION);
+      exit(-1);
+      break;
+    case 'm':
+      bytes = (unsigned long long)atoi(optarg) << 20;
+      break;
+    case 's':
+      ringBytes = atoi(optarg);
+      break;
+    case 'n':
+      name = optarg;
+      break;
+    case '?':
+    default:
+      usage();
+    }
+  if (bytes == 0 || ringBytes == 0) usage();
+
+  pipeRate = run_pipe(bytes);
+  ringRate = run_ring(bytes, name, ringBytes);
+  printf("shmring is %.1f times the pipe's throughput\n", ringRate / pipeRate);
+  return 0;
+}
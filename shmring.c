@@ -0,0 +1,251 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#include "shmring.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#define SHMRING_MAGIC 0x676e6972
+/* the samples start a page in, after the header */
+#define HEADER_SPACE 4096
+#define MAX_CAPACITY (1U << 30)
+
+static void wait_for_change(volatile int *sequence, int seen)
+{
+#ifdef __linux__
+  struct timespec timeout;
+  timeout.tv_sec = 0;
+  timeout.tv_nsec = SHMRING_WAIT_MS * 1000000L;
+  /* not FUTEX_PRIVATE: the other side is another process */
+  syscall(SYS_futex, sequence, FUTEX_WAIT, seen, &timeout, NULL, 0);
+#else
+  struct timespec ts;
+  unsigned waited;
+  ts.tv_sec = 0;
+  ts.tv_nsec = 1000000;
+  for (waited = 0; waited < SHMRING_WAIT_MS && *sequence == seen; waited++) nanosleep(&ts, NULL);
+#endif
+}
+
+static void wake(volatile int *sequence, volatile int *waiting)
+{
+  /* a full barrier, so the count moved before is seen before waiting is read */
+  __sync_fetch_and_add(sequence, 1);
+#ifdef __linux__
+  if (*waiting) syscall(SYS_futex, sequence, FUTEX_WAKE, 1, NULL, NULL, 0);
+#else
+  (void)waiting;
+#endif
+}
+
+static shmring *map_ring(int fd, unsigned mappedSize)
+{
+  shmring *r;
+  void *base = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) return NULL;
+  r = (shmring *)malloc(sizeof(shmring));
+  r->header = (shmringheader *)base;
+  r->buffer = (char *)base + HEADER_SPACE;
+  r->mappedSize = mappedSize;
+  return r;
+}
+
+shmring *shmring_create(const char *name, unsigned capacity, const shmringformat *format)
+{
+  unsigned size = 64;
+  shmring *r;
+  int fd;
+
+  if (capacity > MAX_CAPACITY) {
+    errno = EINVAL;
+    return NULL;
+  }
+  /* a power of two, so the free-running counts wrap cleanly */
+  while (size < capacity) size *= 2;
+  shm_unlink(name);
+  fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) return NULL;
+  if (ftruncate(fd, HEADER_SPACE + size) != 0) {
+    int saved = errno;
+    close(fd);
+    shm_unlink(name);
+    errno = saved;
+    return NULL;
+  }
+  r = map_ring(fd, HEADER_SPACE + size);
+  if (r == NULL) return NULL;
+  memset(r->header, 0, sizeof(shmringheader));
+  r->header->maxDataSize = size;
+  r->header->format = *format;
+  /* publish the header before the magic that says it's ready */
+  __sync_synchronize();
+  r->header->magic = SHMRING_MAGIC;
+  return r;
+}
+
+shmring *shmring_open(const char *name)
+{
+  struct stat st;
+  shmring *r;
+  int fd = shm_open(name, O_RDWR, 0);
+
+  if (fd < 0) return NULL;
+  if (fstat(fd, &st) != 0 || st.st_size < HEADER_SPACE) {
+    close(fd);
+    errno = EINVAL;
+    return NULL;
+  }
+  r = map_ring(fd, st.st_size);
+  if (r == NULL) return NULL;
+  __sync_synchronize();
+  if (r->header->magic != SHMRING_MAGIC || HEADER_SPACE + r->header->maxDataSize > r->mappedSize) {
+    shmring_free(r);
+    errno = EINVAL;
+    return NULL;
+  }
+  return r;
+}
+
+int shmring_unlink(const char *name)
+{
+  return shm_unlink(name);
+}
+
+void shmring_free(shmring *r)
+{
+  munmap(r->header, r->mappedSize);
+  free(r);
+}
+
+const shmringformat *shmring_format(shmring *r)
+{
+  return &r->header->format;
+}
+
+unsigned shmring_reserve(shmring *r, void **bytes)
+{
+  shmringheader *h = r->header;
+  unsigned space = h->maxDataSize - (h->headCount - h->tailCount);
+  unsigned offset, spaceAtEnd;
+
+  if (space == 0) {
+    int seen = h->removeSequence;
+    h->writerWaiting = 1;
+    __sync_synchronize();
+    if (h->headCount - h->tailCount == h->maxDataSize) wait_for_change(&h->removeSequence, seen);
+    h->writerWaiting = 0;
+    space = h->maxDataSize - (h->headCount - h->tailCount);
+  }
+  /* don't touch the space before seeing it freed */
+  __sync_synchronize();
+  offset = h->headCount & (h->maxDataSize - 1);
+  spaceAtEnd = h->maxDataSize - offset;
+  if (space > spaceAtEnd) space = spaceAtEnd;
+  *bytes = r->buffer + offset;
+  return space;
+}
+
+void shmring_commit(shmring *r, unsigned length)
+{
+  shmringheader *h = r->header;
+  /* the samples land before the count that makes them visible */
+  __sync_synchronize();
+  h->headCount += length;
+  wake(&h->addSequence, &h->readerWaiting);
+}
+
+void shmring_write(shmring *r, const void *bytes, unsigned length)
+{
+  const char *mem = (const char *)bytes;
+
+  while (length > 0) {
+    void *space;
+    unsigned toCopy = shmring_reserve(r, &space);
+    if (toCopy > length) toCopy = length;
+    memcpy(space, mem, toCopy);
+    shmring_commit(r, toCopy);
+    mem += toCopy;
+    length -= toCopy;
+  }
+}
+
+void shmring_close_writer(shmring *r)
+{
+  __sync_synchronize();
+  r->header->writerClosed = 1;
+  wake(&r->header->addSequence, &r->header->readerWaiting);
+}
+
+unsigned shmring_peek(shmring *r, void **bytes)
+{
+  shmringheader *h = r->header;
+  unsigned queued = h->headCount - h->tailCount;
+  unsigned offset, queuedAtEnd;
+
+  if (queued == 0 && !h->writerClosed) {
+    int seen = h->addSequence;
+    h->readerWaiting = 1;
+    __sync_synchronize();
+    if (h->headCount == h->tailCount && !h->writerClosed) wait_for_change(&h->addSequence, seen);
+    h->readerWaiting = 0;
+    queued = h->headCount - h->tailCount;
+  }
+  /* don't read the samples before seeing the count */
+  __sync_synchronize();
+  offset = h->tailCount & (h->maxDataSize - 1);
+  queuedAtEnd = h->maxDataSize - offset;
+  if (queued > queuedAtEnd) queued = queuedAtEnd;
+  *bytes = r->buffer + offset;
+  return queued;
+}
+
+void shmring_consume(shmring *r, unsigned length)
+{
+  shmringheader *h = r->header;
+  /* finish with the samples before handing their space back */
+  __sync_synchronize();
+  h->tailCount += length;
+  wake(&h->removeSequence, &h->writerWaiting);
+}
+
+int shmring_finished(shmring *r)
+{
+  shmringheader *h = r->header;
+  int closed = h->writerClosed;
+  /* everything written before the close is visible once the close is */
+  __sync_synchronize();
+  return closed && h->headCount == h->tailCount;
+}
@@ -0,0 +1,106 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#ifndef __shmring_h__
+#define __shmring_h__
+
+/* A byte ring in named POSIX shared memory, for one writing and one
+   reading process. The layout follows threadedqueue, but the counts are
+   free-running and each side only moves its own, so nothing is locked;
+   a side that has to wait sleeps on a futex on Linux and polls
+   elsewhere. Either side can hand out a pointer straight into the ring,
+   so samples needn't be copied on the way through. */
+
+/* waits give up after this long so callers can check for a stop */
+#define SHMRING_WAIT_MS 100
+
+/* What the writer puts in the ring: native-endian signed integer or float
+   samples, interleaved. */
+typedef struct {
+  float rate;
+  unsigned channelCount;
+  unsigned bytesPerSample;
+  int isFloat;
+} shmringformat;
+
+typedef struct {
+  unsigned magic;
+  unsigned maxDataSize;
+  shmringformat format;
+  volatile int writerClosed;
+  /* each bumped after its side moves, to wake a sleeping other side */
+  volatile int addSequence;
+  volatile int removeSequence;
+  volatile int readerWaiting;
+  volatile int writerWaiting;
+  /* bytes ever added and removed; their difference is what's queued */
+  volatile unsigned headCount __attribute__((aligned(64)));
+  volatile unsigned tailCount __attribute__((aligned(64)));
+} shmringheader;
+
+typedef struct {
+  shmringheader *header;
+  char *buffer;
+  unsigned mappedSize;
+} shmring;
+
+/* Create (or replace) the ring called name, "/something", with at least
+   capacity bytes, rounded up to a power of two. Returns NULL and sets
+   errno on failure. */
+shmring *shmring_create(const char *name, unsigned capacity, const shmringformat *format);
+
+/* Attach to a ring another process created. */
+shmring *shmring_open(const char *name);
+
+/* Remove the name; processes attached keep their mapping. */
+int shmring_unlink(const char *name);
+
+/* Detach. */
+void shmring_free(shmring *r);
+
+const shmringformat *shmring_format(shmring *r);
+
+/* Writer: point at contiguous free space, waiting up to SHMRING_WAIT_MS
+   for some, and return how many bytes there are (maybe 0). Fill some of
+   it and commit that many. */
+unsigned shmring_reserve(shmring *r, void **bytes);
+void shmring_commit(shmring *r, unsigned length);
+
+/* Writer: copy length bytes in, waiting for room as needed. */
+void shmring_write(shmring *r, const void *bytes, unsigned length);
+
+/* Writer: no more data is coming. */
+void shmring_close_writer(shmring *r);
+
+/* Reader: point at contiguous queued bytes, waiting up to
+   SHMRING_WAIT_MS for some, and return how many (maybe 0). Consume some
+   once done with them. */
+unsigned shmring_peek(shmring *r, void **bytes);
+void shmring_consume(shmring *r, unsigned length);
+
+/* Reader: true once the writer has closed and everything is consumed. */
+int shmring_finished(shmring *r);
+
+#endif /* __shmring_h__ */
@@ -25,15 +25,80 @@
 
 #include <CoreAudio/AudioHardware.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 #include "audiopipeout.h"
+#include "shmring.h"
+#include "clipcache.h"
+#include "wavfile.h"
+#include "trace.h"
 #include "swap.h"
 #include "version.h"
 
+/* how much of the next item to read ahead while the current one plays */
+#define PREFETCH_BYTES (1024*1024)
+#define FEED_SAMPLES 4096
+/* the queue grows from the smaller to the larger as the writer gets
+   ahead, and shrinks back when it doesn't */
+#define QUEUE_MIN_SAMPLES 8192
+#define QUEUE_MAX_SAMPLES 131072
+#define DEFAULT_CACHE_MEGABYTES 256
+
+enum { SIGNED, UNSIGNED, FLOAT };
+
+typedef struct {
+  int sampleFormat;
+  int bytesPerSample;
+  int swapEndian;
+  int channelCount;
+  float rate;
+} streamformat;
+
+typedef void (*WriteSamplesFunction)(audiopipeout *, void *samples, unsigned frameCount);
+
+/* One file (or stdin) to play, opened and read ahead by the prefetch
+   thread. Samples in prefetched are already in host byte order. */
+typedef struct {
+  char *name;
+  FILE *file;
+  streamformat format;
+  unsigned long long bytesLeft;
+  char *prefetched;
+  unsigned prefetchedBytes;
+  /* with a cache, whether the read ahead holds all of it, and its hash */
+  int isWhole;
+  clipkey key;
+} playitem;
+
 static char *tool;
 
+/* where item names come from: the command line, then the playlist fd */
+static char **fileNames;
+static int fileCount;
+static int nextFile = 0;
+static FILE *playlist = NULL;
+static streamformat defaultFormat;
+
+/* the prefetch thread's hand-off slot; a NULL item ends playback */
+static pthread_mutex_t slotLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t slotChanged = PTHREAD_COND_INITIALIZER;
+static playitem *slot;
+static int slotFull = 0;
+
+/* with -K, clips are cached under their hash and settingsKey's */
+static clipcache *cache = NULL;
+static clipkey settingsKey;
+
+/* a clip's output on its way into the queue */
+typedef struct {
+  float *samples;
+  unsigned long count;
+  unsigned long capacity;
+} cliprecording;
+
 static void usage() {
-  fprintf(stderr, "usage: %s [-v] [-c channelCount (1 or 2)] [-s|-u|-f] [-b|-w|-l] [-x] [-r rate]\n", tool);
+  fprintf(stderr, "usage: %s [-v] [-c channelCount (1 or 2)] [-s|-u|-f] [-b|-w|-l] [-x] [-r rate] [-k] [-g dB] [-d stage]... [-D dspFile] [-p playlistFd] [-z silence|fade|repeat] [-t factor] [-Q quality] [-A percent] [-K cacheDir] [-M megabytes] [-S ringName | file ...]\n", tool);
   fprintf(stderr, " -v : show version and exit\n");
   fprintf(stderr, " -s : signed samples\n");
   fprintf(stderr, " -u : unsigned\n");
@@ -43,22 +108,330 @@ static void usage() {
   fprintf(stderr, " -l : 4 bytes per sample\n");
   fprintf(stderr, " -x : use opposite endian\n");
   fprintf(stderr, " -r : sample rate, defaults to 44.1 kHz\n");
+  fprintf(stderr, " -k : keep queued samples as 16 bit (halves buffer memory)\n");
+  fprintf(stderr, " -g : apply gain in dB\n");
+  fprintf(stderr, " -d : add a processing stage, e.g. \"dcblock\" or \"highpass 80\"\n");
+  fprintf(stderr, " -D : add the processing stages listed in dspFile\n");
+  fprintf(stderr, " -p : after any files, play the files named one per line on playlistFd\n");
+  fprintf(stderr, " -z : when input falls behind, play silence, fade out (default), or\n");
+  fprintf(stderr, "      repeat the last few milliseconds dying away\n");
+  fprintf(stderr, " -t : play factor times faster (0.25 to 4) at the same pitch\n");
+  fprintf(stderr, " -Q : resample with box (default), linear, short or sinc\n");
+  fprintf(stderr, " -A : step the resampling down when it takes more than percent of real\n");
+  fprintf(stderr, "      time (default 25), and back up when it can; 0 never steps\n");
+  fprintf(stderr, " -K : keep each whole file's output in cacheDir, and play it from there\n");
+  fprintf(stderr, "      when the same file comes round again with the same settings\n");
+  fprintf(stderr, " -M : hold at most megabytes in the cache (default %d)\n", DEFAULT_CACHE_MEGABYTES);
+  fprintf(stderr, " -S : play from the shared-memory ring a producer created, in its format\n");
+  fprintf(stderr, " WAV files play in their own format; other files, and stdin (\"-\" or\n");
+  fprintf(stderr, " no files), in the format given by the options\n");
   exit(1);
 }
 
+/* underruns are audible, so always say so */
+static void report_underruns(audiopipeout *ap)
+{
+  samplerange ranges[16];
+  unsigned count, i;
+
+  while ((count = apo_take_underrun_ranges(ap, ranges, 16)) > 0) {
+    for (i = 0; i < count; i++) {
+      fprintf(stderr, "%s: underrun, concealed %llu samples at %llu\n", tool, ranges[i].length, ranges[i].position);
+    }
+  }
+}
+
+static void report_quality_switches(audiopipeout *ap)
+{
+  qualityswitch switches[16];
+  unsigned count, i;
+
+  while ((count = apo_take_quality_switches(ap, switches, 16)) > 0) {
+    for (i = 0; i < count; i++) {
+      fprintf(stderr, "%s: resampling %s -> %s at %llu (load %.0f%%)\n", tool,
+              resampler_quality_name(switches[i].fromQuality), resampler_quality_name(switches[i].toQuality),
+              switches[i].position, switches[i].load * 100);
+    }
+  }
+}
+
+static int isBigEndian() {
+  union { short s; char c[2]; } u;
+  u.s = 1;
+  return u.c[0] == 0;
+}
+
+static char *next_name() {
+  char line[4096];
+
+  if (nextFile < fileCount) return strdup(fileNames[nextFile++]);
+  if (playlist == NULL) return NULL;
+  while (fgets(line, sizeof(line), playlist) != NULL) {
+    line[strcspn(line, "\r\n")] = 0;
+    if (line[0] != 0) return strdup(line);
+  }
+  return NULL;
+}
+
+static void free_item(playitem *item) {
+  if (item->file != NULL && item->file != stdin) fclose(item->file);
+  free(item->prefetched);
+  free(item->name);
+  free(item);
+}
+
+/* read whole samples, swapped to host order */
+static unsigned read_item(playitem *item, char *buffer, unsigned maxBytes) {
+  unsigned bytesPerSample = item->format.bytesPerSample;
+  unsigned count;
+
+  if (maxBytes > item->bytesLeft) maxBytes = item->bytesLeft;
+  TRACE_BEGIN(read_input);
+  count = fread(buffer, bytesPerSample, maxBytes / bytesPerSample, item->file);
+  TRACE_END(read_input);
+  item->bytesLeft -= count * bytesPerSample;
+  if (item->format.swapEndian) {
+    if (bytesPerSample == 2) swap_16_samples((short*)buffer, count);
+    if (bytesPerSample == 4) swap_32_samples((long*)buffer, count);
+  }
+  return count * bytesPerSample;
+}
+
+static playitem *open_item(char *name) {
+  playitem *item = (playitem*)calloc(1, sizeof(playitem));
+  wavformat wf;
+
+  item->name = name;
+  item->format = defaultFormat;
+  item->bytesLeft = WAV_UNKNOWN_LENGTH;
+  if (!strcmp(name, "-")) {
+    /* stdin is always raw, as it always was */
+    item->file = stdin;
+  } else if ((item->file = fopen(name, "rb")) == NULL) {
+    perror(name);
+    free_item(item);
+    return NULL;
+  } else if (wav_read_header(item->file, &wf, &item->bytesLeft) == 0) {
+    item->format.sampleFormat = wf.isFloat ? FLOAT : ((wf.bitsPerSample == 8) ? UNSIGNED : SIGNED);
+    item->format.bytesPerSample = wf.bitsPerSample / 8;
+    item->format.channelCount = wf.channelCount;
+    item->format.rate = wf.rate;
+    item->format.swapEndian = isBigEndian();
+    if ((wf.bitsPerSample != 8 && wf.bitsPerSample != 16 && wf.bitsPerSample != 32) ||
+        (wf.isFloat && wf.bitsPerSample != 32) || wf.channelCount < 1 || wf.channelCount > 2) {
+      fprintf(stderr, "%s: %s: unsupported WAV format\n", tool, name);
+      free_item(item);
+      return NULL;
+    }
+  } else {
+    rewind(item->file);
+  }
+  /* a live stdin shouldn't have to fill the read ahead before it plays */
+  if (item->file != stdin) {
+    item->prefetched = (char*)malloc(PREFETCH_BYTES);
+    item->prefetchedBytes = read_item(item, item->prefetched, PREFETCH_BYTES);
+    /* a short read was the end of the file */
+    item->isWhole = (item->bytesLeft == 0 || item->prefetchedBytes < PREFETCH_BYTES) && !ferror(item->file);
+  }
+  if (cache != NULL && item->isWhole) {
+    clipkey_init(&item->key);
+    clipkey_add(&item->key, &item->format.sampleFormat, sizeof(item->format.sampleFormat));
+    clipkey_add(&item->key, &item->format.bytesPerSample, sizeof(item->format.bytesPerSample));
+    clipkey_add(&item->key, &item->format.channelCount, sizeof(item->format.channelCount));
+    clipkey_add(&item->key, &item->format.rate, sizeof(item->format.rate));
+    clipkey_add(&item->key, item->prefetched, item->prefetchedBytes);
+  }
+  return item;
+}
+
+static void *prefetch_thread(void *context) {
+  TRACE_THREAD_NAME("prefetch");
+  while (1) {
+    char *name = next_name();
+    playitem *item = NULL;
+
+    if (name != NULL) {
+      item = open_item(name);
+      if (item == NULL) continue;
+    }
+    pthread_mutex_lock(&slotLock);
+    while (slotFull) pthread_cond_wait(&slotChanged, &slotLock);
+    slot = item;
+    slotFull = 1;
+    pthread_cond_broadcast(&slotChanged);
+    pthread_mutex_unlock(&slotLock);
+    if (item == NULL) break;
+  }
+  return NULL;
+}
+
+static playitem *take_item() {
+  playitem *item;
+  pthread_mutex_lock(&slotLock);
+  while (!slotFull) pthread_cond_wait(&slotChanged, &slotLock);
+  item = slot;
+  slotFull = 0;
+  pthread_cond_broadcast(&slotChanged);
+  pthread_mutex_unlock(&slotLock);
+  return item;
+}
+
+static WriteSamplesFunction write_function(const streamformat *format) {
+  switch (format->sampleFormat) {
+  case SIGNED:
+    if (format->bytesPerSample == 1) return (WriteSamplesFunction)apo_write_s8_samples;
+    if (format->bytesPerSample == 2) return (WriteSamplesFunction)apo_write_s16_samples;
+    return (WriteSamplesFunction)apo_write_s32_samples;
+  case UNSIGNED:
+    if (format->bytesPerSample == 1) return (WriteSamplesFunction)apo_write_u8_samples;
+    if (format->bytesPerSample == 2) return (WriteSamplesFunction)apo_write_u16_samples;
+    return (WriteSamplesFunction)apo_write_u32_samples;
+  }
+  return (WriteSamplesFunction)apo_write_float_samples;
+}
+
+static void record_output(void *context, const float *samples, unsigned sampleCount)
+{
+  cliprecording *rec = (cliprecording *)context;
+
+  if (rec->count + sampleCount > rec->capacity) {
+    while (rec->count + sampleCount > rec->capacity) rec->capacity *= 2;
+    rec->samples = (float*)realloc(rec->samples, rec->capacity * sizeof(float));
+  }
+  memcpy(rec->samples + rec->count, samples, sampleCount * sizeof(float));
+  rec->count += sampleCount;
+}
+
+/* Queue a whole file's output from the cache, or play it and cache the
+   output it came to. The pipe is drained before and after, which sends
+   on the last file and restarts every stage, so a clip's output depends
+   only on the clip and the settings in its key. The drained tail, the
+   part past the clip's end, is added into the start of whatever follows
+   rather than played after it, so clips still join without a gap
+   whether they came from the cache or not. The resampler's quality
+   in the key is the governor's at the start; output the governor changed
+   part way through isn't stored. */
+static void play_clip(audiopipeout *ap, playitem *item, WriteSamplesFunction writeSamples)
+{
+  unsigned sampleCount = item->prefetchedBytes / item->format.bytesPerSample;
+  double deviceRate = apo_device_rate(ap);
+  int quality = apo_resampler_quality(ap);
+  unsigned long switchCount = apo_quality_switch_count(ap);
+  clipkey key = item->key;
+  cliprecording rec;
+  clipdata data;
+
+  clipkey_add(&key, &settingsKey, sizeof(settingsKey));
+  clipkey_add(&key, &deviceRate, sizeof(deviceRate));
+  clipkey_add(&key, &quality, sizeof(quality));
+  if (clipcache_lookup(cache, &key, &data) == 0) {
+    apo_write_device_samples(ap, data.samples, data.sampleCount, sampleCount);
+    clipcache_release(&data);
+    return;
+  }
+
+  /* nothing of the last file, then all of this one */
+  apo_drain(ap);
+  rec.count = 0;
+  rec.capacity = (unsigned long)(sampleCount * (2.0 / item->format.channelCount) * deviceRate / item->format.rate) + 4096;
+  rec.samples = (float*)malloc(rec.capacity * sizeof(float));
+  apo_set_output_hook(ap, record_output, &rec);
+  writeSamples(ap, item->prefetched, sampleCount);
+  apo_drain(ap);
+  apo_set_output_hook(ap, NULL, NULL);
+  /* output that spans a change of device rate or quality isn't either one's */
+  if (apo_device_rate(ap) == deviceRate && apo_quality_switch_count(ap) == switchCount) {
+    clipcache_store(cache, &key, rec.samples, rec.count);
+  }
+  free(rec.samples);
+}
+
+static void report_cache(void)
+{
+  clipcachestats stats;
+
+  clipcache_get_stats(cache, &stats);
+  fprintf(stderr, "%s: cache so far %llu hits, %llu misses, %llu stored, %llu evicted; %u clips, %.1f MB\n", tool,
+          stats.hits, stats.misses, stats.stores, stats.evictions, stats.clipCount, stats.bytes / 1048576.0);
+}
+
+/* Play what a producer writes into the ring called name, straight out
+   of the shared memory, until it closes its end. */
+static void play_ring(audiopipeout *ap, const char *name, streamformat *current)
+{
+  shmring *r = shmring_open(name);
+  const shmringformat *ringFormat;
+  streamformat format;
+  WriteSamplesFunction writeSamples;
+
+  if (r == NULL) {
+    perror(name);
+    exit(1);
+  }
+  ringFormat = shmring_format(r);
+  format.sampleFormat = ringFormat->isFloat ? FLOAT : SIGNED;
+  format.bytesPerSample = ringFormat->bytesPerSample;
+  format.swapEndian = 0;
+  format.channelCount = ringFormat->channelCount;
+  format.rate = ringFormat->rate;
+  if (format.channelCount < 1 || format.channelCount > 2 || format.rate <= 0 ||
+      (format.bytesPerSample != 1 && format.bytesPerSample != 2 && format.bytesPerSample != 4) ||
+      (ringFormat->isFloat && format.bytesPerSample != 4)) {
+    fprintf(stderr, "%s: %s holds samples in a format we can't play\n", tool, name);
+    exit(1);
+  }
+  if (format.rate != current->rate || format.channelCount != current->channelCount) {
+    apo_set_rate(ap, format.rate, format.channelCount == 1);
+  }
+  *current = format;
+  writeSamples = write_function(&format);
+
+  while (!shmring_finished(r)) {
+    void *samples;
+    unsigned bytes = shmring_peek(r, &samples);
+    /* hand space back to the producer a little at a time */
+    if (bytes > FEED_SAMPLES * format.bytesPerSample) bytes = FEED_SAMPLES * format.bytesPerSample;
+    if (bytes == 0) continue;
+    writeSamples(ap, samples, bytes / format.bytesPerSample);
+    shmring_consume(r, bytes);
+    report_underruns(ap);
+    report_quality_switches(ap);
+  }
+  shmring_free(r);
+}
+
 int main(int argc, char *argv[]) {
   char ch;
-  enum { SIGNED, UNSIGNED, FLOAT };
   int swapEndian = 0;
   int sampleFormat = SIGNED;
   int channelCount = 2;
   float sampleRate = 44100;
   int bytesPerSample = 2;
+  int storeFormat = STORE_FLOAT;
+  int i;
+  char *dspStages[DSP_MAX_STAGES];
+  int dspStageCount = 0;
+  char *dspPath = NULL;
+  float gainDb = 0.0;
+  int playlistFd = -1;
+  int concealment = CONCEAL_FADE;
+  float stretchFactor = 1.0;
+  char *ringName = NULL;
+  int quality = RESAMPLER_BOX;
+  float budgetPercent = 25;
+  char *cachePath = NULL;
+  float cacheMegabytes = DEFAULT_CACHE_MEGABYTES;
+  char *stdinName = "-";
+  char buf[FEED_SAMPLES * 8];
+  streamformat current;
+  playitem *item;
+  pthread_t prefetcher;
 
   audiopipeout *ap;
 
+  TRACE_INIT();
   tool = argv[0];
-  while ((ch = getopt(argc, argv, "c:sufbwlxr:v")) != -1)
+  while ((ch = getopt(argc, argv, "c:sufbwlxr:vkg:d:D:p:z:t:Q:A:K:M:S:")) != -1)
     switch(ch) {
     case 'v':
       fprintf(stderr, "%s version %s\n", tool, VERSION);
@@ -92,6 +465,47 @@ int main(int argc, char *argv[]) {
     case 'r':
       sampleRate = atof(optarg);
       break;
+    case 'k':
+      storeFormat = STORE_S16;
+      break;
+    case 'g':
+      gainDb = atof(optarg);
+      break;
+    case 'd':
+      if (dspStageCount == DSP_MAX_STAGES) usage();
+      dspStages[dspStageCount++] = optarg;
+      break;
+    case 'D':
+      dspPath = optarg;
+      break;
+    case 'p':
+      playlistFd = atoi(optarg);
+      break;
+    case 'z':
+      if (!strcmp(optarg, "silence")) concealment = CONCEAL_SILENCE;
+      else if (!strcmp(optarg, "fade")) concealment = CONCEAL_FADE;
+      else if (!strcmp(optarg, "repeat")) concealment = CONCEAL_REPEAT;
+      else usage();
+      break;
+    case 't':
+      stretchFactor = atof(optarg);
+      break;
+    case 'Q':
+      quality = resampler_quality_named(optarg);
+      if (quality < 0) usage();
+      break;
+    case 'A':
+      budgetPercent = atof(optarg);
+      break;
+    case 'K':
+      cachePath = optarg;
+      break;
+    case 'M':
+      cacheMegabytes = atof(optarg);
+      break;
+    case 'S':
+      ringName = optarg;
+      break;
     case '?':
     default:
       usage();
@@ -99,8 +513,6 @@ int main(int argc, char *argv[]) {
   argc -= optind;
   argv += optind;
 
-  if (argc > 0) usage();
-
   /* figure sample type */
   if ((sampleFormat == FLOAT) && (swapEndian)) {
     fprintf(stderr, "Can't use swap (-x) with float (-f)\n");
@@ -108,42 +520,108 @@ int main(int argc, char *argv[]) {
   }
 
   if ((channelCount < 1) || (channelCount > 2)) usage();
+  if (stretchFactor < WSOLA_MIN_FACTOR || stretchFactor > WSOLA_MAX_FACTOR) usage();
+  if (budgetPercent < 0 || budgetPercent > 100) usage();
+  if (cacheMegabytes <= 0) usage();
+  if (ringName != NULL && (argc > 0 || playlistFd >= 0)) usage();
+
+  ap = apo_new_elastic(sampleRate, channelCount == 1, QUEUE_MIN_SAMPLES, QUEUE_MAX_SAMPLES, storeFormat);
+  apo_set_concealment(ap, concealment);
+  if (stretchFactor != 1.0) apo_set_time_stretch(ap, stretchFactor);
+  if (quality != RESAMPLER_BOX) apo_set_resampler_quality(ap, quality, budgetPercent / 100);
 
-  ap = apo_new(sampleRate, channelCount == 1, 131072);
+  for (i = 0; i < dspStageCount; i++) {
+    if (dsp_parse(apo_dsp(ap), dspStages[i]) != 0) {
+      fprintf(stderr, "%s: bad processing stage \"%s\"\n", tool, dspStages[i]);
+      exit(1);
+    }
+  }
+  if (dspPath != NULL && dsp_load(apo_dsp(ap), dspPath) != 0) {
+    fprintf(stderr, "%s: bad processing stages in %s\n", tool, dspPath);
+    exit(1);
+  }
+  if (gainDb != 0.0) dsp_add_gain(apo_dsp(ap), gainDb);
+
+  if (cachePath != NULL) {
+    dspchain *dsp = apo_dsp(ap);
+    cache = clipcache_open(cachePath, (unsigned long long)(cacheMegabytes * 1048576));
+    if (cache == NULL) {
+      perror(cachePath);
+      exit(1);
+    }
+    /* everything that shapes the output besides the file and device */
+    clipkey_init(&settingsKey);
+    clipkey_add(&settingsKey, &quality, sizeof(quality));
+    clipkey_add(&settingsKey, &stretchFactor, sizeof(stretchFactor));
+    for (i = 0; i < (int)dsp->stageCount; i++) {
+      dspstage *stage = &dsp->stages[i];
+      clipkey_add(&settingsKey, &stage->type, sizeof(stage->type));
+      clipkey_add(&settingsKey, &stage->targetGain, sizeof(stage->targetGain));
+      clipkey_add(&settingsKey, &stage->kind, sizeof(stage->kind));
+      clipkey_add(&settingsKey, &stage->frequency, sizeof(stage->frequency));
+      clipkey_add(&settingsKey, &stage->q, sizeof(stage->q));
+      clipkey_add(&settingsKey, &stage->gainDb, sizeof(stage->gainDb));
+    }
+  }
 
-  /* a couple of macros to make life easier */
+  defaultFormat.sampleFormat = sampleFormat;
+  defaultFormat.bytesPerSample = bytesPerSample;
+  defaultFormat.swapEndian = swapEndian && (bytesPerSample > 1);
+  defaultFormat.channelCount = channelCount;
+  defaultFormat.rate = sampleRate;
+  current = defaultFormat;
 
-#define FEEDLOOP(BUFFERTYPE, WRITE) \
-while (1) {\
-    count = fread(buf, bytesPerSample, 4096, stdin);\
-    if (count == 0) break;\
-    WRITE(ap, (BUFFERTYPE*)buf, count);}
+  if (ringName != NULL) {
+    play_ring(ap, ringName, &current);
+  } else {
+    fileNames = argv;
+    fileCount = argc;
+    if (playlistFd >= 0) {
+      playlist = fdopen(playlistFd, "r");
+      if (playlist == NULL) {
+        perror("playlist");
+        exit(1);
+      }
+    } else if (argc == 0) {
+      fileNames = &stdinName;
+      fileCount = 1;
+    }
 
-#define FEEDSWAPLOOP(BUFFERTYPE, SWAP, WRITE) \
-while (1) {\
-    count = fread(buf, bytesPerSample, 4096, stdin);\
-    if (count == 0) break;\
-    if (swapEndian) SWAP((BUFFERTYPE*)buf, count);\
-    WRITE(ap, (BUFFERTYPE*)buf, count);}
+    /* the next item is opened and read ahead while this one plays, and
+       each is written straight after the last, so they join seamlessly */
+    pthread_create(&prefetcher, NULL, prefetch_thread, NULL);
+    while ((item = take_item()) != NULL) {
+      WriteSamplesFunction writeSamples = write_function(&item->format);
+      unsigned bytesPerSample = item->format.bytesPerSample;
+      unsigned bytes;
 
-  switch (sampleFormat) {
-    char buf[4096*8];
-    unsigned count;
-    
-  case SIGNED:
-    if (bytesPerSample == 1) FEEDLOOP(char, apo_write_s8_samples)
-    else if (bytesPerSample == 2) FEEDSWAPLOOP(short, swap_16_samples, apo_write_s16_samples)
-    else if (bytesPerSample == 4) FEEDSWAPLOOP(long, swap_32_samples,  apo_write_s32_samples);
-    break;
-  case UNSIGNED:
-    if (bytesPerSample == 1) FEEDLOOP(char, apo_write_u8_samples)
-    else if (bytesPerSample == 2) FEEDSWAPLOOP(unsigned short, swap_16_samples, apo_write_u16_samples)
-    else if (bytesPerSample == 4) FEEDSWAPLOOP(unsigned long, swap_32_samples, apo_write_u32_samples);
-    break;
-  case FLOAT:
-    FEEDLOOP(float, apo_write_float_samples);
+      if (item->format.rate != current.rate || item->format.channelCount != current.channelCount) {
+        apo_set_rate(ap, item->format.rate, item->format.channelCount == 1);
+      }
+      current = item->format;
+      if (cache != NULL && item->isWhole) {
+        play_clip(ap, item, writeSamples);
+        report_underruns(ap);
+        report_quality_switches(ap);
+      } else {
+        writeSamples(ap, item->prefetched, item->prefetchedBytes / bytesPerSample);
+        while ((bytes = read_item(item, buf, FEED_SAMPLES * bytesPerSample)) > 0) {
+          writeSamples(ap, buf, bytes / bytesPerSample);
+          report_underruns(ap);
+          report_quality_switches(ap);
+        }
+      }
+      free_item(item);
+    }
   }
 
-  while (1) sleep(5);
+  apo_wait_until_done(ap);
+  report_underruns(ap);
+  report_quality_switches(ap);
   apo_free(ap);
+  if (cache != NULL) {
+    report_cache();
+    clipcache_close(cache);
+  }
+  exit(0);
 }
@@ -24,17 +24,39 @@
 */
 
 #include "threadedqueue.h"
+#include "trace.h"
+#include <string.h>
+
+/* an elastic queue shrinks once this many buffers' worth has gone
+   through while it was never more than a quarter full */
+#define SETTLE_TURNS 8
 
 void init_threadedqueue(threadedqueue *q, unsigned bufferSize)
+{
+  init_threadedqueue_elastic(q, bufferSize, bufferSize);
+}
+
+void init_threadedqueue_elastic(threadedqueue *q, unsigned minimumSize, unsigned maximumSize)
 {
   pthread_mutex_init(&q->dataLock, NULL);
   pthread_cond_init(&q->addDataLock, NULL);
   pthread_cond_init(&q->removeDataLock, NULL);
-  q->buffer = malloc(bufferSize);
+  if (maximumSize < minimumSize) maximumSize = minimumSize;
+  q->buffer = malloc(maximumSize);
+  q->spare = (maximumSize > minimumSize) ? malloc(maximumSize) : NULL;
+  /* without the memory for a second buffer, the queue doesn't grow */
+  if (q->spare == NULL) maximumSize = minimumSize;
   q->headPointer = 0;
   q->tailPointer = 0;
   q->bytesInQueue = 0;
-  q->maxDataSize = bufferSize;
+  q->maxDataSize = minimumSize;
+  q->minDataSize = minimumSize;
+  q->limitDataSize = maximumSize;
+  q->retired = NULL;
+  q->retiredAt = 0;
+  q->removals = 0;
+  q->flowBytes = 0;
+  q->peakBytes = 0;
 }
 
 void destroy_threadedqueue(threadedqueue *q)
@@ -42,46 +64,169 @@ void destroy_threadedqueue(threadedqueue *q)
   pthread_cond_destroy(&q->removeDataLock);
   pthread_cond_destroy(&q->addDataLock);
   pthread_mutex_destroy(&q->dataLock);
+  free(q->retired);
+  free(q->spare);
   free(q->buffer);
 }
 
+/* Take back the buffer a resize replaced once the reader has removed
+   since: until then it may still be using a pointer from peekBytes. The
+   caller holds the lock. */
+static void reclaimRetired(threadedqueue *q)
+{
+  if (q->retired != NULL && q->removals != q->retiredAt) {
+    q->spare = q->retired;
+    q->retired = NULL;
+  }
+}
+
+/* Move what's queued into the spare buffer, as size bytes. Only
+   addBytes resizes, so nothing is added meanwhile, and the reader only
+   moves the tail, so the queued bytes can be copied without the lock;
+   the lock is held just to see what the reader took in the meantime and
+   swap. The caller has checked there is a spare. */
+static void resize(threadedqueue *q, unsigned size)
+{
+  char *buffer, *old;
+  unsigned tail, count, first, consumed;
+
+  TRACE_BEGIN(queue_resize);
+  pthread_mutex_lock(&q->dataLock);
+  buffer = (char*)q->spare;
+  q->spare = NULL;
+  old = (char*)q->buffer;
+  tail = q->tailPointer;
+  count = q->bytesInQueue;
+  first = q->maxDataSize - tail;
+  pthread_mutex_unlock(&q->dataLock);
+
+  if (first > count) first = count;
+  memcpy(buffer, old + tail, first);
+  memcpy(buffer + first, old, count - first);
+
+  pthread_mutex_lock(&q->dataLock);
+  consumed = count - q->bytesInQueue;
+  q->buffer = buffer;
+  q->maxDataSize = size;
+  q->tailPointer = (consumed < size) ? consumed : 0;
+  q->headPointer = (count < size) ? count : 0;
+  q->retired = old;
+  q->retiredAt = q->removals;
+  q->flowBytes = 0;
+  q->peakBytes = q->bytesInQueue;
+  pthread_mutex_unlock(&q->dataLock);
+  TRACE_END(queue_resize);
+}
+
+/* The elastic sizes either side of the current one. */
+static unsigned grownSize(threadedqueue *q)
+{
+  unsigned size = q->maxDataSize * 2;
+  return (size > q->limitDataSize || size < q->maxDataSize) ? q->limitDataSize : size;
+}
+
+static unsigned shrunkSize(threadedqueue *q)
+{
+  unsigned size = q->minDataSize;
+  while (size * 2 < q->maxDataSize) size *= 2;
+  return size;
+}
+
+/* copy in what fits; the caller holds the lock */
+static unsigned copyIn(threadedqueue *q, const char *mem, unsigned length)
+{
+  unsigned bytesToAdd = q->maxDataSize - q->bytesInQueue;
+  unsigned bytesToAddInPlace;
+  int isWrapping;
+
+  if (bytesToAdd > length) bytesToAdd = length;
+  bytesToAddInPlace = bytesToAdd;
+  isWrapping = (bytesToAdd >= q->maxDataSize - q->headPointer);
+  if (isWrapping) bytesToAddInPlace = q->maxDataSize - q->headPointer;
+  memcpy(((char*)q->buffer)+q->headPointer, mem, bytesToAddInPlace);
+  if (isWrapping) memcpy(q->buffer, mem+bytesToAddInPlace, bytesToAdd-bytesToAddInPlace);
+  q->headPointer += bytesToAdd;
+  if (isWrapping) q->headPointer -= q->maxDataSize;
+  q->bytesInQueue += bytesToAdd;
+  if (bytesToAdd > 0) pthread_cond_broadcast(&q->addDataLock);
+  return bytesToAdd;
+}
+
+/* Adds what fits without waiting and returns how many bytes that was. */
+unsigned addBytesNoWait(threadedqueue *q, const void *bytesPtr, unsigned length)
+{
+  unsigned added;
+  pthread_mutex_lock(&q->dataLock);
+  added = copyIn(q, (const char*)bytesPtr, length);
+  pthread_mutex_unlock(&q->dataLock);
+  return added;
+}
+
+/* Adds all of the bytes without waiting, discarding the oldest queued
+   bytes (and, past the queue's size, the start of these) to make room.
+   Returns how many bytes were lost; queuedBefore gets how many were
+   queued beforehand, which places the loss in the stream. */
+unsigned addBytesOverwriting(threadedqueue *q, const void *bytesPtr, unsigned length, unsigned *queuedBefore)
+{
+  const char *mem = (const char*)bytesPtr;
+  unsigned lost = 0;
+  unsigned overflow;
+
+  pthread_mutex_lock(&q->dataLock);
+  *queuedBefore = q->bytesInQueue;
+  if (length > q->maxDataSize) {
+    lost = length - q->maxDataSize;
+    mem += lost;
+    length = q->maxDataSize;
+  }
+  overflow = q->bytesInQueue + length;
+  if (overflow > q->maxDataSize) {
+    overflow -= q->maxDataSize;
+    q->tailPointer += overflow;
+    if (q->tailPointer >= q->maxDataSize) q->tailPointer -= q->maxDataSize;
+    q->bytesInQueue -= overflow;
+    lost += overflow;
+  }
+  copyIn(q, mem, length);
+  pthread_mutex_unlock(&q->dataLock);
+  return lost;
+}
+
 void addBytes(threadedqueue *q, const void *bytesPtr, unsigned length)
 {
   const char *mem = (const char*)bytesPtr;
 
   while (length > 0) {
     unsigned bytesToAdd;
-    unsigned bytesAvailable;
-    unsigned bytesToAddInPlace;
-    int isWrapping;
-    /* wait until it's safe to add something */
+    int shrink = 0;
+    /* wait until it's safe to add something, or grow */
     pthread_mutex_lock(&q->dataLock);
-    while (1) {
-      /* figure out how much we can add now */
-      bytesAvailable = q->maxDataSize - q->bytesInQueue;
-      if (bytesAvailable > 0) break;
+    reclaimRetired(q);
+    while (q->bytesInQueue == q->maxDataSize) {
+      if (q->maxDataSize < q->limitDataSize && q->spare != NULL) {
+        pthread_mutex_unlock(&q->dataLock);
+        resize(q, grownSize(q));
+        pthread_mutex_lock(&q->dataLock);
+        continue;
+      }
+      TRACE_BEGIN(queue_full_wait);
       pthread_cond_wait(&q->removeDataLock, &q->dataLock);
+      TRACE_END(queue_full_wait);
     }
-    bytesToAdd = length;
-    if (bytesToAdd > bytesAvailable) bytesToAdd = bytesAvailable;
-
-    /* copy to circular buffer */
-    bytesToAddInPlace = bytesToAdd;
-    isWrapping = (bytesToAdd >= q->maxDataSize - q->headPointer);
-    if (isWrapping) bytesToAddInPlace = q->maxDataSize - q->headPointer;
-    memcpy(((char*)q->buffer)+q->headPointer, mem, bytesToAddInPlace);
-    if (isWrapping) memcpy(q->buffer, mem+bytesToAddInPlace, bytesToAdd-bytesToAddInPlace);
-    q->headPointer += bytesToAdd;
-    if (isWrapping) q->headPointer -= q->maxDataSize;
-    q->bytesInQueue += bytesToAdd;
-    
-    if (bytesToAdd > 0) {
-      pthread_cond_broadcast(&q->addDataLock);
+    bytesToAdd = copyIn(q, mem, length);
+    if (q->maxDataSize > q->minDataSize) {
+      q->flowBytes += bytesToAdd;
+      if (q->bytesInQueue > q->peakBytes) q->peakBytes = q->bytesInQueue;
+      if (q->flowBytes >= (unsigned long long)q->maxDataSize * SETTLE_TURNS) {
+        shrink = (q->peakBytes <= q->maxDataSize / 4 && q->spare != NULL);
+        q->flowBytes = 0;
+        q->peakBytes = q->bytesInQueue;
+      }
     }
     pthread_mutex_unlock(&q->dataLock);
+    if (shrink) resize(q, shrunkSize(q));
 
     mem += bytesToAdd;
-    bytesAvailable -= bytesToAdd;
     length -= bytesToAdd;
   }
 }
@@ -111,6 +256,7 @@ void removeBytes(threadedqueue *q, unsigned aByteCount)
 {
   waitForMinimumBytes(q,aByteCount);
   pthread_mutex_lock(&q->dataLock);
+  q->removals++;
 
   while (aByteCount > 0) {
     unsigned bytesToTake;
@@ -150,12 +296,34 @@ unsigned spaceUsed(threadedqueue *q)
   return r;
 }
 
+unsigned queueCapacity(threadedqueue *q)
+{
+  unsigned r;
+  pthread_mutex_lock(&q->dataLock);
+  r = q->maxDataSize;
+  pthread_mutex_unlock(&q->dataLock);
+  return r;
+}
+
 unsigned waitForMinimumBytes(threadedqueue *q, unsigned minimum)
 {
   unsigned r;
   pthread_mutex_lock(&q->dataLock);
   while ((r = q->bytesInQueue) < minimum) {
+    TRACE_BEGIN(queue_empty_wait);
     pthread_cond_wait(&q->addDataLock, &q->dataLock);
+    TRACE_END(queue_empty_wait);
+  }
+  pthread_mutex_unlock(&q->dataLock);
+  return r;
+}
+
+unsigned waitForMaximumBytes(threadedqueue *q, unsigned maximum)
+{
+  unsigned r;
+  pthread_mutex_lock(&q->dataLock);
+  while ((r = q->bytesInQueue) > maximum) {
+    pthread_cond_wait(&q->removeDataLock, &q->dataLock);
   }
   pthread_mutex_unlock(&q->dataLock);
   return r;
@@ -173,6 +341,7 @@ unsigned removeBytesTo(threadedqueue *q, void *bytesPtr, unsigned minimum, unsig
     if (minimum > 0) waitForMinimumBytes(q, minimum);
 
     pthread_mutex_lock(&q->dataLock);
+    q->removals++;
     available = q->bytesInQueue;
     bytesAvailableAtEnd = q->maxDataSize - q->tailPointer;
     src = ((char*)q->buffer) + q->tailPointer;
@@ -199,3 +368,46 @@ unsigned removeBytesTo(threadedqueue *q, void *bytesPtr, unsigned minimum, unsig
   return totalWrit;
 }
 
+
+/* Take whatever is queued, up to maximum bytes, without waiting; for
+   callers that can't block, like a playback callback. */
+unsigned removeBytesNoWait(threadedqueue *q, void *bytesPtr, unsigned maximum)
+{
+  unsigned totalWrit = 0;
+  char *dest = (char*)bytesPtr;
+
+  pthread_mutex_lock(&q->dataLock);
+  q->removals++;
+  while (maximum > 0 && q->bytesInQueue > 0) {
+    unsigned available = q->bytesInQueue;
+    unsigned bytesAvailableAtEnd = q->maxDataSize - q->tailPointer;
+
+    if (available > bytesAvailableAtEnd) available = bytesAvailableAtEnd;
+    if (available > maximum) available = maximum;
+    memcpy(dest, ((char*)q->buffer) + q->tailPointer, available);
+    q->tailPointer += available;
+    if (q->tailPointer >= q->maxDataSize) q->tailPointer -= q->maxDataSize;
+    q->bytesInQueue -= available;
+    maximum -= available;
+    totalWrit += available;
+    dest += available;
+  }
+  if (totalWrit > 0) pthread_cond_broadcast(&q->removeDataLock);
+  pthread_mutex_unlock(&q->dataLock);
+  return totalWrit;
+}
+
+/* Like peekBytes, but returns 0 at once when the queue is empty. */
+unsigned peekBytesNoWait(threadedqueue *q, void **aBytesPtr)
+{
+  unsigned bytesToReturn;
+  unsigned bytesAvailableAtEnd;
+
+  pthread_mutex_lock(&q->dataLock);
+  bytesToReturn = q->bytesInQueue;
+  bytesAvailableAtEnd = q->maxDataSize - q->tailPointer;
+  *aBytesPtr = ((char*)q->buffer) + q->tailPointer;
+  pthread_mutex_unlock(&q->dataLock);
+  if (bytesToReturn > bytesAvailableAtEnd) bytesToReturn = bytesAvailableAtEnd;
+  return bytesToReturn;
+}
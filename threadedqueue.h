@@ -38,15 +38,48 @@ typedef struct
   unsigned headPointer;
   unsigned tailPointer;
   unsigned bytesInQueue;
+  /* the buffer's current size, between the elastic limits */
   unsigned maxDataSize;
+  unsigned minDataSize;
+  unsigned limitDataSize;
+  /* an elastic queue's second buffer, allocated up front at the largest
+     size: the spare, or retired by a resize until the reader has
+     removed since */
+  void *spare;
+  void *retired;
+  unsigned retiredAt;
+  unsigned removals;
+  /* bytes added, and the most queued, since the size last settled */
+  unsigned long long flowBytes;
+  unsigned peakBytes;
 } threadedqueue;
 
 void init_threadedqueue(threadedqueue *q, unsigned bufferSize);
+
+/* A queue whose buffer starts at minimumSize bytes and grows, doubling
+   up to maximumSize, when addBytes finds it full, rather than waiting.
+   After it has turned over several times without being more than a
+   quarter full, addBytes halves it again, down to minimumSize. Two
+   buffers of maximumSize are allocated here and a resize copies from one
+   to the other, so adding and removing never touch the heap; only the
+   part in use gets written. Only addBytes resizes, and it copies outside
+   the lock, so a reader is never held up for longer than it takes to
+   swap buffers. Keep maximumSize a multiple of the sample size; sizes
+   are minimumSize doubled, or maximumSize. */
+void init_threadedqueue_elastic(threadedqueue *q, unsigned minimumSize, unsigned maximumSize);
 void addBytes(threadedqueue *q, const void *bytesPtr, unsigned length);
+unsigned addBytesNoWait(threadedqueue *q, const void *bytesPtr, unsigned length);
+unsigned addBytesOverwriting(threadedqueue *q, const void *bytesPtr, unsigned length, unsigned *queuedBefore);
 unsigned peekBytes(threadedqueue *q, void **aBytesPtr);
+unsigned peekBytesNoWait(threadedqueue *q, void **aBytesPtr);
 void removeBytes(threadedqueue *q, unsigned aByteCount);
 unsigned waitForMinimumBytes(threadedqueue *q, unsigned minimum);
+unsigned waitForMaximumBytes(threadedqueue *q, unsigned maximum);
 unsigned removeBytesTo(threadedqueue *q, void *bytesPtr, unsigned minimum, unsigned maximum);
+unsigned removeBytesNoWait(threadedqueue *q, void *bytesPtr, unsigned maximum);
+unsigned spaceAvailable(threadedqueue *q);
+unsigned spaceUsed(threadedqueue *q);
+unsigned queueCapacity(threadedqueue *q);
 void destroy_threadedqueue(threadedqueue *q);
 
 #endif /* __threaded_queue_h__ */
@@ -0,0 +1,70 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#include "timeline.h"
+
+void init_timeline(timeline *tl, double slope)
+{
+  tl->markCount = 0;
+  tl->slope = slope;
+}
+
+void timeline_set_slope(timeline *tl, double slope)
+{
+  tl->slope = slope;
+}
+
+void timeline_mark(timeline *tl, unsigned long long index, double value)
+{
+  timepoint *p = &tl->points[tl->markCount % TIMELINE_SIZE];
+  p->index = index;
+  p->value = value;
+  /* publish the point before the count that makes it visible */
+  __sync_synchronize();
+  tl->markCount++;
+}
+
+int timeline_lookup(timeline *tl, unsigned long long index, double *value)
+{
+  while (1) {
+    unsigned long count = tl->markCount;
+    unsigned long oldest = (count > TIMELINE_SIZE - 1) ? count - (TIMELINE_SIZE - 1) : 0;
+    unsigned long i = count;
+    timepoint p;
+
+    if (count == 0) return -1;
+    __sync_synchronize();
+    /* newest first; the slot at count is the one being written, so skip it */
+    do {
+      i--;
+      p = tl->points[i % TIMELINE_SIZE];
+    } while (i > oldest && p.index > index);
+    __sync_synchronize();
+    /* if the writer lapped us the point may be torn: try again */
+    if (tl->markCount - oldest >= TIMELINE_SIZE) continue;
+    *value = p.value + ((double)index - (double)p.index) * tl->slope;
+    return 0;
+  }
+}
@@ -0,0 +1,57 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#ifndef __timeline_h__
+#define __timeline_h__
+
+/* A timeline maps a sample index to a value that grows linearly with it,
+   such as the host time a sample is heard. One thread marks points as it
+   learns them and any thread can look up an index. The last
+   TIMELINE_SIZE points are kept, and nothing is locked. */
+
+#define TIMELINE_SIZE 64
+
+typedef struct {
+  unsigned long long index;
+  double value;
+} timepoint;
+
+typedef struct
+{
+  timepoint points[TIMELINE_SIZE];
+  volatile unsigned long markCount;
+  double slope;
+} timeline;
+
+/* slope is the change in value per index between marks */
+void init_timeline(timeline *tl, double slope);
+void timeline_set_slope(timeline *tl, double slope);
+void timeline_mark(timeline *tl, unsigned long long index, double value);
+
+/* Extrapolates from the newest mark at or before index (or the oldest
+   kept). Returns -1 if nothing has been marked yet. */
+int timeline_lookup(timeline *tl, unsigned long long index, double *value);
+
+#endif /* __timeline_h__ */
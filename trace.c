@@ -0,0 +1,194 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+
+#include "trace.h"
+
+#ifdef TRACE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+
+/* a ring holds the newest TRACE_RING_SIZE events of one thread, and
+   trace_init sets aside rings for this many threads */
+#define TRACE_RING_SIZE 65536
+#define TRACE_MAX_THREADS 16
+
+typedef struct {
+  double time;
+  const char *name;
+  double value;
+  char phase;
+} tracerecord;
+
+typedef struct tracering {
+  tracerecord records[TRACE_RING_SIZE];
+  volatile unsigned long count;
+  unsigned threadIndex;
+  char threadName[32];
+} tracering;
+
+volatile int trace_enabled = 0;
+
+static const char *tracePath;
+static double startTime;
+static pthread_mutex_t dumpLock = PTHREAD_MUTEX_INITIALIZER;
+static tracering *rings = NULL;
+static volatile unsigned ringsClaimed = 0;
+static __thread tracering *threadRing = NULL;
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The first event on a thread claims it a ring from the pool, so a
+   device callback neither allocates nor locks. Threads past
+   TRACE_MAX_THREADS go unrecorded. */
+static tracering *ring_for_thread()
+{
+  unsigned index;
+  if (threadRing != NULL) return threadRing;
+  index = __sync_fetch_and_add(&ringsClaimed, 1);
+  if (index >= TRACE_MAX_THREADS) return NULL;
+  threadRing = &rings[index];
+  return threadRing;
+}
+
+void trace_thread_name(const char *name)
+{
+  tracering *ring = ring_for_thread();
+  if (ring != NULL) strncpy(ring->threadName, name, sizeof(ring->threadName) - 1);
+}
+
+void trace_record(const char *name, char phase, double value)
+{
+  tracering *ring = ring_for_thread();
+  tracerecord *r;
+
+  if (ring == NULL) return;
+  r = &ring->records[ring->count % TRACE_RING_SIZE];
+  r->time = now();
+  r->name = name;
+  r->value = value;
+  r->phase = phase;
+  /* publish the record before the count that makes it visible */
+  __sync_synchronize();
+  ring->count++;
+}
+
+int trace_dump(const char *path)
+{
+  FILE *f = fopen(path, "w");
+  const char *separator = "";
+  int pid = getpid();
+  unsigned claimed = ringsClaimed;
+  unsigned n;
+
+  if (f == NULL) return -1;
+  if (claimed > TRACE_MAX_THREADS) claimed = TRACE_MAX_THREADS;
+  fprintf(f, "{\"traceEvents\":[\n");
+  pthread_mutex_lock(&dumpLock);
+  for (n = 0; n < claimed; n++) {
+    tracering *ring = &rings[n];
+    unsigned long count = ring->count;
+    /* a busy thread may be overwriting the oldest records as we go, so
+       leave those out */
+    unsigned long first = (count > TRACE_RING_SIZE) ? count - TRACE_RING_SIZE + TRACE_RING_SIZE / 8 : 0;
+    unsigned long i;
+
+    __sync_synchronize();
+    fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+            separator, pid, ring->threadIndex, ring->threadName);
+    separator = ",\n";
+    for (i = first; i < count; i++) {
+      tracerecord *r = &ring->records[i % TRACE_RING_SIZE];
+      double us = (r->time - startTime) * 1e6;
+      if (r->phase == 'C') {
+        fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%d,\"tid\":%u,\"args\":{\"value\":%g}}",
+                r->name, us, pid, ring->threadIndex, r->value);
+      } else {
+        fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%u}",
+                r->name, r->phase, us, pid, ring->threadIndex);
+      }
+    }
+  }
+  pthread_mutex_unlock(&dumpLock);
+  fprintf(f, "\n]}\n");
+  return fclose(f);
+}
+
+static void dump_at_exit()
+{
+  trace_dump(tracePath);
+}
+
+static void *dump_thread(void *context)
+{
+  sigset_t *signals = (sigset_t *)context;
+  while (1) {
+    int sig;
+    if (sigwait(signals, &sig) == 0) trace_dump(tracePath);
+  }
+  return NULL;
+}
+
+void trace_init(void)
+{
+  static sigset_t signals;
+  pthread_t thread;
+  unsigned i;
+
+  tracePath = getenv("TRACE_FILE");
+  if (tracePath == NULL || trace_enabled) return;
+  /* written through now, so no thread takes page faults on its first
+     events either */
+  rings = (tracering*)malloc(TRACE_MAX_THREADS * sizeof(tracering));
+  memset(rings, 0, TRACE_MAX_THREADS * sizeof(tracering));
+  for (i = 0; i < TRACE_MAX_THREADS; i++) {
+    rings[i].threadIndex = i + 1;
+    snprintf(rings[i].threadName, sizeof(rings[i].threadName), "thread %u", i + 1);
+  }
+  startTime = now();
+  /* threads started from here on inherit the mask, so SIGUSR1 is only
+     ever taken by sigwait */
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+  pthread_create(&thread, NULL, dump_thread, &signals);
+  pthread_detach(thread);
+  atexit(dump_at_exit);
+  trace_enabled = 1;
+  trace_thread_name("main");
+}
+
+#endif /* TRACE */
@@ -0,0 +1,80 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+
+#ifndef __trace_h__
+#define __trace_h__
+
+/* Tracepoints around the events that decide whether audio drops out:
+   callbacks, queue waits, resampling and the tools' I/O. They are only
+   compiled in with -DTRACE (make TRACEFLAGS=-DTRACE), and only record
+   when TRACE_INIT runs with TRACE_FILE set in the environment. Each
+   thread records into its own ring, claimed from a pool TRACE_INIT sets
+   aside, so recording neither locks nor allocates, and the rings are
+   written to TRACE_FILE as Chrome trace JSON (for chrome://tracing or
+   Perfetto) at exit and whenever the process gets SIGUSR1. Where
+   <sys/sdt.h> exists, each tracepoint is also a USDT probe in provider
+   "audiopipe", for perf and bpftrace. */
+
+#ifdef TRACE
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TRACE_PROBE(name) DTRACE_PROBE(audiopipe, name)
+#define TRACE_PROBE1(name, value) DTRACE_PROBE1(audiopipe, name, value)
+#endif
+#endif
+#ifndef TRACE_PROBE
+#define TRACE_PROBE(name)
+#define TRACE_PROBE1(name, value)
+#endif
+
+extern volatile int trace_enabled;
+
+void trace_init(void);
+void trace_thread_name(const char *name);
+void trace_record(const char *name, char phase, double value);
+int trace_dump(const char *path);
+
+/* Call first thing in main, before any threads start, so they all leave
+   SIGUSR1 to the dump thread. */
+#define TRACE_INIT() trace_init()
+#define TRACE_THREAD_NAME(name) do { if (trace_enabled) trace_thread_name(name); } while (0)
+#define TRACE_BEGIN(name) do { TRACE_PROBE(name##__begin); if (trace_enabled) trace_record(#name, 'B', 0); } while (0)
+#define TRACE_END(name) do { TRACE_PROBE(name##__end); if (trace_enabled) trace_record(#name, 'E', 0); } while (0)
+#define TRACE_COUNTER(name, value) do { TRACE_PROBE1(name, (long)(value)); if (trace_enabled) trace_record(#name, 'C', (value)); } while (0)
+
+#else
+
+#define TRACE_INIT()
+#define TRACE_THREAD_NAME(name)
+#define TRACE_BEGIN(name)
+#define TRACE_END(name)
+#define TRACE_COUNTER(name, value)
+
+#endif /* TRACE */
+
+#endif /* __trace_h__ */
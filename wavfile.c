@@ -0,0 +1,163 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#include "wavfile.h"
+#include <string.h>
+
+/* WAV and RF64 fields are little endian regardless of the host */
+
+static unsigned char *put_tag(unsigned char *p, const char *tag)
+{
+  memcpy(p, tag, 4);
+  return p + 4;
+}
+
+static unsigned char *put_16(unsigned char *p, unsigned v)
+{
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+  return p + 2;
+}
+
+static unsigned char *put_32(unsigned char *p, unsigned long v)
+{
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+  p[2] = (v >> 16) & 0xff;
+  p[3] = (v >> 24) & 0xff;
+  return p + 4;
+}
+
+static unsigned char *put_64(unsigned char *p, unsigned long long v)
+{
+  p = put_32(p, (unsigned long)(v & 0xffffffffUL));
+  return put_32(p, (unsigned long)(v >> 32));
+}
+
+void wav_build_header(unsigned char header[WAV_HEADER_SIZE], const wavformat *format, unsigned long long dataBytes)
+{
+  unsigned char *p = header;
+  unsigned blockAlign = format->channelCount * (format->bitsPerSample / 8);
+  unsigned long long riffBytes = dataBytes + WAV_HEADER_SIZE - 8;
+  int isUnknown = (dataBytes == WAV_UNKNOWN_LENGTH);
+  int isRF64 = !isUnknown && (riffBytes > 0xffffffffULL);
+
+  p = put_tag(p, isRF64 ? "RF64" : "RIFF");
+  p = put_32(p, (isRF64 || isUnknown) ? 0xffffffffUL : (unsigned long)riffBytes);
+  p = put_tag(p, "WAVE");
+
+  /* ds64 when needed, otherwise a JUNK chunk of the same size */
+  p = put_tag(p, isRF64 ? "ds64" : "JUNK");
+  p = put_32(p, 28);
+  memset(p, 0, 28);
+  if (isRF64) {
+    put_64(p, riffBytes);
+    put_64(p + 8, dataBytes);
+    put_64(p + 16, blockAlign ? dataBytes / blockAlign : 0);
+  }
+  p += 28;
+
+  p = put_tag(p, "fmt ");
+  p = put_32(p, 16);
+  p = put_16(p, format->isFloat ? 3 : 1);
+  p = put_16(p, format->channelCount);
+  p = put_32(p, format->rate);
+  p = put_32(p, format->rate * blockAlign);
+  p = put_16(p, blockAlign);
+  p = put_16(p, format->bitsPerSample);
+
+  p = put_tag(p, "data");
+  put_32(p, (isRF64 || isUnknown) ? 0xffffffffUL : (unsigned long)dataBytes);
+}
+
+static unsigned get_16(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static unsigned long get_32(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8) | ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static unsigned long long get_64(const unsigned char *p)
+{
+  return get_32(p) | ((unsigned long long)get_32(p + 4) << 32);
+}
+
+/* skip by reading, so pipes work too */
+static int skip_bytes(FILE *f, unsigned long long count)
+{
+  unsigned char buf[256];
+  while (count > 0) {
+    size_t chunk = (count > sizeof(buf)) ? sizeof(buf) : count;
+    if (fread(buf, 1, chunk, f) != chunk) return -1;
+    count -= chunk;
+  }
+  return 0;
+}
+
+int wav_read_header(FILE *f, wavformat *format, unsigned long long *dataBytes)
+{
+  unsigned char p[40];
+  unsigned long long ds64DataBytes = WAV_UNKNOWN_LENGTH;
+  int haveFormat = 0;
+
+  if (fread(p, 1, 12, f) != 12) return -1;
+  if ((memcmp(p, "RIFF", 4) && memcmp(p, "RF64", 4)) || memcmp(p + 8, "WAVE", 4)) return -1;
+
+  while (fread(p, 1, 8, f) == 8) {
+    unsigned long size = get_32(p + 4);
+    unsigned long used = 0;
+
+    if (!memcmp(p, "data", 4)) {
+      if (!haveFormat) return -1;
+      if (size != 0xffffffffUL) *dataBytes = size;
+      else *dataBytes = ds64DataBytes;
+      return 0;
+    }
+    if (!memcmp(p, "ds64", 4) && size >= 16) {
+      if (fread(p, 1, 16, f) != 16) return -1;
+      ds64DataBytes = get_64(p + 8);
+      used = 16;
+    } else if (!memcmp(p, "fmt ", 4) && size >= 16) {
+      unsigned tag;
+      used = (size >= 40) ? 40 : 16;
+      if (fread(p, 1, used, f) != used) return -1;
+      tag = get_16(p);
+      /* WAVE_FORMAT_EXTENSIBLE keeps the real tag in its sub format */
+      if (tag == 0xfffe && used == 40) tag = get_16(p + 24);
+      if (tag != 1 && tag != 3) return -1;
+      format->isFloat = (tag == 3);
+      format->channelCount = get_16(p + 2);
+      format->rate = get_32(p + 4);
+      format->bitsPerSample = get_16(p + 14);
+      haveFormat = 1;
+    }
+    /* chunks are padded to an even length */
+    if (skip_bytes(f, size - used + (size & 1)) != 0) return -1;
+  }
+  return -1;
+}
@@ -0,0 +1,53 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#ifndef __wavfile_h__
+#define __wavfile_h__
+
+#include <stdio.h>
+
+/* Size of the header wav_build_header produces. The header always reserves
+   room for an RF64 ds64 chunk (as a JUNK chunk), so a file that grows past
+   4 GB can be turned into RF64 by rewriting the header in place. */
+#define WAV_HEADER_SIZE 80
+
+/* Pass as dataBytes when the length is unknown, e.g. writing to a pipe. */
+#define WAV_UNKNOWN_LENGTH (~0ULL)
+
+typedef struct {
+  unsigned rate;
+  unsigned channelCount;
+  unsigned bitsPerSample;
+  int isFloat;
+} wavformat;
+
+void wav_build_header(unsigned char header[WAV_HEADER_SIZE], const wavformat *format, unsigned long long dataBytes);
+
+/* Read a WAV or RF64 header from f, leaving it at the first sample. Sets
+   dataBytes to WAV_UNKNOWN_LENGTH when the header doesn't say. Returns -1
+   if f doesn't hold a WAV file, or one of PCM or float samples. */
+int wav_read_header(FILE *f, wavformat *format, unsigned long long *dataBytes);
+
+#endif /* __wavfile_h__ */
@@ -0,0 +1,276 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#include "wsola.h"
+#include "trace.h"
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* segment length, and how far a segment may move to match, in seconds */
+#define WINDOW_SECONDS 0.030
+#define TOLERANCE_SECONDS 0.010
+
+static float clamp_factor(float factor)
+{
+  if (factor < WSOLA_MIN_FACTOR) return WSOLA_MIN_FACTOR;
+  if (factor > WSOLA_MAX_FACTOR) return WSOLA_MAX_FACTOR;
+  return factor;
+}
+
+wsola *wsola_new(float rate, unsigned channelCount, float factor, outputCallback callback)
+{
+  wsola *ws = (wsola *)malloc(sizeof(wsola));
+  unsigned i;
+
+  ws->channelCount = channelCount;
+  ws->factor = clamp_factor(factor);
+  ws->hopFrames = (unsigned)(rate * WINDOW_SECONDS / 2);
+  if (ws->hopFrames < 16) ws->hopFrames = 16;
+  ws->windowFrames = ws->hopFrames * 2;
+  ws->toleranceFrames = (unsigned)(rate * TOLERANCE_SECONDS);
+  /* what a step can need kept, the longest hop plus both tolerances and
+     a window, and at least a window of new input on top */
+  ws->inputCapacity = (unsigned)(ws->hopFrames * WSOLA_MAX_FACTOR) + 2 * ws->toleranceFrames + 3 * ws->windowFrames;
+
+  /* periodic Hann: the halves of overlapping windows sum to one */
+  ws->window = (float *)malloc(ws->windowFrames * sizeof(float));
+  for (i = 0; i < ws->windowFrames; i++) {
+    ws->window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / ws->windowFrames);
+  }
+  ws->input = (float *)malloc(ws->inputCapacity * channelCount * sizeof(float));
+  ws->mono = (float *)malloc(ws->inputCapacity * sizeof(float));
+  ws->overlap = (float *)malloc(ws->hopFrames * channelCount * sizeof(float));
+  ws->output = (float *)malloc(ws->hopFrames * channelCount * sizeof(float));
+  ws->framesIn = 0;
+  ws->context = NULL;
+  ws->callback = callback;
+  wsola_flush(ws);
+  return ws;
+}
+
+void wsola_free(wsola *ws)
+{
+  free(ws->window);
+  free(ws->input);
+  free(ws->mono);
+  free(ws->overlap);
+  free(ws->output);
+  free(ws);
+}
+
+void wsola_set_context(wsola *ws, void *context)
+{
+  ws->context = context;
+}
+
+void wsola_set_factor(wsola *ws, float factor)
+{
+  ws->factor = clamp_factor(factor);
+}
+
+static unsigned append(wsola *ws, const float *samples, unsigned frameCount)
+{
+  unsigned channelCount = ws->channelCount;
+  unsigned take, i, c;
+  float *in, *mono;
+
+  /* a long hop can start past the input seen so far */
+  if (ws->framesIn < ws->base) {
+    take = frameCount;
+    if (take > ws->base - ws->framesIn) take = ws->base - ws->framesIn;
+    ws->framesIn += take;
+    return take;
+  }
+  take = ws->inputCapacity - ws->inputUsed;
+  if (take > frameCount) take = frameCount;
+  in = ws->input + ws->inputUsed * channelCount;
+  mono = ws->mono + ws->inputUsed;
+  memcpy(in, samples, take * channelCount * sizeof(float));
+  for (i = 0; i < take; i++) {
+    float sum = 0.0;
+    for (c = 0; c < channelCount; c++) sum += in[i * channelCount + c];
+    mono[i] = sum;
+  }
+  ws->inputUsed += take;
+  ws->framesIn += take;
+  return take;
+}
+
+/* Normalized correlation of b against a, with four independent sums so
+   the loop pipelines and the compiler can use vector registers. */
+static float similarity(const float *a, const float *b, unsigned n)
+{
+  float c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+  float e0 = 0, e1 = 0, e2 = 0, e3 = 0;
+  unsigned i;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    c0 += a[i] * b[i];
+    c1 += a[i + 1] * b[i + 1];
+    c2 += a[i + 2] * b[i + 2];
+    c3 += a[i + 3] * b[i + 3];
+    e0 += b[i] * b[i];
+    e1 += b[i + 1] * b[i + 1];
+    e2 += b[i + 2] * b[i + 2];
+    e3 += b[i + 3] * b[i + 3];
+  }
+  for (; i < n; i++) {
+    c0 += a[i] * b[i];
+    e0 += b[i] * b[i];
+  }
+  return (c0 + c1 + c2 + c3) / sqrtf(e0 + e1 + e2 + e3 + 1e-9);
+}
+
+/* Where near nominal the input looks most like what would have followed
+   the previous segment: every other shift first, then its neighbours. */
+static unsigned long long best_start(wsola *ws, unsigned long long nominal)
+{
+  unsigned long long low = ws->base, high = nominal + ws->toleranceFrames;
+  const float *target = ws->mono + (ws->previousStart + ws->hopFrames - ws->base);
+  unsigned long long best = nominal, start;
+  float bestScore = similarity(target, ws->mono + (nominal - ws->base), ws->hopFrames);
+
+  if (nominal > low + ws->toleranceFrames) low = nominal - ws->toleranceFrames;
+  for (start = low; start <= high; start += 2) {
+    float score = similarity(target, ws->mono + (start - ws->base), ws->hopFrames);
+    if (score > bestScore) {
+      bestScore = score;
+      best = start;
+    }
+  }
+  for (start = (best > low) ? best - 1 : best; start <= best + 1 && start <= high; start += 2) {
+    float score = similarity(target, ws->mono + (start - ws->base), ws->hopFrames);
+    if (score > bestScore) {
+      bestScore = score;
+      best = start;
+    }
+  }
+  return best;
+}
+
+/* Overlap-add one segment if the input for it has arrived. */
+static int step(wsola *ws)
+{
+  unsigned channelCount = ws->channelCount;
+  unsigned hop = ws->hopFrames;
+  unsigned long long nominal = (unsigned long long)(ws->nominal + 0.5);
+  unsigned long long start;
+  const float *in;
+  unsigned i, c;
+
+  if (nominal + ws->toleranceFrames + ws->windowFrames > ws->base + ws->inputUsed) return 0;
+  start = ws->started ? best_start(ws, nominal) : nominal;
+  in = ws->input + (start - ws->base) * channelCount;
+  for (i = 0; i < hop; i++) {
+    for (c = 0; c < channelCount; c++) {
+      ws->output[i * channelCount + c] = ws->overlap[i * channelCount + c] + in[i * channelCount + c] * ws->window[i];
+      ws->overlap[i * channelCount + c] = in[(hop + i) * channelCount + c] * ws->window[hop + i];
+    }
+  }
+  ws->callback(ws->context, ws->output, hop * channelCount);
+  ws->previousStart = start;
+  ws->started = 1;
+  ws->nominal += hop * ws->factor;
+  return 1;
+}
+
+/* Drop input no later step can reach. */
+static void discard(wsola *ws)
+{
+  unsigned long long nominal = (unsigned long long)(ws->nominal + 0.5);
+  unsigned long long keep = (nominal > ws->toleranceFrames) ? nominal - ws->toleranceFrames : 0;
+  unsigned long long end = ws->base + ws->inputUsed;
+  unsigned shift;
+
+  if (ws->started && ws->previousStart + ws->hopFrames < keep) keep = ws->previousStart + ws->hopFrames;
+  if (keep <= ws->base) return;
+  if (keep >= end) {
+    ws->base = keep;
+    ws->inputUsed = 0;
+    return;
+  }
+  shift = keep - ws->base;
+  memmove(ws->input, ws->input + shift * ws->channelCount, (ws->inputUsed - shift) * ws->channelCount * sizeof(float));
+  memmove(ws->mono, ws->mono + shift, (ws->inputUsed - shift) * sizeof(float));
+  ws->base = keep;
+  ws->inputUsed -= shift;
+}
+
+void wsola_process(wsola *ws, const float *samples, unsigned sampleCount)
+{
+  unsigned frameCount = sampleCount / ws->channelCount;
+
+  assert(sampleCount % ws->channelCount == 0);
+  TRACE_BEGIN(time_stretch);
+  while (frameCount > 0) {
+    unsigned taken = append(ws, samples, frameCount);
+    samples += taken * ws->channelCount;
+    frameCount -= taken;
+    while (step(ws)) ;
+    discard(ws);
+  }
+  TRACE_END(time_stretch);
+}
+
+/* Silence after the end of the input, as much as there's room for, so
+   the segments that reach past it can still be made. */
+static void pad(wsola *ws)
+{
+  unsigned frames = ws->inputCapacity - ws->inputUsed;
+
+  memset(ws->input + ws->inputUsed * ws->channelCount, 0, frames * ws->channelCount * sizeof(float));
+  memset(ws->mono + ws->inputUsed, 0, frames * sizeof(float));
+  ws->inputUsed += frames;
+}
+
+void wsola_flush(wsola *ws)
+{
+  while (ws->nominal < ws->framesIn) {
+    pad(ws);
+    if (!step(ws)) break;
+    discard(ws);
+  }
+  if (ws->started) {
+    /* past the end of the input the tail is only the padding */
+    unsigned long long tailStart = ws->previousStart + ws->hopFrames;
+    unsigned frames = ws->hopFrames;
+
+    if (tailStart + frames > ws->framesIn) frames = (ws->framesIn > tailStart) ? ws->framesIn - tailStart : 0;
+    if (frames > 0) ws->callback(ws->context, ws->overlap, frames * ws->channelCount);
+  }
+  memset(ws->overlap, 0, ws->hopFrames * ws->channelCount * sizeof(float));
+  ws->started = 0;
+  ws->base = ws->framesIn;
+  ws->inputUsed = 0;
+  ws->nominal = ws->framesIn;
+  ws->previousStart = ws->framesIn;
+}
+
+float wsola_next_output_offset(wsola *ws)
+{
+  return (ws->framesIn - ws->nominal) / ws->factor * ws->channelCount;
+}
@@ -0,0 +1,83 @@
+/*
+* Copyright (c) 2002 By Richard Kiss
+*
+* Permission is hereby granted, free of charge, to any person
+* obtaining a copy of this software and associated documentation
+* files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify,
+* merge, publish, distribute, sublicense, and or sell copies of
+* the Software, and to permit persons to whom the Software is furnished
+* to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+* HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#ifndef __wsola_h__
+#define __wsola_h__
+
+#include "resampler.h"
+
+/* Time-stretch by waveform-similarity overlap-add: Hann-windowed
+   segments are taken from the input every hop * factor frames and
+   overlapped every hop frames, each shifted by up to a tolerance to the
+   spot most like the natural continuation of the last one, so speed
+   changes and pitch doesn't. All buffers are allocated up front. */
+
+#define WSOLA_MIN_FACTOR 0.25
+#define WSOLA_MAX_FACTOR 4.0
+
+typedef struct
+{
+  unsigned channelCount;
+  float factor;
+  unsigned windowFrames;
+  unsigned hopFrames;
+  unsigned toleranceFrames;
+  float *window;
+  /* input frames from absolute frame index base on, and their mono mix */
+  float *input;
+  float *mono;
+  unsigned inputCapacity;
+  unsigned inputUsed;
+  unsigned long long base;
+  /* where the next segment would start unshifted, and where the last one
+     actually started */
+  double nominal;
+  unsigned long long previousStart;
+  int started;
+  float *overlap;
+  float *output;
+  unsigned long long framesIn;
+  void *context;
+  outputCallback callback;
+} wsola;
+
+/* factor is input played per output, so 2 is double speed. Output goes
+   to callback, a hop at a time. */
+wsola *wsola_new(float rate, unsigned channelCount, float factor, outputCallback callback);
+void wsola_free(wsola *ws);
+void wsola_set_context(wsola *ws, void *context);
+void wsola_set_factor(wsola *ws, float factor);
+/* sampleCount is interleaved samples, whole frames of them. */
+void wsola_process(wsola *ws, const float *samples, unsigned sampleCount);
+
+/* Make the segments still due from the input so far, padded with
+   silence past its end, then send the tail of the last one, fading out. */
+void wsola_flush(wsola *ws);
+
+/* How far past the next output sample the next input sample will land,
+   in output samples. Used to line up timestamps. */
+float wsola_next_output_offset(wsola *ws);
+
+#endif /* __wsola_h__ */